@@ -0,0 +1,92 @@
+//
+// Benchmark.h: Microbenchmark runner
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#ifndef _BENCHMARKS_BENCHMARK_H
+#define _BENCHMARKS_BENCHMARK_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstddef>
+
+class DataWriter;
+
+//
+// A benchmark case runs a kernel on inputs of a given size (usually, curve
+// points). The setup function, if any, runs before every iteration and is
+// not timed (e.g. to restore a curve modified in place by the kernel).
+// Inputs are owned by the functions, and released with the case.
+//
+
+struct BenchmarkCase {
+  std::string           name;
+  size_t                size   = 0;
+  size_t                points = 0; // Points processed per iteration
+  std::function<void()> setup;
+  std::function<void()> run;
+};
+
+struct BenchmarkResult {
+  std::string name;
+  size_t      size       = 0;
+  size_t      points     = 0;
+  size_t      iterations = 0;
+  double      meanTime   = 0; // s
+  double      minTime    = 0; // s
+  double      maxTime    = 0; // s
+
+  double pointsPerSecond() const;
+};
+
+struct BenchmarkComparison {
+  BenchmarkResult const *baseline = nullptr;
+  BenchmarkResult const *current  = nullptr;
+
+  double change() const; // Relative change of the minimum time
+};
+
+class BenchmarkRunner {
+    std::vector<BenchmarkResult> m_results;
+    double   m_minTime       = .5;
+    unsigned m_minIterations = 1;
+    unsigned m_maxIterations = 1000000;
+
+  public:
+    void setMinTime(double);
+    void setMinIterations(unsigned);
+
+    // Runs the case until both the minimum time and iterations are reached
+    BenchmarkResult const &run(BenchmarkCase const &);
+    std::vector<BenchmarkResult> const &results() const;
+
+    void writeJson(DataWriter &) const;
+
+    // Reads the results from a file written by writeJson
+    static std::vector<BenchmarkResult> readJson(std::string const &path);
+
+    // Pairs the results with those of the baseline with the same name and size
+    static std::vector<BenchmarkComparison> compare(
+      std::vector<BenchmarkResult> const &baseline,
+      std::vector<BenchmarkResult> const &current);
+};
+
+// Keeps the compiler from discarding the results of a kernel
+void benchmarkSink(double);
+
+#endif // _BENCHMARKS_BENCHMARK_H
@@ -0,0 +1,40 @@
+//
+// Kernels.h: LibETC kernels under benchmark
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#ifndef _BENCHMARKS_KERNELS_H
+#define _BENCHMARKS_KERNELS_H
+
+#include "Benchmark.h"
+
+//
+// Sized kernels are run for every curve size. Unsized kernels work on
+// inputs of a fixed size (e.g. detector pixels) and run once.
+//
+
+struct BenchmarkKernel {
+  const char *name;
+  const char *description;
+  bool        sized;
+
+  BenchmarkCase (*make)(size_t size);
+};
+
+std::vector<BenchmarkKernel> const &benchmarkKernels();
+
+#endif // _BENCHMARKS_KERNELS_H
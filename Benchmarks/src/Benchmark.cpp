@@ -0,0 +1,200 @@
+//
+// Benchmark.cpp: Microbenchmark runner
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include <Benchmark.h>
+#include <DataWriter.h>
+#include <yaml-cpp/yaml.h>
+#include <stdexcept>
+#include <algorithm>
+#include <limits>
+#include <ctime>
+
+static volatile double g_sink;
+
+void
+benchmarkSink(double value)
+{
+  g_sink = value;
+}
+
+static inline double
+monotonicTime()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+double
+BenchmarkResult::pointsPerSecond() const
+{
+  return meanTime > 0 ? points / meanTime : 0;
+}
+
+double
+BenchmarkComparison::change() const
+{
+  if (baseline == nullptr || current == nullptr || baseline->minTime <= 0)
+    return 0;
+
+  return current->minTime / baseline->minTime - 1;
+}
+
+void
+BenchmarkRunner::setMinTime(double time)
+{
+  m_minTime = time;
+}
+
+void
+BenchmarkRunner::setMinIterations(unsigned iterations)
+{
+  m_minIterations = std::max(iterations, 1u);
+}
+
+BenchmarkResult const &
+BenchmarkRunner::run(BenchmarkCase const &bench)
+{
+  BenchmarkResult result;
+  double total = 0;
+
+  result.name    = bench.name;
+  result.size    = bench.size;
+  result.points  = bench.points;
+  result.minTime = std::numeric_limits<double>::infinity();
+
+  while (result.iterations < m_minIterations
+         || (total < m_minTime && result.iterations < m_maxIterations)) {
+    double t0, elapsed;
+
+    if (bench.setup)
+      bench.setup();
+
+    t0 = monotonicTime();
+    bench.run();
+    elapsed = monotonicTime() - t0;
+
+    total += elapsed;
+    result.minTime = std::min(result.minTime, elapsed);
+    result.maxTime = std::max(result.maxTime, elapsed);
+    ++result.iterations;
+  }
+
+  result.meanTime = total / result.iterations;
+
+  m_results.push_back(result);
+
+  return m_results.back();
+}
+
+std::vector<BenchmarkResult> const &
+BenchmarkRunner::results() const
+{
+  return m_results;
+}
+
+//
+// Names are plain identifiers, so they are written without escaping. Times
+// are in seconds.
+//
+void
+BenchmarkRunner::writeJson(DataWriter &out) const
+{
+  bool first = true;
+
+  out.write("{\"benchmarks\": [\n");
+
+  for (auto const &r : m_results) {
+    if (!first)
+      out.write(",\n");
+    first = false;
+
+    out.write("  {\"name\": \"" + r.name + "\"");
+    out.write(", \"size\": " + std::to_string(r.size));
+    out.write(", \"points\": " + std::to_string(r.points));
+    out.write(", \"iterations\": " + std::to_string(r.iterations));
+    out.write(", \"meanTime\": ");
+    out.writeScientific(r.meanTime, 6);
+    out.write(", \"minTime\": ");
+    out.writeScientific(r.minTime, 6);
+    out.write(", \"maxTime\": ");
+    out.writeScientific(r.maxTime, 6);
+    out.write(", \"pointsPerSecond\": ");
+    out.writeScientific(r.pointsPerSecond(), 6);
+    out.write("}");
+  }
+
+  out.write("\n]}\n");
+}
+
+// JSON is read as YAML, of which it is a subset
+std::vector<BenchmarkResult>
+BenchmarkRunner::readJson(std::string const &path)
+{
+  std::vector<BenchmarkResult> results;
+
+  try {
+    YAML::Node doc = YAML::LoadFile(path);
+
+    for (auto const &node : doc["benchmarks"]) {
+      BenchmarkResult r;
+
+      r.name       = node["name"].as<std::string>();
+      r.size       = node["size"].as<size_t>();
+      r.points     = node["points"].as<size_t>();
+      r.iterations = node["iterations"].as<size_t>();
+      r.meanTime   = node["meanTime"].as<double>();
+      r.minTime    = node["minTime"].as<double>();
+      r.maxTime    = node["maxTime"].as<double>();
+
+      results.push_back(r);
+    }
+  } catch (YAML::Exception const &e) {
+    throw std::runtime_error(
+      "Cannot read benchmark results from `" + path + "': " + e.what());
+  }
+
+  return results;
+}
+
+std::vector<BenchmarkComparison>
+BenchmarkRunner::compare(
+  std::vector<BenchmarkResult> const &baseline,
+  std::vector<BenchmarkResult> const &current)
+{
+  std::vector<BenchmarkComparison> comparisons;
+
+  for (auto const &r : current) {
+    BenchmarkComparison c;
+
+    c.current = &r;
+
+    for (auto const &b : baseline)
+      if (b.name == r.name && b.size == r.size) {
+        c.baseline = &b;
+        break;
+      }
+
+    comparisons.push_back(c);
+  }
+
+  return comparisons;
+}
@@ -0,0 +1,284 @@
+//
+// Kernels.cpp: LibETC kernels under benchmark
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include <Kernels.h>
+#include <Curve.h>
+#include <Spectrum.h>
+#include <Detector.h>
+#include <SkyModel.h>
+#include <InstrumentModel.h>
+#include <ModelRegistry.h>
+#include <Simulation.h>
+#include <Helpers.h>
+#include <memory>
+#include <random>
+#include <cmath>
+
+#define BENCHMARK_QUERIES    4096
+#define BENCHMARK_SLICE      20
+#define BENCHMARK_WL_MIN     300e-9
+#define BENCHMARK_WL_MAX     1100e-9
+
+//
+// Synthetic input spectrum of the given size, covering both arms. This
+// is a smooth continuum with a few emission lines on top, in the same
+// units as the inputs of Simulation (W / (m^2 sr m), X axis in meters).
+//
+static Spectrum *
+makeInput(size_t size)
+{
+  Spectrum *spectrum = new Spectrum();
+  std::vector<double> x(size), y(size);
+  double step = (BENCHMARK_WL_MAX - BENCHMARK_WL_MIN) / (size - 1);
+
+  for (size_t i = 0; i < size; ++i) {
+    double wl = BENCHMARK_WL_MIN + i * step;
+    double v  = 1e-10 * (1 + .25 * sin(wl * 2e7));
+
+    for (auto line : {486.1e-9, 656.3e-9, 850.0e-9}) {
+      double d = (wl - line) / .5e-9;
+      v += 5e-10 * exp(-.5 * d * d);
+    }
+
+    x[i] = wl;
+    y[i] = v;
+  }
+
+  spectrum->adopt(std::move(x), std::move(y));
+
+  return spectrum;
+}
+
+// Transmission-like curve on a grid shifted half a step from the input's
+static Curve *
+makeTransmission(size_t size)
+{
+  Curve *curve = new Curve();
+  std::vector<double> x(size), y(size);
+  double step = (BENCHMARK_WL_MAX - BENCHMARK_WL_MIN) / (size - 1);
+
+  for (size_t i = 0; i < size; ++i) {
+    x[i] = BENCHMARK_WL_MIN + (i + .5) * step;
+    y[i] = .5 + .4 * cos(x[i] * 1e7);
+  }
+
+  curve->adopt(std::move(x), std::move(y));
+
+  return curve;
+}
+
+static std::shared_ptr<const InstrumentModel>
+instrumentModel()
+{
+  auto model = ModelRegistry::instance()->instrumentModel();
+
+  // Keep the lazy slice loads out of the timings
+  model->loadAllSlices();
+
+  return model;
+}
+
+static BenchmarkCase
+curveGet(size_t size)
+{
+  BenchmarkCase bench;
+  std::shared_ptr<Curve> curve(makeInput(size));
+  auto queries = std::make_shared<std::vector<double>>(BENCHMARK_QUERIES);
+  std::mt19937_64 rng(size);
+  std::uniform_real_distribution<double> dist(
+    BENCHMARK_WL_MIN,
+    BENCHMARK_WL_MAX);
+
+  for (auto &q : *queries)
+    q = dist(rng);
+
+  bench.points = BENCHMARK_QUERIES;
+  bench.run    = [curve, queries] () {
+    double sum = 0;
+
+    for (auto q : *queries)
+      sum += curve->get(q);
+
+    benchmarkSink(sum);
+  };
+
+  return bench;
+}
+
+static BenchmarkCase
+curveMultiply(size_t size)
+{
+  BenchmarkCase bench;
+  std::shared_ptr<Curve> input(makeInput(size));
+  std::shared_ptr<Curve> transmission(makeTransmission(size));
+  auto work = std::make_shared<Curve>();
+
+  bench.points = size;
+  bench.setup  = [input, work] () { *work = *input; };
+  bench.run    = [work, transmission] () { work->multiplyBy(*transmission); };
+
+  return bench;
+}
+
+static BenchmarkCase
+curveIntegral(size_t size)
+{
+  BenchmarkCase bench;
+  std::shared_ptr<Curve> curve(makeInput(size));
+
+  bench.points = size;
+  bench.run    = [curve] () { benchmarkSink(curve->integral()); };
+
+  return bench;
+}
+
+// Dispersion: wavelength to pixel axis, as in makePixelPhotonFlux
+static BenchmarkCase
+spectrumScaleAxis(size_t size)
+{
+  BenchmarkCase bench;
+  auto model = instrumentModel();
+  std::shared_ptr<Spectrum> input(makeInput(size));
+  auto work  = std::make_shared<Spectrum>();
+
+  bench.points = size;
+  bench.setup  = [input, work] () { *work = *input; };
+  bench.run    = [model, work] () {
+    work->scaleAxis(XAxis, *model->wavelengthToPx(BlueArm, BENCHMARK_SLICE));
+  };
+
+  return bench;
+}
+
+// Wavelength to frequency, as in Simulation::normalizeToRMag
+static BenchmarkCase
+spectrumInvertAxis(size_t size)
+{
+  BenchmarkCase bench;
+  std::shared_ptr<Spectrum> input(makeInput(size));
+  auto work = std::make_shared<Spectrum>();
+
+  bench.points = size;
+  bench.setup  = [input, work] () { *work = *input; };
+  bench.run    = [work] () { work->invertAxis(XAxis, SPEED_OF_LIGHT); };
+
+  return bench;
+}
+
+// Dispersion and convolution of one arm and slice
+static BenchmarkCase
+pixelPhotonFlux(size_t size)
+{
+  BenchmarkCase bench;
+  auto model = instrumentModel();
+  std::unique_ptr<Spectrum> input(makeInput(size));
+  std::shared_ptr<Spectrum> atten(
+    model->makeAttenuatedSpectrum(BlueArm, "ML15", *input));
+
+  bench.points = size;
+  bench.run    = [model, atten] () {
+    delete model->makePixelPhotonFlux(BlueArm, BENCHMARK_SLICE, *atten);
+  };
+
+  return bench;
+}
+
+static BenchmarkCase
+skySpectrum(size_t size)
+{
+  BenchmarkCase bench;
+  auto sky = ModelRegistry::instance()->skyModel();
+  std::shared_ptr<Spectrum> input(makeInput(size));
+
+  bench.points = size;
+  bench.run    = [sky, input] () {
+    delete sky->makeSkySpectrum(*input, 1., 0.);
+  };
+
+  return bench;
+}
+
+// The detector stage of simulateAllDetectors, once the flux is sampled
+static BenchmarkCase
+detectorRecalculate(size_t)
+{
+  BenchmarkCase bench;
+  SimulationParams params;
+  auto model = instrumentModel();
+  std::unique_ptr<Spectrum> input(makeInput(10000));
+  std::unique_ptr<Spectrum> atten(
+    model->makeAttenuatedSpectrum(BlueArm, "ML15", *input));
+  std::unique_ptr<Spectrum> flux(
+    model->makePixelPhotonFlux(BlueArm, BENCHMARK_SLICE, *atten));
+  auto det = std::make_shared<Detector>();
+
+  det->setDetector(params.blueDetector);
+  det->setExposureTime(params.exposure);
+  det->setPixelPhotonFlux(*flux);
+
+  bench.size   = DETECTOR_PIXELS;
+  bench.points = DETECTOR_PIXELS;
+  bench.run    = [det] () { det->recalculate(); };
+
+  return bench;
+}
+
+// Everything the Calculator does for a single object, both arms
+static BenchmarkCase
+simulation(size_t size)
+{
+  BenchmarkCase bench;
+  std::shared_ptr<Spectrum> input(makeInput(size));
+
+  instrumentModel();
+
+  bench.points = size;
+  bench.run    = [input] () {
+    SimulationParams params;
+    Simulation sim;
+
+    sim.setInput(*input);
+    sim.normalizeToRMag(params.rABmag);
+    sim.setParams(params);
+    sim.simulateArm(BlueArm);
+    sim.simulateArm(RedArm);
+
+    benchmarkSink(sim.result(RedArm).signal[DETECTOR_PIXELS / 2]);
+  };
+
+  return bench;
+}
+
+static const std::vector<BenchmarkKernel> g_kernels = {
+  {"curve_get",       "Curve::get, random queries",               true,  curveGet},
+  {"curve_multiply",  "Curve::multiplyBy",                        true,  curveMultiply},
+  {"curve_integral",  "Curve::integral",                          true,  curveIntegral},
+  {"spectrum_scale",  "Spectrum::scaleAxis, wavelength to pixel", true,  spectrumScaleAxis},
+  {"spectrum_invert", "Spectrum::invertAxis, to frequency",       true,  spectrumInvertAxis},
+  {"pixel_flux",      "InstrumentModel::makePixelPhotonFlux",     true,  pixelPhotonFlux},
+  {"sky_spectrum",    "SkyModel::makeSkySpectrum",                true,  skySpectrum},
+  {"detector",        "Detector::recalculate",                    false, detectorRecalculate},
+  {"simulation",      "Simulation of both arms",                  true,  simulation}
+};
+
+std::vector<BenchmarkKernel> const &
+benchmarkKernels()
+{
+  return g_kernels;
+}
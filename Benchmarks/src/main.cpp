@@ -0,0 +1,301 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <stdexcept>
+#include <getopt.h>
+#include <DataFileManager.h>
+#include <DataWriter.h>
+#include <ThreadPool.h>
+#include <Benchmark.h>
+#include <Kernels.h>
+
+void
+help(const char *progName)
+{
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr, "\t%s [OPTIONS]\n\n", progName);
+  fprintf(stderr, "Runs microbenchmarks of the LibETC kernels for curves of 1e2, 1e3,\n");
+  fprintf(stderr, "... points and writes the timings as JSON. The results of a\n");
+  fprintf(stderr, "previous run can be passed as a baseline to catch regressions.\n\n");
+  fprintf(stderr, "OPTIONS can be any of the following:\n");
+  fprintf(stderr, "\t-d, --data-dir [DIR]       Add DIR to the data search paths\n");
+  fprintf(stderr, "\t-o, --output [FILE]        Write the JSON results to FILE (default\n");
+  fprintf(stderr, "\t                           is stdout)\n");
+  fprintf(stderr, "\t-b, --bench [NAME]         Run only the benchmark NAME. May be\n");
+  fprintf(stderr, "\t                           given more than once\n");
+  fprintf(stderr, "\t-n, --min-size [N]         Smallest curve size (default 1e2)\n");
+  fprintf(stderr, "\t-m, --max-size [N]         Largest curve size (default 1e7)\n");
+  fprintf(stderr, "\t-t, --min-time [SEC]       Run each benchmark for at least SEC\n");
+  fprintf(stderr, "\t                           seconds (default .5)\n");
+  fprintf(stderr, "\t-i, --iterations [N]       Run each benchmark at least N times\n");
+  fprintf(stderr, "\t                           (default 1)\n");
+  fprintf(stderr, "\t-c, --compare [FILE]       Compare with the results in FILE\n");
+  fprintf(stderr, "\t-r, --max-regression [PCT] Fail if a benchmark is more than PCT\n");
+  fprintf(stderr, "\t                           percent slower than in the baseline\n");
+  fprintf(stderr, "\t                           (default 10)\n");
+  fprintf(stderr, "\t-l, --list                 List the benchmarks and exit\n\n");
+  fprintf(stderr, "\t--help                     This help\n");
+}
+
+static bool
+parseNumber(const char *arg, double &value)
+{
+  char *end;
+
+  value = strtod(arg, &end);
+
+  return *end == '\0' && value >= 0 && !std::isnan(value);
+}
+
+static bool
+selected(std::vector<std::string> const &names, const char *name)
+{
+  if (names.empty())
+    return true;
+
+  for (auto const &n : names)
+    if (n == name)
+      return true;
+
+  return false;
+}
+
+// Returns false if any benchmark regressed beyond the threshold
+static bool
+printComparison(
+  const char *progName,
+  std::vector<BenchmarkComparison> const &comparisons,
+  double maxRegression)
+{
+  bool ok = true;
+
+  fprintf(
+    stderr,
+    "%s: %-16s %9s %12s %12s %9s\n",
+    progName,
+    "benchmark",
+    "size",
+    "base (ms)",
+    "now (ms)",
+    "change");
+
+  for (auto const &c : comparisons) {
+    bool regressed = c.baseline != nullptr && c.change() > maxRegression;
+
+    if (c.baseline == nullptr) {
+      fprintf(
+        stderr,
+        "%s: %-16s %9zu %12s %12.3f %9s\n",
+        progName,
+        c.current->name.c_str(),
+        c.current->size,
+        "-",
+        1e3 * c.current->minTime,
+        "new");
+      continue;
+    }
+
+    fprintf(
+      stderr,
+      "%s: %-16s %9zu %12.3f %12.3f %+8.1f%%%s\n",
+      progName,
+      c.current->name.c_str(),
+      c.current->size,
+      1e3 * c.baseline->minTime,
+      1e3 * c.current->minTime,
+      1e2 * c.change(),
+      regressed ? " REGRESSION" : "");
+
+    if (regressed)
+      ok = false;
+  }
+
+  return ok;
+}
+
+int
+main(int argc, char **argv)
+{
+  std::vector<std::string> names;
+  std::string outputPath;
+  std::string baselinePath;
+  std::vector<BenchmarkResult> baseline;
+  BenchmarkRunner runner;
+  double minSize = 1e2, maxSize = 1e7;
+  double minTime = .5, iterations = 1;
+  double maxRegression = 10;
+  bool ok = true;
+  const char* const short_opt = "d:o:b:n:m:t:i:c:r:lh";
+  int opt;
+  const option long_opt[] = {
+    {"data-dir",       required_argument, nullptr, 'd'},
+    {"output",         required_argument, nullptr, 'o'},
+    {"bench",          required_argument, nullptr, 'b'},
+    {"min-size",       required_argument, nullptr, 'n'},
+    {"max-size",       required_argument, nullptr, 'm'},
+    {"min-time",       required_argument, nullptr, 't'},
+    {"iterations",     required_argument, nullptr, 'i'},
+    {"compare",        required_argument, nullptr, 'c'},
+    {"max-regression", required_argument, nullptr, 'r'},
+    {"list",           no_argument,       nullptr, 'l'},
+    {"help",           no_argument,       nullptr, 'h'},
+    {nullptr,          no_argument,       nullptr, 0}
+  };
+
+  while ((opt = getopt_long(argc, argv, short_opt, long_opt, nullptr)) != -1) {
+    switch (opt) {
+      case 'd':
+        if (!DataFileManager::instance()->addSearchPath(optarg))
+          goto bad_option;
+        break;
+
+      case 'o':
+        outputPath = optarg;
+        break;
+
+      case 'b':
+        names.push_back(optarg);
+        break;
+
+      case 'n':
+        if (!parseNumber(optarg, minSize) || minSize < 2) {
+          fprintf(stderr, "%s: invalid size `%s'\n", argv[0], optarg);
+          goto bad_option;
+        }
+        break;
+
+      case 'm':
+        if (!parseNumber(optarg, maxSize) || maxSize < 2) {
+          fprintf(stderr, "%s: invalid size `%s'\n", argv[0], optarg);
+          goto bad_option;
+        }
+        break;
+
+      case 't':
+        if (!parseNumber(optarg, minTime)) {
+          fprintf(stderr, "%s: invalid time `%s'\n", argv[0], optarg);
+          goto bad_option;
+        }
+        break;
+
+      case 'i':
+        if (!parseNumber(optarg, iterations) || iterations < 1) {
+          fprintf(stderr, "%s: invalid number of iterations `%s'\n", argv[0], optarg);
+          goto bad_option;
+        }
+        break;
+
+      case 'c':
+        baselinePath = optarg;
+        break;
+
+      case 'r':
+        if (!parseNumber(optarg, maxRegression)) {
+          fprintf(stderr, "%s: invalid regression `%s'\n", argv[0], optarg);
+          goto bad_option;
+        }
+        break;
+
+      case 'l':
+        for (auto const &k : benchmarkKernels())
+          printf("%-16s %s\n", k.name, k.description);
+        exit(EXIT_SUCCESS);
+
+      case 'h':
+        help(argv[0]);
+        exit(EXIT_SUCCESS);
+
+      case '?':
+        help(argv[0]);
+        goto bad_option;
+    }
+  }
+
+  if (optind < argc) {
+    fprintf(stderr, "%s: unexpected arguments\n", argv[0]);
+    goto bad_option;
+  }
+
+  for (auto const &n : names) {
+    bool found = false;
+
+    for (auto const &k : benchmarkKernels())
+      if (n == k.name)
+        found = true;
+
+    if (!found) {
+      fprintf(stderr, "%s: unknown benchmark `%s'\n", argv[0], n.c_str());
+      goto bad_option;
+    }
+  }
+
+  runner.setMinTime(minTime);
+  runner.setMinIterations(static_cast<unsigned>(iterations));
+
+  try {
+    if (!baselinePath.empty())
+      baseline = BenchmarkRunner::readJson(baselinePath);
+
+    fprintf(
+      stderr,
+      "%s: running on %u threads\n",
+      argv[0],
+      ThreadPool::instance()->threads());
+
+    for (auto const &kernel : benchmarkKernels()) {
+      if (!selected(names, kernel.name))
+        continue;
+
+      // Sizes are powers of ten, unsized kernels run once
+      for (double size = minSize; size <= maxSize * (1 + 1e-9); size *= 10) {
+        auto n = static_cast<size_t>(std::round(size));
+        BenchmarkCase bench = kernel.make(n);
+
+        bench.name = kernel.name;
+        if (kernel.sized)
+          bench.size = n;
+
+        auto const &r = runner.run(bench);
+
+        fprintf(
+          stderr,
+          "%s: %-16s %9zu %8zu iterations, min %10.3f ms, %10.3e points/s\n",
+          argv[0],
+          r.name.c_str(),
+          r.size,
+          r.iterations,
+          1e3 * r.minTime,
+          r.pointsPerSecond());
+
+        if (!kernel.sized)
+          break;
+      }
+    }
+
+    if (outputPath.empty()) {
+      DataWriter out(stdout);
+      runner.writeJson(out);
+      out.close();
+    } else {
+      DataWriter out(outputPath);
+      runner.writeJson(out);
+      out.close();
+    }
+
+    if (!baselinePath.empty())
+      ok = printComparison(
+        argv[0],
+        BenchmarkRunner::compare(baseline, runner.results()),
+        1e-2 * maxRegression);
+  } catch (std::runtime_error const &e) {
+    fprintf(stderr, "%s: %s\n", argv[0], e.what());
+    exit(EXIT_FAILURE);
+  }
+
+  exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+
+bad_option:
+  fprintf(stderr, "Type `%s --help` for help\n", argv[0]);
+  exit(EXIT_FAILURE);
+}
@@ -20,7 +20,11 @@
 
 #include "CalculationWorker.h"
 #include "GUIHelpers.h"
+#include <ModelRegistry.h>
+#include <JobScheduler.h>
+#include <Tracer.h>
 #include <random>
+#include <cstdio>
 #include <sys/time.h>
 
 static bool g_registered = false;
@@ -38,6 +42,19 @@ CalculationWorker::~CalculationWorker()
 {
   if (m_simulation != nullptr)
     delete m_simulation;
+
+  if (m_sweepSim != nullptr)
+    delete m_sweepSim;
+
+  if (!m_tracePath.empty()) {
+    Tracer::instance()->stop();
+
+    try {
+      Tracer::instance()->write(m_tracePath);
+    } catch (std::runtime_error const &e) {
+      fprintf(stderr, "CalGUI: cannot write trace: %s\n", e.what());
+    }
+  }
 }
 
 void
@@ -46,6 +63,13 @@ CalculationWorker::init()
   if (m_simulation == nullptr) {
     try {
       m_simulation = new Simulation();
+
+      // Pick up changes in the data files without restarting
+      ModelRegistry::instance()->watchDataFiles();
+
+      // Written when the worker goes away
+      m_tracePath = Tracer::startFromEnvironment();
+
       emit done("init");
     } catch (std::runtime_error const &e) {
       emit exception(e.what());
@@ -110,32 +134,36 @@ SNRCurve::SNRCurve()
 }
 
 void
-CalculationWorker::simulateArm(InstrumentArm arm, SNRCurve &curve)
+CalculationWorker::simulateArm(
+    Simulation &sim,
+    InstrumentArm arm,
+    SNRCurve &curve)
 {
   std::default_random_engine generator;
   double ron, invGain;
   struct timeval tv;
   gettimeofday(&tv, nullptr);
 
-  m_simulation->simulateArm(arm);
+  sim.simulateArm(arm);
 
   generator.seed(
         static_cast<uint64_t>(tv.tv_usec)
         + static_cast<uint64_t>(tv.tv_sec) * 1000000ull);
 
-  invGain = 1. / m_simulation->gain();
-  ron = m_simulation->readOutNoise(); // In counts
+  ArmResult const &result = sim.result(arm);
+
+  invGain = 1. / result.gain;
+  ron = result.readOutNoise; // In counts
+
+  curve.wlToPixel  = sim.wlToPixelCurve();
+  curve.wavelength = result.wavelength;
+  curve.signal     = result.signal;
+  curve.noise      = result.noise;
+
   for (unsigned i = 0; i < DETECTOR_PIXELS; ++i) {
-    double electrons = m_simulation->electrons(i);
-    double signal = m_simulation->signal(i);
-    double noise  = m_simulation->noise(i);
-    std::poisson_distribution<int> shotElectrons(electrons);
-
-    curve.wavelength[i] = m_simulation->pxToWavelength(i);
-    curve.wlToPixel     = m_simulation->wlToPixelCurve();
-    curve.signal[i]     = signal;
-    curve.noise[i]      = noise;
-    curve.counts[i]     =
+    std::poisson_distribution<int> shotElectrons(result.electrons[i]);
+
+    curve.counts[i] =
         static_cast<int>(
             invGain * shotElectrons(generator)
           + ron * randNormal());
@@ -144,36 +172,90 @@ CalculationWorker::simulateArm(InstrumentArm arm, SNRCurve &curve)
   curve.initialized = true;
 }
 
+//
+// Simulations run on the library-wide scheduler, so that the one somebody
+// is looking at is served before queued sweep slices. The worker thread
+// just waits for them.
+//
 void
 CalculationWorker::singleShot()
 {
   CalculationProduct result;
 
-  simulateArm(BlueArm, result.blueArm);
-  simulateArm(RedArm,  result.redArm);
+  JobScheduler::instance()->submit(InteractiveJob, [&] () {
+    simulateArm(*m_simulation, BlueArm, result.blueArm);
+    simulateArm(*m_simulation, RedArm,  result.redArm);
+  }).get();
 
   emit dataProduct(result);
 }
 
+//
+// Sweeps run one slice per event of the worker thread. Requests queued
+// in the meantime (e.g. a single-slice simulation) are served between
+// two slices instead of waiting for the whole sweep. A new sweep
+// replaces the one in progress.
+//
 void
 CalculationWorker::allSlices()
+{
+  if (m_sweepSim == nullptr)
+    m_sweepSim = new Simulation();
+
+  m_sweepParams = m_simParams;
+  m_sweepSim->setInput(m_inputSpectrum);
+  m_sweepSim->normalizeToRMag(m_sweepParams.rABmag);
+
+  m_sweepSlice  = 0;
+  ++m_sweepId;
+  scheduleNextSlice();
+}
+
+void
+CalculationWorker::scheduleNextSlice()
+{
+  QMetaObject::invokeMethod(
+        this,
+        "sweepNextSlice",
+        Qt::QueuedConnection,
+        Q_ARG(unsigned, m_sweepId));
+}
+
+void
+CalculationWorker::sweepNextSlice(unsigned id)
 {
   CalculationProduct result;
-  auto paramCopy = m_simParams;
+  auto paramCopy = m_sweepParams;
 
-  for (int i = 0; i < TARSIS_SLICES; ++i) {
-    emit progress(100. * (i + 1.) / TARSIS_SLICES);
+  // Event of a sweep that has been replaced
+  if (id != m_sweepId || m_sweepSlice < 0)
+    return;
 
-    paramCopy.slice = i;
-    m_simulation->setParams(paramCopy);
+  try {
+    TraceSpan span("sweep", "sweepSlice", traceArg("slice", m_sweepSlice));
 
-    simulateArm(BlueArm, result.blueArm);
-    simulateArm(RedArm,  result.redArm);
+    emit progress(100. * (m_sweepSlice + 1.) / TARSIS_SLICES);
+
+    paramCopy.slice = m_sweepSlice;
+
+    JobScheduler::instance()->submit(BulkJob, [&] () {
+      m_sweepSim->setParams(paramCopy);
+      simulateArm(*m_sweepSim, BlueArm, result.blueArm);
+      simulateArm(*m_sweepSim, RedArm,  result.redArm);
+    }).get();
 
     emit dataProduct(result);
-  }
 
-  m_simulation->setParams(m_simParams);
+    if (++m_sweepSlice < TARSIS_SLICES) {
+      scheduleNextSlice();
+    } else {
+      m_sweepSlice = -1;
+      emit done("simulate");
+    }
+  } catch (std::runtime_error const &e) {
+    m_sweepSlice = -1;
+    emit exception(e.what());
+  }
 }
 
 void
@@ -185,12 +267,13 @@ CalculationWorker::simulate()
   }
 
   try {
-    if (m_simParams.slice < 0)
+    // Sweeps report completion when their last slice is done
+    if (m_simParams.slice < 0) {
       allSlices();
-    else
+    } else {
       singleShot();
-
-    emit done("simulate");
+      emit done("simulate");
+    }
 
   } catch (std::runtime_error const &e) {
     emit exception(e.what());
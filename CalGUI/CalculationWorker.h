@@ -54,9 +54,19 @@ class CalculationWorker : public QObject
   bool             m_newSpectrum = false;
   Spectrum         m_inputSpectrum;
 
-  void             simulateArm(InstrumentArm, SNRCurve &);
+  // Slice sweep in progress. It has a simulation of its own, so that
+  // requests served between slices do not alter it.
+  Simulation      *m_sweepSim = nullptr;
+  SimulationParams m_sweepParams;
+  int              m_sweepSlice = -1; // Next slice, -1 if no sweep
+  unsigned         m_sweepId    = 0;  // Tells stale slice events apart
+
+  std::string      m_tracePath; // Empty if not tracing
+
+  void             simulateArm(Simulation &, InstrumentArm, SNRCurve &);
   void             singleShot();
   void             allSlices();
+  void             scheduleNextSlice();
 
 public:
   CalculationWorker(QObject *parent = nullptr);
@@ -68,6 +78,9 @@ public slots:
   void setParams(SimulationParams);
   void simulate();
 
+private slots:
+  void sweepNextSlice(unsigned);
+
 signals:
   void done(QString);
   void progress(qreal);
@@ -12,6 +12,7 @@
 #include <QScatterSeries>
 #include <QValueAxis>
 #include <DataFileManager.h>
+#include <DataWriter.h>
 #include <QProgressBar>
 
 // Thanks tab10
@@ -54,7 +55,10 @@ MainWindow::MainWindow(QWidget *parent)
   m_saveFileDialog->setFileMode(QFileDialog::AnyFile);
   m_saveFileDialog->setAcceptMode(QFileDialog::AcceptSave);
   m_saveFileDialog->setNameFilter(
-        "2-column comma-separated values (*.csv);;All files (*)");
+        "Comma-separated values (*.csv);;"
+        "NumPy arrays (*.npy);;"
+        "Binary tables (*.bin);;"
+        "All files (*)");
 
 
   m_blueSNRWidget = new ZoomableChartWidget();
@@ -564,42 +568,35 @@ bool
 MainWindow::saveDataProduct(std::string const &path)
 {
   bool ok = false;
-  FILE *fp = fopen(path.c_str(), "wb");
-
-  if (fp == nullptr)
-    goto done;
-
-  for (auto &p : m_lastProducts) {
-    for (auto i = 0u; i < DETECTOR_PIXELS; ++i)
-      fprintf(fp, "%s%g", i > 0 ? "," : "", p.blueArm.wavelength[i]);
-    fputc('\n', fp);
-
-    for (auto i = 0u; i < DETECTOR_PIXELS; ++i)
-      fprintf(fp, "%s%g", i > 0 ? "," : "", p.blueArm.signal[i]);
-    fputc('\n', fp);
-
-    for (auto i = 0u; i < DETECTOR_PIXELS; ++i)
-      fprintf(fp, "%s%g", i > 0 ? "," : "", p.blueArm.noise[i]);
-    fputc('\n', fp);
-
-    for (auto i = 0u; i < DETECTOR_PIXELS; ++i)
-      fprintf(fp, "%s%g", i > 0 ? "," : "", p.redArm.wavelength[i]);
-    fputc('\n', fp);
-
-    for (auto i = 0u; i < DETECTOR_PIXELS; ++i)
-      fprintf(fp, "%s%g", i > 0 ? "," : "", p.redArm.signal[i]);
-    fputc('\n', fp);
+  DataWriter *out = nullptr;
+
+  // Six rows per product: wavelength, signal and noise of each arm
+  try {
+    out = new DataWriter(path);
+
+    TableWriter table(
+      *out,
+      TableWriter::formatFromPath(path),
+      6 * m_lastProducts.size(),
+      DETECTOR_PIXELS);
+
+    for (auto &p : m_lastProducts) {
+      table.writeRow(p.blueArm.wavelength);
+      table.writeRow(p.blueArm.signal);
+      table.writeRow(p.blueArm.noise);
+      table.writeRow(p.redArm.wavelength);
+      table.writeRow(p.redArm.signal);
+      table.writeRow(p.redArm.noise);
+    }
 
-    for (auto i = 0u; i < DETECTOR_PIXELS; ++i)
-      fprintf(fp, "%s%g", i > 0 ? "," : "", p.redArm.noise[i]);
-    fputc('\n', fp);
+    out->close();
+    ok = true;
+  } catch (std::runtime_error const &) {
+    ok = false;
   }
 
-  ok = true;
-
-done:
-  if (fp != nullptr)
-    fclose(fp);
+  if (out != nullptr)
+    delete out;
 
   return ok;
 }
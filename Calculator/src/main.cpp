@@ -1,243 +1,853 @@
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
 #include <stdexcept>
+#include <deque>
+#include <future>
 #include <getopt.h>
+#include <CsvReader.h>
 #include <DataFileManager.h>
+#include <DataWriter.h>
+#include <ModelRegistry.h>
+#include <ResultCache.h>
+#include <JobScheduler.h>
+#include <Tracer.h>
 #include <Simulation.h>
 
 void
 help(const char *progName)
 {
   fprintf(stderr, "Usage:\n");
-  fprintf(stderr, "\t%s [OPTIONS] SPECTRUM-FILE\n\n", progName);
+  fprintf(stderr, "\t%s [OPTIONS] SPECTRUM-FILE\n", progName);
+  fprintf(stderr, "\t%s [OPTIONS] -F JOB-FILE\n\n", progName);
   fprintf(stderr, "Calculates the SNR of a surface brightness spectrum\n");
   fprintf(stderr, "as seen by TARSIS. SPECTRUM-FILE must be a CSV-formatted surface\n");
   fprintf(stderr, "brightness (radiance) spectrum, specified in the wavelength\n");
   fprintf(stderr, "axis (nm). \n\nOPTIONS can be any of the following:\n");
   fprintf(stderr, "\t-a, --airmass [AIRMASS]    Set airmass (default is 1)\n");
   fprintf(stderr, "\t-b, --blue-det [DET]       Configure blue arm's detector (default is CCD231-84-0-S77)\n");
+  fprintf(stderr, "\t-B, --binning [SPExSPA]    Set spectral and spatial on-chip binning factors\n");
+  fprintf(stderr, "\t                           (default is 1x1)\n");
+  fprintf(stderr, "\t-C, --cache [N]            Keep up to N batch results in memory for\n");
+  fprintf(stderr, "\t                           repeated jobs (default is 64, 0 disables it)\n");
+  fprintf(stderr, "\t-D, --all-detectors        Simulate every compatible detector of each arm.\n");
+  fprintf(stderr, "\t                           Rows are prefixed by the detector name\n");
   fprintf(stderr, "\t-e, --elevation [ANGLE]    Set elevation angle (same as -z 90-ANGLE,\n");
   fprintf(stderr, "\t                           default is 90)\n");
+  fprintf(stderr, "\t-F, --batch [JOB-FILE]     Run the simulations listed in JOB-FILE (- for\n");
+  fprintf(stderr, "\t                           stdin), one per line. See below\n");
+  fprintf(stderr, "\t-f, --format [FORMAT]      Output format: text (CSV), bin (compact binary)\n");
+  fprintf(stderr, "\t                           or npy (NumPy array). Default is given by the\n");
+  fprintf(stderr, "\t                           output file extension, or text\n");
+  fprintf(stderr, "\t-j, --jobs [N]             Run up to N batch jobs at once (default is 1),\n");
+  fprintf(stderr, "\t                           on up to TARSIS_ETC_THREADS threads\n");
   fprintf(stderr, "\t-m, --magnitude [MAGR_AB]  Normalize spectrum to the specified R(AB)\n");
   fprintf(stderr, "\t                           magnitude (default is 18 mag/arcsec^2)\n");
   fprintf(stderr, "\t-M, --moon [PERCENT]       Set moon illumination, being 0 new\n");
   fprintf(stderr, "\t                           moon and 100 full moon (default is 0)\n");
+  fprintf(stderr, "\t-o, --output [FILE]        Write results to FILE instead of stdout\n");
+  fprintf(stderr, "\t-P, --profile              Print the time spent in each simulation stage\n");
+  fprintf(stderr, "\t                           to stderr\n");
   fprintf(stderr, "\t-r, --red-det [DET]        Configure red arm's detector (default is CCD231-84-0-H69)\n");
+  fprintf(stderr, "\t-S, --cache-stats          Print result cache counters after a batch\n");
   fprintf(stderr, "\t-s, --slice [SLICE]        Slice at which calculations are to be\n");
   fprintf(stderr, "\t                           done (from 1 to 40, default is 20)\n");
+  fprintf(stderr, "\t-T, --trace [FILE]         Write a trace of the simulation stages to FILE,\n");
+  fprintf(stderr, "\t                           in Chrome / Perfetto JSON format\n");
   fprintf(stderr, "\t-t, --exposure [TIME]      Set exposure time, in seconds (default\n");
   fprintf(stderr, "\t                           is 3600 seconds)\n");
   fprintf(stderr, "\t-z, --zenith [ANGLE]       Specify airmass from the zenith angle\n\n");
-  fprintf(stderr, "\t--help                     This help\n");
+  fprintf(stderr, "\t--help                     This help\n\n");
+  fprintf(stderr, "Each line of a JOB-FILE is a SPECTRUM-FILE followed by options\n");
+  fprintf(stderr, "(-F, -j, -C, -T and --help excluded) that override those of the command\n");
+  fprintf(stderr, "line for that job. Empty lines and lines starting with # are\n");
+  fprintf(stderr, "ignored. Results of jobs without -o are written in job order to\n");
+  fprintf(stderr, "the output of the command line, in text mode preceded by a line\n");
+  fprintf(stderr, "`# job LINE: SPECTRUM-FILE'.\n");
 }
 
-bool
-runSimulation(SimulationParams const &params, std::string const &path)
+struct OutputOptions {
+  std::string path;
+  DataFormat  format    = TextFormat;
+  bool        formatSet = false;
+};
+
+struct CommandLine {
+  SimulationParams         params;
+  OutputOptions            output;
+  bool                     allDetectors = false;
+  std::string              batchFile;   // Empty if not in batch mode
+  unsigned                 jobs = 1;
+  unsigned                 cacheSize  = 64;
+  bool                     cacheStats = false;
+  bool                     profile    = false;
+  std::string              tracePath;
+  std::vector<std::string> files;
+};
+
+struct JobResult {
+  bool              ok = false;
+  std::string       error;
+  std::string       data; // Results for the common output
+  SimulationProfile profile;
+};
+
+static ArmResult
+makeProduct(SimulationParams const &params, ArmResult const &result)
+{
+  if (params.binning.spectral != 1 || params.binning.spatial != 1)
+    return result.binned(params.binning);
+
+  return result;
+}
+
+typedef ResultCache<std::vector<ArmResult>> ProductCache;
+
+static void
+printProfile(const char *progName, SimulationProfile const &profile)
+{
+  fprintf(
+    stderr,
+    "%s: %-14s %8s %12s %12s %12s\n",
+    progName,
+    "stage",
+    "calls",
+    "wall (ms)",
+    "cpu (ms)",
+    "points");
+
+  for (auto i = 0; i <= SIMULATION_STAGE_COUNT; ++i) {
+    auto stage = static_cast<SimulationStage>(i);
+    StageProfile s = i < SIMULATION_STAGE_COUNT
+      ? profile.stage(stage)
+      : profile.total();
+
+    fprintf(
+      stderr,
+      "%s: %-14s %8llu %12.3f %12.3f %12llu\n",
+      progName,
+      i < SIMULATION_STAGE_COUNT ? SimulationProfile::stageName(stage) : "total",
+      static_cast<unsigned long long>(s.calls),
+      1e3 * s.wallTime,
+      1e3 * s.cpuTime,
+      static_cast<unsigned long long>(s.points));
+  }
+
+  // Only available in builds with ETC_ALLOC_STATS. Counters are process-wide.
+  AllocationProfile alloc = allocationProfile();
+
+  if (!alloc.enabled)
+    return;
+
+  fprintf(
+    stderr,
+    "%s: %-14s %8s %12s\n",
+    progName,
+    "allocations",
+    "count",
+    "bytes");
+
+  for (auto i = 0; i < ALLOCATION_SITE_COUNT; ++i)
+    fprintf(
+      stderr,
+      "%s: %-14s %8llu %12llu\n",
+      progName,
+      AllocationProfile::siteName(static_cast<AllocationSite>(i)),
+      static_cast<unsigned long long>(alloc.sites[i].count),
+      static_cast<unsigned long long>(alloc.sites[i].bytes));
+
+  fprintf(
+    stderr,
+    "%s: peak live heap: %llu bytes\n",
+    progName,
+    static_cast<unsigned long long>(alloc.peakLiveBytes));
+}
+
+// The profile, if any, accumulates the stage times of the simulation
+static void
+simulate(
+  CommandLine const &cl,
+  CsvReader const &spectrum,
+  std::vector<ArmResult> &products,
+  SimulationProfile *profile = nullptr)
 {
-  bool ok = false;
+  Simulation sim;
   Spectrum input;
-  Simulation *sim = nullptr;
 
-  DataFileManager::instance()->addSearchPath("../data");
+  sim.setProfiling(profile != nullptr);
 
-  try {
-    sim = new Simulation();
+  // Init data
+  input.load(spectrum);
+  input.scaleAxis(XAxis, 1e-9);
 
-    // Init data
-    input.load(path);
-    input.scaleAxis(XAxis, 1e-9);
+  sim.setInput(input);
+  sim.normalizeToRMag(cl.params.rABmag);
 
-    sim->setInput(input);
-    sim->normalizeToRMag(params.rABmag);
+  sim.setParams(cl.params);
 
-    sim->setParams(params);
-    sim->simulateArm(BlueArm);
-    
-    for (auto i = 0; i < DETECTOR_PIXELS; ++i)
-      printf("%s%g", i > 0 ? "," : "", sim->pxToWavelength(i));
-    putchar('\n');
+  if (cl.allDetectors) {
+    for (auto arm : {BlueArm, RedArm})
+      for (auto const &p : sim.simulateAllDetectors(arm))
+        products.push_back(makeProduct(cl.params, p.second));
+  } else {
+    sim.simulateArm(BlueArm);
+    sim.simulateArm(RedArm);
 
-    for (auto i = 0; i < DETECTOR_PIXELS; ++i)
-      printf("%s%g", i > 0 ? "," : "", sim->signal(i));
-    putchar('\n');
+    for (auto arm : {BlueArm, RedArm})
+      products.push_back(makeProduct(cl.params, sim.result(arm)));
+  }
 
-    for (auto i = 0; i < DETECTOR_PIXELS; ++i)
-      printf("%s%g", i > 0 ? "," : "", sim->noise(i));
-    putchar('\n');
+  if (profile != nullptr)
+    profile->merge(sim.profile());
+}
+
+//
+// Three rows (wavelength, signal and noise) per product. When simulating
+// all detectors, rows are labeled by the detector name.
+//
+static void
+writeProducts(
+  DataWriter &out,
+  DataFormat format,
+  std::vector<ArmResult> const &products,
+  bool withName)
+{
+  size_t cols = products.empty() ? 0 : products[0].wavelength.size();
+  TableWriter table(out, format, 3 * products.size(), cols);
 
-    sim->simulateArm(RedArm);
+  for (auto const &product : products) {
+    std::string label = withName ? product.detector : std::string();
 
-    for (auto i = 0; i < DETECTOR_PIXELS; ++i)
-      printf("%s%g", i > 0 ? "," : "", sim->pxToWavelength(i));
-    putchar('\n');
+    table.writeRow(product.wavelength, label);
+    table.writeRow(product.signal, label);
+    table.writeRow(product.noise, label);
+  }
 
-    for (auto i = 0; i < DETECTOR_PIXELS; ++i)
-      printf("%s%g", i > 0 ? "," : "", sim->signal(i));
-    putchar('\n');
+  out.close();
+}
 
+static void
+writeProducts(
+  std::string const &path,
+  DataFormat format,
+  std::vector<ArmResult> const &products,
+  bool withName)
+{
+  DataWriter out(path);
 
-    for (auto i = 0; i < DETECTOR_PIXELS; ++i)
-      printf("%s%g", i > 0 ? "," : "", sim->noise(i));
-    putchar('\n');
+  writeProducts(out, format, products, withName);
+}
 
-    ok = true;
+bool
+runSimulation(CommandLine const &cl)
+{
+  std::vector<ArmResult> products;
+  SimulationProfile profile;
+
+  try {
+    CsvReader spectrum(cl.files[0]);
+
+    simulate(cl, spectrum, products, cl.profile ? &profile : nullptr);
+
+    if (cl.output.path.empty()) {
+      DataWriter out(stdout);
+      writeProducts(out, cl.output.format, products, cl.allDetectors);
+    } else {
+      writeProducts(cl.output.path, cl.output.format, products, cl.allDetectors);
+    }
+
+    if (cl.profile)
+      printProfile(cl.params.progName, profile);
   } catch (std::runtime_error const &e) {
     fprintf(
       stderr,
       "%s: simulation exception: %s\n",
-      params.progName,
+      cl.params.progName,
       e.what());
+    return false;
   }
 
-  if (sim != nullptr)
-    delete sim;
-  
-  return ok;
+  return true;
 }
 
-int
-main(int argc, char **argv)
+static bool
+parseCommandLine(int argc, char **argv, CommandLine &cl, bool jobLine)
 {
-  SimulationParams params;
-  const char* const short_opt = "a:b:e:M:m:r:s:t:z:h";
+  const char* const short_opt = "a:b:B:C:De:F:f:j:M:m:o:Pr:Ss:T:t:z:h";
   double angle;
   int opt;
   const option long_opt[] = {
     {"airmass",         required_argument, nullptr, 'a'},
     {"blue-det",        required_argument, nullptr, 'b'},
+    {"binning",         required_argument, nullptr, 'B'},
+    {"cache",           required_argument, nullptr, 'C'},
+    {"all-detectors",   no_argument,       nullptr, 'D'},
     {"elevation",       required_argument, nullptr, 'e'},
+    {"batch",           required_argument, nullptr, 'F'},
+    {"format",          required_argument, nullptr, 'f'},
+    {"jobs",            required_argument, nullptr, 'j'},
     {"magnitude",       required_argument, nullptr, 'm'},
     {"moon",            required_argument, nullptr, 'M'},
+    {"output",          required_argument, nullptr, 'o'},
+    {"profile",         no_argument,       nullptr, 'P'},
     {"red-det",         required_argument, nullptr, 'r'},
+    {"cache-stats",     no_argument,       nullptr, 'S'},
     {"slice",           required_argument, nullptr, 's'},
+    {"trace",           required_argument, nullptr, 'T'},
     {"exposure",        required_argument, nullptr, 't'},
     {"zenith-distance", required_argument, nullptr, 'z'},
     {"help",            no_argument,       nullptr, 'h'},
     {nullptr,           no_argument,       nullptr, 0}
   };
 
-  params.progName = argv[0];
+  // Job lines are parsed with getopt too. Start over.
+#if defined(__APPLE__) || defined(__FreeBSD__)
+  optreset = 1;
+  optind   = 1;
+#else
+  optind   = 0;
+#endif
 
   while ((opt = getopt_long(argc, argv, short_opt, long_opt, nullptr)) != -1) {
     switch (opt) {
       case 'a':
-        if (sscanf(optarg, "%lg", &params.airmass) < 1) {
+        if (sscanf(optarg, "%lg", &cl.params.airmass) < 1) {
           fprintf(stderr, "%s: invalid airmass `%s'\n", argv[0], optarg);
-          goto bad_option;
+          return false;
         }
         
-        if (params.airmass < 1) {
+        if (cl.params.airmass < 1) {
           fprintf(stderr, "%s: airmass `%s' out of bounds\n", argv[0], optarg);
-          goto bad_option;
+          return false;
         }
         break;
 
       case 'b':
-        params.blueDetector = optarg;
+        cl.params.blueDetector = optarg;
+        break;
+
+      case 'B':
+        if (sscanf(
+              optarg,
+              "%ux%u",
+              &cl.params.binning.spectral,
+              &cl.params.binning.spatial) < 2) {
+          fprintf(stderr, "%s: invalid binning mode `%s'\n", argv[0], optarg);
+          return false;
+        }
+
+        if (!cl.params.binning.isValid()) {
+          fprintf(stderr, "%s: binning mode `%s' out of bounds\n", argv[0], optarg);
+          return false;
+        }
+        break;
+
+      case 'C':
+        if (jobLine) {
+          fprintf(stderr, "%s: -C is not allowed in job lines\n", argv[0]);
+          return false;
+        }
+
+        if (sscanf(optarg, "%u", &cl.cacheSize) < 1) {
+          fprintf(stderr, "%s: invalid cache size `%s'\n", argv[0], optarg);
+          return false;
+        }
+        break;
+
+      case 'D':
+        cl.allDetectors = true;
         break;
 
       case 'e':
         if (sscanf(optarg, "%lg", &angle) < 1) {
           fprintf(stderr, "%s: invalid elevation angle `%s'\n", argv[0], optarg);
-          goto bad_option;
+          return false;
         }
 
         if (angle < 0 || angle > 90) {
           fprintf(stderr, "%s: elevation angle `%s' out of bounds\n", argv[0], optarg);
-          goto bad_option;
+          return false;
+        }
+
+        cl.params.airmass = 1. / cos((90 - angle) * M_PI / 180.);
+        break;
+
+      case 'F':
+        if (jobLine) {
+          fprintf(stderr, "%s: batches cannot be nested\n", argv[0]);
+          return false;
         }
 
-        params.airmass = 1. / cos((90 - angle) * M_PI / 180.);
+        cl.batchFile = optarg;
+        break;
+
+      case 'f':
+        if (!TableWriter::parseFormat(optarg, cl.output.format)) {
+          fprintf(stderr, "%s: invalid output format `%s'\n", argv[0], optarg);
+          return false;
+        }
+        cl.output.formatSet = true;
+        break;
+
+      case 'j':
+        if (jobLine) {
+          fprintf(stderr, "%s: -j is not allowed in job lines\n", argv[0]);
+          return false;
+        }
+
+        if (sscanf(optarg, "%u", &cl.jobs) < 1 || cl.jobs < 1) {
+          fprintf(stderr, "%s: invalid number of jobs `%s'\n", argv[0], optarg);
+          return false;
+        }
         break;
       
       case 'm':
-        if (sscanf(optarg, "%lg", &params.rABmag) < 1) {
+        if (sscanf(optarg, "%lg", &cl.params.rABmag) < 1) {
           fprintf(stderr, "%s: invalid r(AB) magnitude `%s'\n", argv[0], optarg);
-          goto bad_option;
+          return false;
         }
         break;
       
       case 'M':
-        if (sscanf(optarg, "%lg", &params.moon) < 1) {
+        if (sscanf(optarg, "%lg", &cl.params.moon) < 1) {
           fprintf(stderr, "%s: invalid moon illumination `%s'\n", argv[0], optarg);
-          goto bad_option;
+          return false;
         }
 
-        if (params.moon < 0 || params.moon > 100) {
+        if (cl.params.moon < 0 || cl.params.moon > 100) {
           fprintf(stderr, "%s: moon illumination `%s' out of bounds\n", argv[0], optarg);
-          goto bad_option;
+          return false;
         }
         break;
 
+      case 'o':
+        cl.output.path = optarg;
+        break;
+
+      case 'P':
+        cl.profile = true;
+        break;
+
       case 'r':
-        params.redDetector = optarg;
+        cl.params.redDetector = optarg;
         break;
       
+      case 'S':
+        cl.cacheStats = true;
+        break;
+
       case 's':
-        if (sscanf(optarg, "%u", &params.slice) < 1) {
+        if (sscanf(optarg, "%u", &cl.params.slice) < 1) {
           fprintf(stderr, "%s: invalid slice number `%s'\n", argv[0], optarg);
-          goto bad_option;
+          return false;
         }
 
-        if (params.slice < 1 || params.slice > 40) {
+        if (cl.params.slice < 1 || cl.params.slice > 40) {
           fprintf(stderr, "%s: slice `%s' out of bounds\n", argv[0], optarg);
-          goto bad_option;
+          return false;
         }
         break;
 
+      case 'T':
+        if (jobLine) {
+          fprintf(stderr, "%s: -T is not allowed in job lines\n", argv[0]);
+          return false;
+        }
+
+        cl.tracePath = optarg;
+        break;
+
       case 't':
-        if (sscanf(optarg, "%lg", &params.exposure) < 1) {
+        if (sscanf(optarg, "%lg", &cl.params.exposure) < 1) {
           fprintf(stderr, "%s: invalid exposure time `%s'\n", argv[0], optarg);
-          goto bad_option;
+          return false;
         }
 
-        if (params.exposure < 0) {
+        if (cl.params.exposure < 0) {
           fprintf(stderr, "%s: exposure time `%s' out of bounds\n", argv[0], optarg);
-          goto bad_option;
+          return false;
         }
         break;
 
       case 'z':
         if (sscanf(optarg, "%lg", &angle) < 1) {
           fprintf(stderr, "%s: invalid zenith distance `%s'\n", argv[0], optarg);
-          goto bad_option;
+          return false;
         }
 
         if (angle < 0 || angle > 90) {
           fprintf(stderr, "%s: zenith distance `%s' out of bounds\n", argv[0], optarg);
-          goto bad_option;
+          return false;
         }
 
-        params.airmass = 1. / cos(angle * M_PI / 180.);
+        cl.params.airmass = 1. / cos(angle * M_PI / 180.);
         break;
 
       case 'h':
+        if (jobLine) {
+          fprintf(stderr, "%s: --help is not allowed in job lines\n", argv[0]);
+          return false;
+        }
+
         help(argv[0]);
         exit(EXIT_SUCCESS);
 
       case '?':
-        help(argv[0]);
-        goto bad_option;
+        if (!jobLine)
+          help(argv[0]);
+        return false;
     }
   }
 
-  if (optind == argc) {
-    fprintf(stderr, "%s: no input spectrum specified\n", argv[0]);
-    help(argv[0]);
-    exit(EXIT_FAILURE);
+  cl.files.clear();
+  for (auto i = optind; i < argc; ++i)
+    cl.files.push_back(argv[i]);
+
+  return true;
+}
+
+//
+// Split a job line in words. Words can be quoted with single or double
+// quotes, and a word starting with # begins a comment.
+//
+static bool
+splitJobLine(std::string const &line, std::vector<std::string> &words)
+{
+  size_t p = 0;
+
+  words.clear();
+
+  for (;;) {
+    std::string word;
+
+    while (p < line.size() && isspace(static_cast<unsigned char>(line[p])))
+      ++p;
+
+    if (p == line.size() || line[p] == '#')
+      return true;
+
+    while (p < line.size() && !isspace(static_cast<unsigned char>(line[p]))) {
+      if (line[p] == '"' || line[p] == '\'') {
+        auto end = line.find(line[p], p + 1);
+        if (end == std::string::npos)
+          return false;
+
+        word.append(line, p + 1, end - p - 1);
+        p = end + 1;
+      } else {
+        word.push_back(line[p++]);
+      }
+    }
+
+    words.push_back(word);
+  }
+}
+
+//
+// Jobs simulating the same spectrum contents with the same parameters
+// share their products, even if their output options differ.
+//
+static JobResult
+runJob(CommandLine const &job, ProductCache &cache)
+{
+  JobResult result;
+  TraceSpan span("job", job.files[0]);
+
+  try {
+    std::string contents = fileContents(job.files[0]);
+    auto key = simulationKey(
+      job.params,
+      job.allDetectors ? "all" : "",
+      contents);
+    auto products = cache.get(key, [&] () {
+      auto products = new std::vector<ArmResult>();
+
+      try {
+        CsvReader spectrum(contents.data(), contents.size(), job.files[0]);
+        simulate(
+          job,
+          spectrum,
+          *products,
+          job.profile ? &result.profile : nullptr);
+      } catch (...) {
+        delete products;
+        throw;
+      }
+
+      return products;
+    });
+
+    if (job.output.path.empty()) {
+      DataWriter out(&result.data);
+      writeProducts(out, job.output.format, *products, job.allDetectors);
+    } else {
+      writeProducts(
+        job.output.path,
+        job.output.format,
+        *products,
+        job.allDetectors);
+    }
+
+    result.ok = true;
+  } catch (std::runtime_error const &e) {
+    result.error = e.what();
+  }
+
+  return result;
+}
+
+struct PendingJob {
+  unsigned               line;
+  std::string            file;
+  bool                   text;
+  std::future<JobResult> result;
+};
+
+//
+// Jobs are read as they are needed, run in parallel and their results
+// written in job order. Up to cl.jobs jobs are kept in flight. They run
+// as bulk work of the library-wide scheduler, so that they share its
+// threads with the rest of the process.
+//
+bool
+runBatch(CommandLine const &cl)
+{
+  FILE *fp = stdin;
+  char *lineBuf = nullptr;
+  size_t lineSize = 0;
+  unsigned lineNum = 0;
+  bool ok = true;
+  DataWriter *out = nullptr;
+  std::deque<PendingJob> pending;
+  std::vector<std::string> words;
+  SimulationProfile profile;
+  ProductCache cache(cl.cacheSize);
+  auto registry = ModelRegistry::instance();
+
+  // Keep the models loaded for the whole batch
+  auto skyModel    = registry->skyModel();
+  auto tarsisModel = registry->instrumentModel();
+  auto cousinsR    = registry->cousinsRFilter();
+
+  if (cl.batchFile != "-" && (fp = fopen(cl.batchFile.c_str(), "r")) == nullptr) {
+    fprintf(
+      stderr,
+      "%s: cannot open `%s': %s\n",
+      cl.params.progName,
+      cl.batchFile.c_str(),
+      strerror(errno));
+    return false;
+  }
+
+  try {
+    if (cl.output.path.empty())
+      out = new DataWriter(stdout);
+    else
+      out = new DataWriter(cl.output.path);
+  } catch (std::runtime_error const &e) {
+    fprintf(stderr, "%s: %s\n", cl.params.progName, e.what());
+    if (fp != stdin)
+      fclose(fp);
+    return false;
+  }
+
+  auto finishOne = [&] () {
+    auto &job = pending.front();
+    auto result = job.result.get();
+
+    profile.merge(result.profile);
+
+    if (result.ok) {
+      if (job.text) {
+        out->write("# job " + std::to_string(job.line) + ": " + job.file + "\n");
+      }
+      out->write(result.data);
+      out->flush();
+    } else {
+      fprintf(
+        stderr,
+        "%s: job %u (%s): simulation exception: %s\n",
+        cl.params.progName,
+        job.line,
+        job.file.c_str(),
+        result.error.c_str());
+      ok = false;
+    }
+
+    pending.pop_front();
+  };
+
+  try {
+    while (getline(&lineBuf, &lineSize, fp) != -1) {
+      CommandLine job = cl;
+      std::vector<char *> argv;
+      std::string line = lineBuf;
+
+      ++lineNum;
+
+      if (!line.empty() && line.back() == '\n')
+        line.pop_back();
+
+      if (!splitJobLine(line, words)) {
+        fprintf(
+          stderr,
+          "%s: job %u: unterminated quote\n",
+          cl.params.progName,
+          lineNum);
+        ok = false;
+        continue;
+      }
+
+      if (words.empty())
+        continue;
+
+      // Job options override those of the command line, output included
+      job.output.path.clear();
+
+      argv.push_back(const_cast<char *>(cl.params.progName));
+      for (auto &w : words)
+        argv.push_back(&w[0]);
+      argv.push_back(nullptr);
+
+      if (!parseCommandLine(
+            static_cast<int>(argv.size() - 1),
+            argv.data(),
+            job,
+            true)
+          || job.files.size() != 1) {
+        fprintf(
+          stderr,
+          "%s: job %u: %s\n",
+          cl.params.progName,
+          lineNum,
+          job.files.size() > 1 ? "too many input files" : "invalid job");
+        ok = false;
+        continue;
+      }
+
+      if (!job.output.formatSet && !job.output.path.empty())
+        job.output.format = TableWriter::formatFromPath(job.output.path);
+
+      while (pending.size() >= cl.jobs)
+        finishOne();
+
+      PendingJob newJob;
+
+      newJob.line   = lineNum;
+      newJob.file   = job.files[0];
+      newJob.text   = job.output.path.empty() && job.output.format == TextFormat;
+      newJob.result = JobScheduler::instance()->submit(
+        BulkJob,
+        [job, &cache] () { return runJob(job, cache); });
+
+      pending.push_back(std::move(newJob));
+    }
+
+    while (!pending.empty())
+      finishOne();
+
+    out->close();
+  } catch (std::runtime_error const &e) {
+    fprintf(stderr, "%s: %s\n", cl.params.progName, e.what());
+    ok = false;
+  }
+
+  // Jobs still running must finish before we leave
+  for (auto &job : pending)
+    job.result.wait();
+
+  delete out;
+
+  if (cl.profile)
+    printProfile(cl.params.progName, profile);
+
+  if (cl.cacheStats) {
+    auto stats = cache.stats();
+
+    fprintf(
+      stderr,
+      "%s: result cache: %llu hits, %llu misses, %llu coalesced, "
+      "%llu evictions, %zu/%zu entries\n",
+      cl.params.progName,
+      static_cast<unsigned long long>(stats.hits),
+      static_cast<unsigned long long>(stats.misses),
+      static_cast<unsigned long long>(stats.coalesced),
+      static_cast<unsigned long long>(stats.evictions),
+      stats.entries,
+      stats.capacity);
   }
 
-  if (optind + 1 < argc) {
-    fprintf(stderr, "%s: too many input files\n", argv[0]);
+  if (lineBuf != nullptr)
+    free(lineBuf);
+
+  if (fp != stdin)
+    fclose(fp);
+
+  return ok;
+}
+
+int
+main(int argc, char **argv)
+{
+  CommandLine cl;
+  bool ok;
+
+  cl.params.progName = argv[0];
+
+  if (!parseCommandLine(argc, argv, cl, false))
+    goto bad_option;
+
+  if (!cl.output.formatSet && !cl.output.path.empty())
+    cl.output.format = TableWriter::formatFromPath(cl.output.path);
+
+  if (cl.batchFile.empty()) {
+    if (cl.files.empty()) {
+      fprintf(stderr, "%s: no input spectrum specified\n", argv[0]);
+      help(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+
+    if (cl.files.size() > 1) {
+      fprintf(stderr, "%s: too many input files\n", argv[0]);
+      help(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  } else if (!cl.files.empty()) {
+    fprintf(stderr, "%s: input files cannot be given in batch mode\n", argv[0]);
     help(argv[0]);
     exit(EXIT_FAILURE);
   }
 
-  if (!runSimulation(params, argv[optind]))
+  // Once, for every simulation of this run
+  DataFileManager::instance()->addSearchPath("../data");
+
+  if (!cl.tracePath.empty())
+    Tracer::instance()->start();
+
+  if (!cl.batchFile.empty())
+    ok = runBatch(cl);
+  else
+    ok = runSimulation(cl);
+
+  if (!cl.tracePath.empty()) {
+    Tracer::instance()->stop();
+
+    try {
+      Tracer::instance()->write(cl.tracePath);
+    } catch (std::runtime_error const &e) {
+      fprintf(stderr, "%s: cannot write trace: %s\n", argv[0], e.what());
+      ok = false;
+    }
+  }
+
+  if (!ok)
     exit(EXIT_FAILURE);
-  
+
   exit(EXIT_SUCCESS);
 
 bad_option:
   fprintf(stderr, "Type `%s --help` for help\n", argv[0]);
   exit(EXIT_FAILURE);
-}
\ No newline at end of file
+}
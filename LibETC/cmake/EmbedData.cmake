@@ -0,0 +1,42 @@
+# Turn data files into a C++ source file with their contents as arrays.
+#
+# Usage: cmake -DDATA_DIR=dir -DFILES="a.csv;config/b.yaml" -DOUTPUT=out.cpp
+#              -P EmbedData.cmake
+#
+# FILES are relative to DATA_DIR, and are looked up by these names.
+
+set(SOURCE "// Generated by EmbedData.cmake. Do not edit.\n\n")
+string(APPEND SOURCE "#include <EmbeddedData.h>\n\n")
+
+# 16 bytes per line. CMake regexes have no {n} quantifier.
+set(LINE_REGEX "")
+foreach(I RANGE 1 16)
+  string(APPEND LINE_REGEX "0x..,")
+endforeach()
+
+set(INDEX 0)
+set(TABLE "")
+
+foreach(FILE ${FILES})
+  file(READ "${DATA_DIR}/${FILE}" HEX HEX)
+  string(LENGTH "${HEX}" SIZE)
+  math(EXPR SIZE "${SIZE} / 2")
+
+  string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," BYTES "${HEX}")
+  string(REGEX REPLACE "(${LINE_REGEX})" "\\1\n  " BYTES "${BYTES}")
+
+  string(APPEND SOURCE "// ${FILE}\n")
+  string(APPEND SOURCE "static const unsigned char file${INDEX}[] = {\n  ${BYTES}0x00\n};\n\n")
+  string(APPEND TABLE "  {\"${FILE}\", file${INDEX}, ${SIZE}},\n")
+
+  math(EXPR INDEX "${INDEX} + 1")
+endforeach()
+
+string(APPEND SOURCE "extern EmbeddedDataFile const g_embeddedDataFiles[] = {\n")
+string(APPEND SOURCE "${TABLE}  {nullptr, nullptr, 0}\n};\n\n")
+string(APPEND SOURCE "extern size_t const g_embeddedDataFileCount = ${INDEX};\n")
+
+file(WRITE "${OUTPUT}.tmp" "${SOURCE}")
+execute_process(
+  COMMAND ${CMAKE_COMMAND} -E copy_if_different "${OUTPUT}.tmp" "${OUTPUT}")
+file(REMOVE "${OUTPUT}.tmp")
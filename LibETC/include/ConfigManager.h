@@ -24,6 +24,9 @@
 #include <string>
 #include <list>
 #include <map>
+#include <mutex>
+#include <atomic>
+#include <functional>
 #include <yaml-cpp/yaml.h>
 
 #define CONFIG_MANAGER_DIRECTORY "config"
@@ -81,46 +84,88 @@ class Config {
     }
 };
 
+typedef std::function<Config *(std::string const &)> ConfigFactory;
+
+//
+// Configs are published as immutable snapshots of the name -> config
+// table. Readers take the current snapshot with a single atomic load;
+// loading a new config or reloading an existing one builds a new snapshot
+// and swaps it in. Neither config objects nor snapshots are ever freed, as
+// readers may hold pointers to them for as long as they want. Readers only
+// get const configs: configs are only modified by the manager.
+//
+
+struct ConfigSnapshot {
+  unsigned                         version = 0;
+  std::map<std::string, Config *>  configs;
+
+  Config const *find(std::string const &name) const;
+};
+
 class ConfigManager {
     static ConfigManager *g_instance;
 
     std::string                      m_configDir;
     std::list<Config *>              m_configList;
-    std::map<std::string, Config *>  m_configCache;
+    std::list<const Config *>        m_retiredList; // Replaced by reload()
+    std::list<const ConfigSnapshot *> m_retiredSnapshots; // Replaced by publish()
+    std::map<std::string, ConfigFactory> m_factories;
     bool                             m_canSaveConfig = false;
+    std::once_flag                   m_configDirFlag;
+
+    // m_mutex serializes writers only
+    std::mutex                          m_mutex;
+    std::atomic<const ConfigSnapshot *> m_snapshot;
 
     ConfigManager();
 
+    void publish(std::string const &name, Config *config);
+    bool prepareConfigDir();
+
   public:
     static ConfigManager *instance();
     bool saveAll();
 
-    std::string getConfigFilePath(std::string const &name, bool write) const;
+    // Write paths are empty if there is no writable config directory
+    std::string getConfigFilePath(std::string const &name, bool write);
+
+    // Load a config again from its file. The config object is replaced
+    // by a new one, the old one is kept alive for its current users.
+    bool reload(std::string const &name);
 
-    template <class T> T *
+    ConfigSnapshot const *snapshot() const;
+    unsigned version() const;
+
+    template <class T> const T *
     getConfig(std::string const &name)
     {
-      auto it = m_configCache.find(name);
-      T *retVal = nullptr;
+      Config const *config;
 
-      if (it == m_configCache.end()) {
-        // Create new config!
-        auto newConfig = new T(name);
-        
-        newConfig->load();
+      if ((config = snapshot()->find(name)) != nullptr)
+        return static_cast<const T *>(config);
 
-        m_configList.push_back(newConfig);
-        m_configCache[name] = newConfig;
+      std::lock_guard<std::mutex> guard(m_mutex);
 
-        retVal = newConfig;
-      } else {
-        retVal = static_cast<T *>(it->second);
-      }
+      // Someone may have loaded it while we were waiting
+      if ((config = snapshot()->find(name)) != nullptr)
+        return static_cast<const T *>(config);
+
+      // Create new config!
+      auto newConfig = new T(name);
+
+      newConfig->load();
+
+      m_configList.push_back(newConfig);
+      m_factories[name] = [] (std::string const &name) -> Config * {
+        return new T(name);
+      };
+
+      publish(name, newConfig);
 
-      return static_cast<T *>(retVal);
+      return newConfig;
     }
 
-    template <class T> static T &
+    template <class T> static const T &
     get(std::string const &name)
     {
       auto cfg = instance()->getConfig<T>(name);
@@ -0,0 +1,105 @@
+//
+// CsvReader.h: Fast reader of numeric CSV files
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#ifndef _ETC_CSV_READER_H
+#define _ETC_CSV_READER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+
+enum CsvIssueKind {
+  CsvInvalidValue, // Cell is not a number
+  CsvMissingCell   // Row is too short (blank line?)
+};
+
+struct CsvCellIssue {
+  CsvIssueKind kind;
+  unsigned     row;  // 0-based CSV row
+  unsigned     col;  // 0-based CSV column
+  std::string  text;
+};
+
+//
+// Memory-mapped reader of numeric CSV files. Cells are parsed on demand
+// straight from the mapping. Cells that cannot be parsed are skipped and
+// reported to the caller, no exceptions are thrown for them. Once opened,
+// a reader can be shared by several threads.
+//
+
+class CsvReader {
+    std::string       m_path;
+    char              m_separator;
+    void             *m_mapping = nullptr;
+    size_t            m_size    = 0;
+    const char       *m_data    = nullptr;
+    std::string       m_owned;
+
+    std::vector<std::pair<size_t, size_t>> m_rows; // [begin, end) offsets
+
+    void indexRows();
+    void splitRow(
+      unsigned row,
+      std::vector<std::string_view> &cells,
+      unsigned maxCells = ~0u) const;
+    bool cellToDouble(
+      std::vector<std::string_view> const &cells,
+      unsigned row,
+      unsigned col,
+      double &value,
+      std::vector<CsvCellIssue> &issues) const;
+
+  public:
+    CsvReader(std::string const &path, char separator = ',');
+
+    // Read from memory. Data must outlive the reader, name is for messages.
+    CsvReader(
+      const char *data,
+      size_t size,
+      std::string const &name,
+      char separator = ',');
+    ~CsvReader();
+
+    CsvReader(CsvReader const &) = delete;
+    CsvReader &operator=(CsvReader const &) = delete;
+
+    // Copy the mapped file into memory owned by the reader and unmap it.
+    // Readers kept around after loading must do this, as a mapping turns
+    // a truncated file into a SIGBUS on the next read.
+    void detach();
+
+    std::string const &path() const;
+    unsigned rows() const;
+    unsigned cols() const; // Cells in the first row
+
+    static bool parse(std::string_view, double &);
+
+    // Read two columns (or two rows, if transposed) as x and y arrays.
+    // Pairs with bad cells are skipped and appended to issues
+    void readPairs(
+      bool transpose,
+      unsigned xIndex,
+      unsigned yIndex,
+      std::vector<double> &x,
+      std::vector<double> &y,
+      std::vector<CsvCellIssue> &issues) const;
+};
+
+#endif // _ETC_CSV_READER_H
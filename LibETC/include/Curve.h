@@ -22,10 +22,13 @@
 
 #include <map>
 #include <list>
+#include <vector>
 #include <string>
 #include <limits>
+#include <cstddef>
 
 class Curve;
+class CsvReader;
 
 enum CurveAxis {
   XAxis,
@@ -40,25 +43,40 @@ struct CurveAssignProxy {
   operator double() const;
 };
 
+//
+// Curves are stored as two arrays of X and Y values, sorted by X and with
+// no repeated X values. Curves can adopt existing arrays, so bulk producers
+// can build curves without inserting points one by one.
+//
+
 class Curve {
   protected:
     double                   m_oobRight = 0;
     double                   m_oobLeft  = 0;
     std::string              m_unitsX;
     std::string              m_unitsY;
-    std::map<double, double> m_curve;
+    std::vector<double>      m_x;
+    std::vector<double>      m_y;
+
+    static void sortPoints(
+      std::vector<double> &x,
+      std::vector<double> &y,
+      bool keepLast);
 
   public:
+    Curve();
+    Curve(std::vector<double> &&x, std::vector<double> &&y);
+
     inline bool
     isOob(double x) const
     {
-      if (m_curve.empty())
+      if (m_x.empty())
         return true;
 
-      if (x < m_curve.cbegin()->first)
+      if (x < m_x.front())
         return true;
 
-      if (std::prev(m_curve.cend())->first < x)
+      if (m_x.back() < x)
         return true;
 
       return false;
@@ -67,17 +85,35 @@ class Curve {
     inline double
     xMin() const
     {
-      if (m_curve.empty())
+      if (m_x.empty())
         return std::numeric_limits<double>::quiet_NaN();
-      return m_curve.begin()->first;
+      return m_x.front();
     }
 
     inline double
     xMax() const
     {
-      if (m_curve.empty())
+      if (m_x.empty())
         return std::numeric_limits<double>::quiet_NaN();
-      return std::prev(m_curve.end())->first;
+      return m_x.back();
+    }
+
+    inline size_t
+    size() const
+    {
+      return m_x.size();
+    }
+
+    inline std::vector<double> const &
+    xData() const
+    {
+      return m_x;
+    }
+
+    inline std::vector<double> const &
+    yData() const
+    {
+      return m_y;
     }
 
     double operator[](double) const;
@@ -105,6 +141,12 @@ class Curve {
     double get(double) const;
     double getdiff(double) const;
 
+    // Adopt X and Y arrays. Arrays are checked for order in one pass and
+    // sorted only if necessary. For repeated X values, the last one wins.
+    void adopt(std::vector<double> &&x, std::vector<double> &&y);
+    void reserve(size_t);
+    void shrinkToFit();
+
     void multiplyBy(Curve const &);
     void add(Curve const &);
     void add(double);
@@ -113,6 +155,7 @@ class Curve {
     void clear();
 
     void load(std::string const &, bool transpose = false, unsigned xCol = 0, unsigned yCol = 1);
+    void load(CsvReader const &, bool transpose = false, unsigned xCol = 0, unsigned yCol = 1);
     void save(std::string const &) const;
 
     void debug();
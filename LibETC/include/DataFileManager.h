@@ -22,11 +22,71 @@
 
 #include <string>
 #include <list>
+#include <map>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <functional>
 #include <stdexcept>
+#include <filesystem>
+
+//
+// Resolved paths (and failed resolutions) are cached, as well as the
+// contents of the directories in which files are looked up. The cache
+// must be invalidated explicitly when files are added or removed, unless
+// cache validation is enabled: in that case, cached entries are checked
+// against the modification time of the files and directories involved.
+//
+// On Linux, the search paths can also be watched for changes (inotify).
+// Changed files are evicted from the cache and reported to the watch
+// listeners by their path relative to the search path, e.g.
+// "config/detectors.yaml", along with the search path they are in.
+//
+
+typedef std::function<
+  void (std::string const &name, std::string const &searchPath)>
+  DataFileWatchListener;
+
+typedef std::pair<std::string, std::string> DataFileChange; // Path, name
+
+struct DataFileCacheEntry {
+  std::string                     path;  // Empty if not found
+  std::filesystem::file_time_type mtime;
+};
+
+struct DataFileDirListing {
+  bool                            exists = false;
+  std::filesystem::file_time_type mtime;
+  std::set<std::string>           entries;
+};
 
 class DataFileManager {
     static DataFileManager *g_instance;
     std::list<std::string> m_paths;
+
+    mutable std::mutex     m_mutex;
+    bool                   m_validateCache = false;
+    std::map<std::pair<std::string, int>, DataFileCacheEntry> m_cache;
+    std::map<std::string, DataFileDirListing>                 m_listings;
+
+    // File watching
+    int                              m_watchFd      = -1;
+    int                              m_watchPipe[2] = {-1, -1};
+    std::thread                      m_watchThread;
+    std::set<std::string>            m_watchedSubdirs;
+    std::map<int, DataFileChange>    m_watches;    // Descriptor -> path, subdir
+    std::list<DataFileWatchListener> m_watchListeners;
+
+    void addWatches(std::string const &path, std::string const &subdir);
+    void watchLoop();
+    void dispatchChanges(std::set<DataFileChange> const &);
+
+    DataFileDirListing &listing(std::string const &dir);
+    bool listed(std::string const &fullPath);
+    bool validateListings();
+    bool validateEntry(DataFileCacheEntry const &);
+
+    std::string lookup(std::string const &path, int flags);
     std::string find(std::string const &path, int flags);
 
     DataFileManager();
@@ -38,7 +98,19 @@ class DataFileManager {
     
     std::string resolve(std::string const &);
     std::string suggest(std::string const &);
-    std::list<std::string> const &searchPaths() const;
+    // Copy of the search paths, as they may be added from other threads
+    std::list<std::string> searchPaths() const;
+
+    void invalidateCache();
+    void invalidateCache(std::string const &);
+    void setCacheValidation(bool);
+    bool cacheValidation() const;
+
+    // Watch a subdirectory ("" for the search path itself) of every
+    // search path, present and future. Returns false if unsupported.
+    bool watch(std::string const &subdir = "");
+    void stopWatching();
+    void addWatchListener(DataFileWatchListener);
 };
 
 static inline std::string
@@ -0,0 +1,118 @@
+//
+// DataWriter.h: Fast writers of numeric data
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#ifndef _ETC_DATA_WRITER_H
+#define _ETC_DATA_WRITER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+
+#define DATA_WRITER_BUFFER_SIZE 65536
+
+//
+// Buffered output to a file or stream. Numbers are formatted with
+// std::to_chars, which gives the same text as printf with the equivalent
+// conversion, without the per-call overhead of stdio.
+//
+
+class DataWriter {
+    FILE             *m_fp     = nullptr;
+    std::string      *m_sink   = nullptr;
+    bool              m_owned  = false;
+    std::string       m_path;
+    std::vector<char> m_buffer;
+    size_t            m_used   = 0;
+
+    inline char *
+    reserve(size_t size)
+    {
+      if (m_used + size > m_buffer.size())
+        flush();
+
+      return m_buffer.data() + m_used;
+    }
+
+  public:
+    DataWriter(FILE *fp);                 // Borrowed
+    DataWriter(std::string const &path);  // Throws if it cannot be opened
+    DataWriter(std::string *sink);        // Appends to a string
+    ~DataWriter();
+
+    DataWriter(DataWriter const &) = delete;
+    DataWriter &operator=(DataWriter const &) = delete;
+
+    void write(const void *data, size_t size);
+    void write(std::string_view);
+    void writeChar(char);
+
+    void writeGeneral(double, int precision = 6);     // As in %.*g
+    void writeScientific(double, int precision = 15); // As in %.*e
+    void writeLittleEndian(double const *, size_t count);
+    void writeLittleEndian(uint32_t);
+
+    void flush();
+    void close(); // Flush and close, throwing on errors
+};
+
+//
+// Writer of tables of doubles. Each row may have an optional label.
+//
+//   TextFormat:   comma-separated values, one row per line (%g). Labels
+//                 are written as the first cell.
+//   BinaryFormat: "TETCTAB" and a NUL, followed by the format version,
+//                 the number of rows and the number of columns (uint32).
+//                 Each row is the label length (uint32), the label and
+//                 the row values (float64). Everything little endian.
+//   NpyFormat:    NumPy .npy file with a rows x cols float64 array.
+//                 Labels are not stored.
+//
+// Binary formats need every row to have the declared number of columns.
+//
+
+enum DataFormat {
+  TextFormat,
+  BinaryFormat,
+  NpyFormat
+};
+
+#define TABLE_WRITER_BINARY_VERSION 1
+
+class TableWriter {
+    DataWriter &m_out;
+    DataFormat  m_format;
+    size_t      m_rows;
+    size_t      m_cols;
+    size_t      m_written = 0;
+
+    void writeHeader();
+
+  public:
+    TableWriter(DataWriter &, DataFormat, size_t rows, size_t cols);
+
+    void writeRow(std::vector<double> const &, std::string const &label = "");
+
+    // Format from a name (text, bin, npy) or a file extension
+    static bool parseFormat(std::string const &name, DataFormat &format);
+    static DataFormat formatFromPath(std::string const &path);
+};
+
+#endif // _ETC_DATA_WRITER_H
@@ -21,6 +21,8 @@
 #define _ETC_DETECTOR_H
 
 #include "ConfigManager.h"
+#include <vector>
+#include <cmath>
 
 #define DETECTOR_PIXELS      2048
 #define DETECTOR_TEMPERATURE 193   // K
@@ -53,31 +55,76 @@ struct DetectorProperties : public Config {
   virtual ~DetectorProperties();
 };
 
+//
+// On-chip binning. Charge of spectral x spatial physical pixels is added up
+// before read-out, so read-out noise is only paid once per binned pixel.
+//
+struct DetectorBinning {
+  unsigned spectral = 1;
+  unsigned spatial  = 1;
+
+  inline bool
+  isValid() const
+  {
+    return spectral >= 1 && spatial >= 1 && spectral <= DETECTOR_PIXELS;
+  }
+
+  inline unsigned
+  pixels() const
+  {
+    return DETECTOR_PIXELS / spectral;
+  }
+};
+
+//
+// The detector operates on a dense buffer of DETECTOR_PIXELS pixels. All
+// per-pixel products (photons, electrons, signal, noise and SNR) are
+// computed in a single pass by recalculate().
+//
+
 class Detector {
-    DetectorProperties *m_properties = nullptr;
-    DetectorSpec       *m_detector = nullptr;
+    const DetectorProperties *m_properties = nullptr;
+    const DetectorSpec       *m_detector = nullptr;
+    std::string         m_detectorName;
 
     double m_expostureTime = 1.;
+    double m_darkElectrons = 0;   // e/px, cached for the current exposure
 
-    Spectrum *m_photonFluxPerPixel; // ph / (px m^2 s)
-    Spectrum *m_photonsPerPixel;    // ph/px
-    Spectrum *m_electronsPerPixel;  // e/px
-    Spectrum *m_signal;             // c
+    std::vector<double> m_photonFluxPerPixel; // ph / (px m^2 s)
+    std::vector<double> m_photonsPerPixel;    // ph/px
+    std::vector<double> m_electronsPerPixel;  // e/px
+    std::vector<double> m_signal;             // c
+    std::vector<double> m_noise;              // c
+    std::vector<double> m_snr;                // 1
+
+    void updateDarkElectrons();
 
   public:
     Detector();
     ~Detector();
 
-    DetectorProperties *properties() const;
-    DetectorSpec *getSpec() const;
+    DetectorProperties const *properties() const;
+    DetectorSpec const *getSpec() const;
+    std::string const &detectorName() const;
     double darkElectrons(double T) const;
     double signal(unsigned px) const;       // c
     double electrons(unsigned px) const;    // e
     double noise(unsigned px) const;        // c
     double readOutNoise() const;            // c
     double snr(unsigned px) const;          // 1
-    const Spectrum *signal() const;         // c
-    const Spectrum *electrons() const;      // e
+
+    // Noise of a (binned) pixel holding the given electrons, in counts
+    static inline double
+    noise(double electrons, double gain, double readOutNoise)
+    {
+      return sqrt(electrons / (gain * gain) + readOutNoise * readOutNoise);
+    }
+
+    std::vector<double> const &photons() const;   // ph
+    std::vector<double> const &electrons() const; // e
+    std::vector<double> const &signal() const;    // c
+    std::vector<double> const &noise() const;     // c
+    std::vector<double> const &snr() const;       // 1
 
     bool setDetector(std::string const &);
     void setPixelPhotonFlux(Spectrum const &);
@@ -0,0 +1,56 @@
+//
+// EmbeddedData.h: Data files compiled into the library
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#ifndef _ETC_EMBEDDED_DATA_H
+#define _ETC_EMBEDDED_DATA_H
+
+#include <string>
+#include <cstddef>
+
+//
+// When built with ETC_EMBED_DATA, the contents of the data directory are
+// compiled into the library. DataFileManager falls back to these files
+// when they cannot be found in any search path, handing out paths of the
+// form "embedded:NAME". Readers of data files (CsvReader, Config) must
+// check for these paths.
+//
+
+#define ETC_EMBEDDED_PREFIX "embedded:"
+
+struct EmbeddedDataFile {
+  const char          *name;  // Relative to the data directory
+  const unsigned char *data;
+  size_t               size;
+};
+
+class EmbeddedData {
+  public:
+    static size_t count();
+    static EmbeddedDataFile const *file(size_t index);
+
+    // Look up by name relative to the data directory
+    static EmbeddedDataFile const *find(std::string const &name);
+
+    // Look up by path, as returned by DataFileManager
+    static EmbeddedDataFile const *fromPath(std::string const &path);
+    static bool isEmbedded(std::string const &path);
+    static std::string path(std::string const &name);
+};
+
+#endif // _ETC_EMBEDDED_DATA_H
@@ -22,9 +22,12 @@
 
 #include "ConfigManager.h"
 #include <cmath>
+#include <memory>
 
 class Curve;
 class Spectrum;
+class SimulationProfile;
+struct InstrumentArmSlices;
 
 #define CAHA_APERTURE_DIAMETER 3.5    // m
 #define CAHA_FOCAL_LENGTH      12.195 // m
@@ -50,52 +53,77 @@ enum InstrumentArm {
   RedArm
 };
 
+// Parts of the model read from different data files. A model can be built
+// from a previous one, reading again only some of them (see ModelRegistry).
+enum InstrumentModelPart {
+  InstrumentPropertiesPart = 1 << 0, // config/tarsis.yaml
+  BlueTransmissionPart     = 1 << 1, // blueTransmission.csv
+  RedTransmissionPart      = 1 << 2, // redTransmission.csv
+  BlueSlicesPart           = 1 << 3, // dispersionBlue.csv, pxResolutionBlue.csv
+  RedSlicesPart            = 1 << 4, // dispersionRed.csv, pxResolutionRed.csv
+  AllInstrumentModelParts  = (1 << 5) - 1
+};
+
 //
 // Instrument model. Unless specified, all units are SI. This is: meters,
-// seconds, Joules, Hertzs and so on
+// seconds, Joules, Hertzs and so on. The model is immutable after
+// construction: the spectra produced by it are returned to the caller, so
+// the same model can be shared among simulations (see ModelRegistry).
 //
 
 class InstrumentModel {
-    InstrumentProperties *m_properties = nullptr; // Borrowed
-    Curve    *m_blueML15      = nullptr;          // Owned, blue + ML15
-    Curve    *m_blueNBB       = nullptr;          // Owned, blue + NBB
-    Curve    *m_redML15       = nullptr;          // Owned, red + ML15
-
-    ///////////////////////////// Blue arm ///////////////////////////
-    Curve    *m_blueDisp[TARSIS_SLICES];          // Owned, spectral dispersion
-    Curve    *m_blueREPx[TARSIS_SLICES];          // Resolution element (in pixels)
-    Curve    *m_blueW2Px[TARSIS_SLICES];          // Owned, int of inv of sd
-    Curve    *m_bluePx2W[TARSIS_SLICES];          // Owned, inverse of above
-
-    ////////////////////////////// Red arm ///////////////////////////
-    Curve    *m_redDisp[TARSIS_SLICES];           // Owned, spectral dispersion
-    Curve    *m_redREPx[TARSIS_SLICES];           // Resolution element (in pixels)
-    Curve    *m_redW2Px[TARSIS_SLICES];           // Owned, int of inv of sd
-    Curve    *m_redPx2W[TARSIS_SLICES];           // Owned, inverse of above
-
-    Spectrum *m_attenSpectrum   = nullptr;        // Owned, attenuated before dispersor
-    InstrumentArm m_currentPath = BlueArm;        // Path of the attenuated spectrum
+    const InstrumentProperties *m_properties = nullptr; // Borrowed
+
+    // Parts not reloaded by a model are shared with the previous one
+    std::shared_ptr<const Curve>         m_blueML15; // blue + ML15
+    std::shared_ptr<const Curve>         m_blueNBB;  // blue + NBB
+    std::shared_ptr<const Curve>         m_redML15;  // red + ML15
+    std::shared_ptr<InstrumentArmSlices> m_blueSlices;
+    std::shared_ptr<InstrumentArmSlices> m_redSlices;
+
+    void load(InstrumentModel const *previous, unsigned reload);
+    Curve const *transmission(InstrumentArm, std::string const &) const;
+    InstrumentArmSlices &requireSlice(InstrumentArm, unsigned) const;
 
   public:
     InstrumentModel();
-    ~InstrumentModel();
+
+    // Builds a model that reads again the parts in reload (a mask of
+    // InstrumentModelPart) and shares the rest with previous.
+    InstrumentModel(InstrumentModel const &previous, unsigned reload);
 
     // Returns instrument properties (required for simulation)
-    InstrumentProperties *properties() const;
+    InstrumentProperties const *properties() const;
+
+    // Slices are built the first time they are used. This builds all of
+    // them now, after which simulations no longer write to the model (e.g.
+    // to share its pages with forked processes).
+    void loadAllSlices() const;
 
     // Turns a pixel into lambda
     double pxToWavelength(InstrumentArm arm, unsigned slice, unsigned pixel) const;
-    Curve *pxToWavelength(unsigned slice) const;
+    Curve const *pxToWavelength(InstrumentArm arm, unsigned slice) const;
 
     int    wavelengthToPx(InstrumentArm arm, unsigned slice, double lambda) const;
-    Curve *wavelengthToPx(unsigned slice) const;
-
-    // Set input spectrum. The input spectrum must be in radiance units,
-    // with a *wavelength* spectral axis* i.e. J / (s * m^2 * sr * m)
-    void   setInput(InstrumentArm arm, Spectrum const &);
-
-    // Returns the per-pixel photon flux,in units of in ph / (s m^2)
-    Spectrum *makePixelPhotonFlux(unsigned int slice) const;
+    Curve const *wavelengthToPx(InstrumentArm arm, unsigned slice) const;
+
+    bool supportsCoating(InstrumentArm arm, std::string const &coating) const;
+
+    // Attenuate the input spectrum. The input spectrum must be in radiance
+    // units, with a *wavelength* spectral axis* i.e. J / (s * m^2 * sr * m).
+    // The coating selects the transmission curve of the arm.
+    Spectrum *makeAttenuatedSpectrum(
+      InstrumentArm arm,
+      std::string const &coating,
+      Spectrum const &) const;
+
+    // Returns the per-pixel photon flux,in units of in ph / (s m^2). The
+    // dispersion and convolution stages are timed in profile, if given.
+    Spectrum *makePixelPhotonFlux(
+      InstrumentArm arm,
+      unsigned int slice,
+      Spectrum const &attenuated,
+      SimulationProfile *profile = nullptr) const;
 };
 
 #endif // _ETC_INSTRUMENT_H
@@ -0,0 +1,123 @@
+//
+// JobScheduler.h: Priority-aware scheduling of simulation jobs
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#ifndef _ETC_JOB_SCHEDULER_H
+#define _ETC_JOB_SCHEDULER_H
+
+#include <ThreadPool.h>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+
+enum JobPriority {
+  InteractiveJob, // A single configuration somebody is waiting for
+  BulkJob,        // Part of a sweep (e.g. one slice of many)
+  JOB_PRIORITY_COUNT
+};
+
+//
+// Runs jobs on a thread pool, interactive jobs first. Every job pushes a
+// token to the pool and every token runs the most urgent job queued at the
+// time, so interactive jobs overtake queued bulk jobs as soon as a worker
+// is free. Priorities only decide which queued job starts next: a running
+// job is never preempted, and an interactive job may wait for every worker
+// to finish its current job. Long bulk work should therefore be split in
+// short jobs (e.g. one per slice).
+//
+// Jobs go through submit(), which wraps them in a packaged task: whatever
+// they throw ends up in their future, never in the pool.
+//
+// Queues are bounded: submit() blocks the caller until there is room
+// (running pool tasks meanwhile), trySubmit() fails instead. Producers that must not
+// block, or that have more work than fits in a queue, should keep their
+// own window of jobs in flight.
+//
+// The server, the batch mode of the calculator and the GUI share the
+// library-wide instance, each with the class of its work.
+//
+
+class JobScheduler {
+    static JobScheduler *g_instance;
+
+    ThreadPool                       *m_pool;     // nullptr: library pool
+    std::deque<std::function<void()>> m_queues[JOB_PRIORITY_COUNT];
+    size_t                            m_capacity[JOB_PRIORITY_COUNT];
+    size_t                            m_running = 0;
+    std::mutex                        m_mutex;
+    std::condition_variable           m_cond;
+
+    void help(std::unique_lock<std::mutex> &);
+    void runNext();
+    void push(JobPriority, std::function<void()>);
+    bool tryPush(JobPriority, std::function<void()>); // false if full
+
+  public:
+    JobScheduler(
+      ThreadPool *pool = nullptr, // nullptr: ThreadPool::instance()
+      size_t interactiveCapacity = 256,
+      size_t bulkCapacity = 64);
+    ~JobScheduler();
+
+    JobScheduler(JobScheduler const &) = delete;
+    JobScheduler &operator=(JobScheduler const &) = delete;
+
+    // Library-wide scheduler, on the library-wide pool
+    static JobScheduler *instance();
+
+    ThreadPool *pool() const;
+    size_t capacity(JobPriority) const;
+    size_t queued(JobPriority);
+
+    template <class F> auto
+    submit(JobPriority priority, F &&func) -> std::future<decltype(func())>
+    {
+      typedef decltype(func()) R;
+      auto task = std::make_shared<std::packaged_task<R()>>(
+        std::forward<F>(func));
+      auto future = task->get_future();
+
+      push(priority, [task] () { (*task)(); });
+
+      return future;
+    }
+
+    // As submit(), but returns false if the queue is full
+    template <class F> bool
+    trySubmit(
+      JobPriority priority,
+      F &&func,
+      std::future<decltype(func())> &future)
+    {
+      typedef decltype(func()) R;
+      auto task = std::make_shared<std::packaged_task<R()>>(
+        std::forward<F>(func));
+      auto result = task->get_future();
+
+      if (!tryPush(priority, [task] () { (*task)(); }))
+        return false;
+
+      future = std::move(result);
+      return true;
+    }
+};
+
+#endif // _ETC_JOB_SCHEDULER_H
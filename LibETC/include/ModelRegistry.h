@@ -0,0 +1,228 @@
+//
+// ModelRegistry.h: Process-wide registry of shared instrument models
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#ifndef _ETC_MODEL_REGISTRY_H
+#define _ETC_MODEL_REGISTRY_H
+
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <cstdint>
+
+class Curve;
+class SkyModel;
+class InstrumentModel;
+
+//
+// The model registry hands out immutable model objects, shared by all
+// simulations created against the same data directories. Models are
+// reference-counted: the registry only keeps weak references to them, so
+// they are released as soon as the last simulation using them is gone.
+//
+// If data files are watched (see watchDataFiles), a changed file only
+// affects the registry keys that read it, i.e. those whose search paths
+// include the directory of the file, with no other copy of the file before
+// it. Each model kind maps its files to the parts of the model built from
+// them (e.g. the slices of one arm): the models using the file are marked
+// stale, and the next request builds a new model from the previous one,
+// reading only the stale parts again. Every change increments the registry
+// generation, so that long-lived simulations know when to request their
+// models again.
+//
+
+//
+// Models are built once per key, outside the registry locks: the builder
+// registers a future under the lock, and concurrent requests of the same
+// key wait for it. Model constructors may then use the thread pool (which
+// runs other pending tasks, including lookups, while waiting) without
+// deadlocking on the registry.
+//
+
+template <class T>
+struct ModelRegistryEntry {
+  std::weak_ptr<const T>                         model;
+  std::shared_future<std::shared_ptr<const T>>   building;
+  std::thread::id                                builder;
+  uint64_t                                       build = 0;
+  unsigned                                       stale = 0; // Parts to reload
+};
+
+class ModelRegistry {
+    static ModelRegistry *g_instance;
+
+    // One lock per kind of model, so that different models can be
+    // looked up in parallel
+    std::mutex m_skyMutex;
+    std::mutex m_tarsisMutex;
+    std::mutex m_cousinsMutex;
+
+    std::map<std::string, ModelRegistryEntry<SkyModel>>        m_skyModels;
+    std::map<std::string, ModelRegistryEntry<InstrumentModel>> m_tarsisModels;
+    std::map<std::string, ModelRegistryEntry<Curve>>           m_cousinsR;
+
+    std::atomic<unsigned> m_generation;
+    std::atomic<uint64_t> m_builds;
+    bool                  m_watching = false;
+
+    ModelRegistry();
+
+    void dataFileChanged(
+      std::string const &name,
+      std::string const &searchPath);
+
+    static bool readsFrom(
+      std::string const &key,
+      std::string const &name,
+      std::string const &searchPath);
+
+    //
+    // Builders take the previous model of the key (null if there is none
+    // left) and the parts of it that must be read again.
+    //
+    template <class T, class Builder> std::shared_ptr<const T>
+    lookup(
+      std::mutex &mutex,
+      std::map<std::string, ModelRegistryEntry<T>> &map,
+      Builder builder)
+    {
+      std::promise<std::shared_ptr<const T>> promise;
+      std::shared_future<std::shared_ptr<const T>> future;
+      std::shared_ptr<const T> ptr, previous;
+      auto key = currentKey();
+      uint64_t build = 0;
+      unsigned stale = 0;
+
+      {
+        std::lock_guard<std::mutex> guard(mutex);
+        auto &entry = map[key];
+
+        if (entry.stale == 0 && (ptr = entry.model.lock()))
+          return ptr;
+
+        // A builder that needs its own model again (e.g. from a task run
+        // while waiting) cannot wait for itself. Build a private copy.
+        if (entry.building.valid()
+            && entry.builder == std::this_thread::get_id())
+          return std::shared_ptr<const T>(builder(previous, ~0u));
+
+        if (entry.building.valid())
+          future = entry.building;
+        else {
+          previous       = entry.model.lock();
+          stale          = entry.stale;
+          entry.building = promise.get_future().share();
+          entry.builder  = std::this_thread::get_id();
+          entry.build    = build = ++m_builds;
+        }
+      }
+
+      // Someone else is building it
+      if (future.valid())
+        return future.get();
+
+      try {
+        ptr = std::shared_ptr<const T>(builder(previous, stale));
+      } catch (...) {
+        // Failures are not remembered: the next request tries again
+        promise.set_exception(std::current_exception());
+
+        std::lock_guard<std::mutex> guard(mutex);
+        auto it = map.find(key);
+        if (it != map.end() && it->second.build == build) {
+          it->second.building = std::shared_future<std::shared_ptr<const T>>();
+          it->second.build    = 0;
+          if (it->second.model.expired())
+            map.erase(it);
+        }
+        throw;
+      }
+
+      promise.set_value(ptr);
+
+      // If the files changed meanwhile, the model may be stale. It is
+      // handed out, but not registered.
+      std::lock_guard<std::mutex> guard(mutex);
+      auto it = map.find(key);
+
+      if (it != map.end() && it->second.build == build) {
+        it->second.model    = ptr;
+        it->second.building = std::shared_future<std::shared_ptr<const T>>();
+        it->second.build    = 0;
+        it->second.stale    = 0;
+      }
+
+      return ptr;
+    }
+
+    // Marks the parts read from a changed file as stale, in the models of
+    // the keys that read it. An empty search path affects every key.
+    template <class T> bool
+    invalidate(
+      std::mutex &mutex,
+      std::map<std::string, ModelRegistryEntry<T>> &map,
+      std::string const &name,
+      std::string const &searchPath,
+      unsigned parts)
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      bool changed = false;
+
+      for (auto it = map.begin(); it != map.end(); ) {
+        auto &entry = it->second;
+
+        if (!searchPath.empty() && !readsFrom(it->first, name, searchPath)) {
+          ++it;
+          continue;
+        }
+
+        // Builds in progress may have read the old file
+        entry.building = std::shared_future<std::shared_ptr<const T>>();
+        entry.build    = 0;
+        entry.stale   |= parts;
+        changed        = true;
+
+        if (entry.model.expired())
+          it = map.erase(it);
+        else
+          ++it;
+      }
+
+      return changed;
+    }
+
+  public:
+    static ModelRegistry *instance();
+
+    // Models are keyed by the current list of data search paths
+    static std::string currentKey();
+
+    std::shared_ptr<const SkyModel>        skyModel();
+    std::shared_ptr<const InstrumentModel> instrumentModel();
+    std::shared_ptr<const Curve>           cousinsRFilter(); // frequency axis
+
+    // Reload models when their data files change
+    bool watchDataFiles();
+    unsigned generation() const;
+};
+
+#endif // _ETC_MODEL_REGISTRY_H
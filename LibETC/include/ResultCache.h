@@ -0,0 +1,157 @@
+//
+// ResultCache.h: Memoization of simulation results
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#ifndef _ETC_RESULT_CACHE_H
+#define _ETC_RESULT_CACHE_H
+
+#include <Simulation.h>
+#include <string>
+#include <string_view>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <cstdint>
+
+struct ResultCacheStats {
+  uint64_t hits      = 0; // Served from the cache
+  uint64_t misses    = 0; // Computed
+  uint64_t coalesced = 0; // Waited for an identical request in progress
+  uint64_t evictions = 0;
+  size_t   entries   = 0;
+  size_t   capacity  = 0;
+};
+
+//
+// Least-recently-used cache of results, keyed by strings (see
+// simulationKey). Identical requests arriving while the result is being
+// computed wait for it instead of computing it again. Failed computations
+// are not cached: their exception is rethrown to every waiter.
+//
+
+template <class T>
+class ResultCache {
+    typedef std::shared_ptr<const T>                  Value;
+    typedef std::list<std::pair<std::string, Value>> LruList;
+
+    std::mutex                                        m_mutex;
+    size_t                                            m_capacity;
+    LruList                                           m_lru;  // MRU first
+    std::unordered_map<std::string, typename LruList::iterator> m_index;
+    std::map<std::string, std::shared_future<Value>>  m_inFlight;
+    ResultCacheStats                                  m_stats;
+
+  public:
+    ResultCache(size_t capacity) : m_capacity(capacity)
+    {
+    }
+
+    template <class Builder> Value
+    get(std::string const &key, Builder builder)
+    {
+      std::promise<Value> promise;
+
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto it = m_index.find(key);
+
+        if (it != m_index.end()) {
+          ++m_stats.hits;
+          m_lru.splice(m_lru.begin(), m_lru, it->second);
+          return it->second->second;
+        }
+
+        auto flight = m_inFlight.find(key);
+        if (flight != m_inFlight.end()) {
+          auto future = flight->second;
+          ++m_stats.coalesced;
+          lock.unlock();
+          return future.get();
+        }
+
+        ++m_stats.misses;
+        m_inFlight[key] = promise.get_future().share();
+      }
+
+      Value value;
+
+      try {
+        value = Value(builder());
+      } catch (...) {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        promise.set_exception(std::current_exception());
+        m_inFlight.erase(key);
+        throw;
+      }
+
+      std::lock_guard<std::mutex> guard(m_mutex);
+
+      promise.set_value(value);
+      m_inFlight.erase(key);
+
+      if (m_capacity > 0) {
+        m_lru.push_front(std::make_pair(key, value));
+        m_index[key] = m_lru.begin();
+
+        while (m_lru.size() > m_capacity) {
+          m_index.erase(m_lru.back().first);
+          m_lru.pop_back();
+          ++m_stats.evictions;
+        }
+      }
+
+      return value;
+    }
+
+    ResultCacheStats
+    stats()
+    {
+      std::lock_guard<std::mutex> guard(m_mutex);
+      ResultCacheStats stats = m_stats;
+
+      stats.entries  = m_lru.size();
+      stats.capacity = m_capacity;
+
+      return stats;
+    }
+
+    void
+    clear()
+    {
+      std::lock_guard<std::mutex> guard(m_mutex);
+
+      m_lru.clear();
+      m_index.clear();
+    }
+};
+
+// Key of a simulation: every simulation parameter, options of the caller
+// that change the result (extra), a hash of the spectrum contents and the
+// model registry generation.
+std::string simulationKey(
+  SimulationParams const &params,
+  std::string const &extra,
+  std::string_view spectrum);
+
+// Contents of a file, throws on errors
+std::string fileContents(std::string const &path);
+
+#endif // _ETC_RESULT_CACHE_H
@@ -26,6 +26,10 @@
 #include <SkyModel.h>
 #include <InstrumentModel.h>
 #include <Detector.h>
+#include <SimulationProfile.h>
+#include <memory>
+#include <vector>
+#include <map>
 
 struct SimulationParams {
   const char *progName     = nullptr;
@@ -36,18 +40,72 @@ struct SimulationParams {
   double exposure          = 3600;
   double rABmag            = 18.;
   int    slice             = 20;
+  DetectorBinning binning;
 };
 
+//
+// Per-pixel products of a simulated arm, stored contiguously. Filled once
+// per call to Simulation::simulateArm.
+//
+struct ArmResult {
+  bool                valid = false;
+  unsigned            slice = 0;
+  std::string         detector;
+  std::vector<double> wavelength;   // m
+  std::vector<double> signal;       // c
+  std::vector<double> noise;        // c
+  std::vector<double> electrons;    // e
+  std::vector<double> snr;          // 1
+  double              readOutNoise; // c
+  double              gain;         // e-/count
+
+  void resize(unsigned pixels);
+
+  // On-chip binning of these products, see Simulation::binnedResult
+  ArmResult binned(DetectorBinning const &) const;
+};
+
+struct SimulationResult {
+  ArmResult blueArm;
+  ArmResult redArm;
+
+  inline ArmResult &
+  arm(InstrumentArm arm)
+  {
+    return arm == BlueArm ? blueArm : redArm;
+  }
+
+  inline ArmResult const &
+  arm(InstrumentArm arm) const
+  {
+    return arm == BlueArm ? blueArm : redArm;
+  }
+};
+
+// Results of every compatible detector of an arm, by detector name
+typedef std::map<std::string, ArmResult> DetectorResultTable;
+
 class Simulation {
     Spectrum  m_input;
-    Curve     m_cousinsR;
     double    m_cousinsREquivBw;
     Spectrum *m_sky = nullptr;
-    SkyModel *m_skyModel = nullptr;
-    InstrumentModel *m_tarsisModel = nullptr;
     Detector *m_det = nullptr;
     SimulationParams m_params;
+    InstrumentArm    m_currentArm = BlueArm;
+    SimulationResult m_result;
+
+    // Shared with other simulations, see ModelRegistry
+    std::shared_ptr<const Curve>           m_cousinsR;
+    std::shared_ptr<const SkyModel>        m_skyModel;
+    std::shared_ptr<const InstrumentModel> m_tarsisModel;
+    unsigned                               m_modelGeneration = 0;
 
+    bool              m_profiling = false;
+    SimulationProfile m_profile;
+
+    void acquireModels();
+    SimulationProfile *profiler();
+    void fillResult(InstrumentArm arm, ArmResult &);
 
   public:
     Simulation();
@@ -58,6 +116,19 @@ class Simulation {
     void setParams(SimulationParams const &params);
 
     void simulateArm(InstrumentArm arm);
+
+    // Results of the last simulateArm() of each arm
+    SimulationResult const &result() const;
+    ArmResult const &result(InstrumentArm arm) const;
+    SimulationResult takeResult();
+
+    // Simulates an arm with all the configured detectors that are
+    // compatible with it. The optical chain is simulated once per coating.
+    DetectorResultTable simulateAllDetectors(InstrumentArm arm);
+
+    // Bins the last result of an arm, without simulating it again
+    ArmResult binnedResult(InstrumentArm arm, DetectorBinning const &) const;
+
     double signal(unsigned px) const;
     double noise(unsigned px) const;
     double electrons(unsigned px) const;
@@ -65,6 +136,12 @@ class Simulation {
     double gain() const;
     double pxToWavelength(unsigned px) const;
     Curve const &wlToPixelCurve() const;
+
+    // Stage timing. Off by default. Accumulates until reset.
+    void setProfiling(bool);
+    bool profiling() const;
+    SimulationProfile const &profile() const;
+    void resetProfile();
 };
 
 #endif // _ETC_SIMULATION_H
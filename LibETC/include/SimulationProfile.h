@@ -0,0 +1,141 @@
+//
+// SimulationProfile.h: Per-stage timing of simulations
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#ifndef _ETC_SIMULATION_PROFILE_H
+#define _ETC_SIMULATION_PROFILE_H
+
+#include <cstdint>
+#include <ctime>
+
+enum SimulationStage {
+  NormalizationStage, // Simulation::normalizeToRMag
+  SkyStage,           // SkyModel::makeSkySpectrum
+  AttenuationStage,   // InstrumentModel::makeAttenuatedSpectrum
+  DispersionStage,    // Wavelength to pixel axis (makePixelPhotonFlux)
+  ConvolutionStage,   // Line spread convolution (makePixelPhotonFlux)
+  DetectorStage,      // Detector::setPixelPhotonFlux / recalculate
+  SIMULATION_STAGE_COUNT
+};
+
+struct StageProfile {
+  uint64_t calls    = 0;
+  double   wallTime = 0; // s
+  double   cpuTime  = 0; // s, of the calling thread
+  uint64_t points   = 0; // Size of the curves the stage worked on
+};
+
+class SimulationProfile {
+    StageProfile m_stages[SIMULATION_STAGE_COUNT];
+
+  public:
+    static const char *stageName(SimulationStage);
+
+    StageProfile const &stage(SimulationStage) const;
+    StageProfile total() const;
+
+    void add(SimulationStage, double wallTime, double cpuTime, uint64_t points);
+    void merge(SimulationProfile const &);
+    void clear();
+};
+
+//
+// Adds the time elapsed between its construction and its destruction to
+// a stage of a profile, and traces it if the tracer is on. Does nothing
+// otherwise, so stages can be timed unconditionally.
+//
+
+class StageTimer {
+    SimulationProfile *m_profile;
+    SimulationStage    m_stage;
+    uint64_t           m_points = 0;
+    struct timespec    m_wallStart;
+    struct timespec    m_cpuStart;
+    bool               m_tracing;
+    uint64_t           m_traceStart = 0;
+
+  public:
+    StageTimer(SimulationProfile *, SimulationStage, uint64_t points = 0);
+    ~StageTimer();
+
+    StageTimer(StageTimer const &) = delete;
+    StageTimer &operator=(StageTimer const &) = delete;
+
+    void setPoints(uint64_t);
+};
+
+//
+// Allocation accounting. When LibETC is built with ETC_ALLOC_STATS, every
+// heap allocation of the process is counted and attributed to the
+// innermost curve operation running in the same thread (AllocationScope),
+// or to OtherAllocSite. Counters are process-wide.
+//
+
+enum AllocationSite {
+  CurveLoadAllocSite,      // Curve::load
+  CurveSetAllocSite,       // Curve::set
+  CurveCopyAllocSite,      // Curve::assign, fromExisting
+  CurveScaleAllocSite,     // Curve / Spectrum scaleAxis
+  CurveInvertAllocSite,    // Curve / Spectrum invertAxis
+  CurveMultiplyAllocSite,  // Curve::multiplyBy
+  CurveAddAllocSite,       // Curve::add
+  CurveIntegrateAllocSite, // Curve::integrate
+  SkySpectrumAllocSite,    // SkyModel::makeSkySpectrum
+  AttenuationAllocSite,    // InstrumentModel::makeAttenuatedSpectrum
+  PixelFluxAllocSite,      // InstrumentModel::makePixelPhotonFlux
+  OtherAllocSite,
+  ALLOCATION_SITE_COUNT
+};
+
+struct AllocationCounters {
+  uint64_t count = 0;
+  uint64_t bytes = 0;
+};
+
+struct AllocationProfile {
+  bool               enabled = false; // Built with ETC_ALLOC_STATS
+  AllocationCounters sites[ALLOCATION_SITE_COUNT];
+  uint64_t           liveBytes     = 0;
+  uint64_t           peakLiveBytes = 0;
+
+  static const char *siteName(AllocationSite);
+};
+
+AllocationProfile allocationProfile();
+
+// Clears the counters. The peak starts over from the current live bytes.
+void resetAllocationProfile();
+
+class AllocationScope {
+    int m_previous;
+
+  public:
+    AllocationScope(AllocationSite);
+    ~AllocationScope();
+
+    AllocationScope(AllocationScope const &) = delete;
+    AllocationScope &operator=(AllocationScope const &) = delete;
+};
+
+#ifdef ETC_ALLOC_STATS
+#  define ETC_ALLOC_SCOPE(site) AllocationScope _allocScope(site)
+#else
+#  define ETC_ALLOC_SCOPE(site) do { } while (false)
+#endif // ETC_ALLOC_STATS
+
+#endif // _ETC_SIMULATION_PROFILE_H
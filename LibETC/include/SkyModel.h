@@ -37,14 +37,18 @@ struct SkyProperties : public Config {
   virtual bool deserialize() override;
 };
 
+//
+// Sky model. This object is immutable after construction, so it can be
+// shared among simulations (see ModelRegistry). Observing conditions
+// (airmass, moon) are passed by the caller.
+//
+
 class SkyModel {
-  SkyProperties *m_properties = nullptr; // Borrowed
+  const SkyProperties *m_properties = nullptr; // Borrowed
 
   Curve    *m_skyExt       = nullptr;    // Owned
   Spectrum *m_skySpectrum  = nullptr;    // Owned
   Curve    *m_moonToMag    = nullptr;    // Owned
-  double    m_airmass      = 1.;
-  double    m_moonFraction = 0.;
 
   // TODO: Add moon spectrum
 
@@ -52,14 +56,15 @@ public:
   SkyModel();
   ~SkyModel();
 
-  SkyProperties *properties() const;
+  SkyProperties const *properties() const;
 
-  void setMoon(double);
-  void setAirmass(double);
-  void setZenithDistance(double);
+  static double zenithDistanceToAirmass(double);
 
   // Returns a radiance spectrum
-  Spectrum *makeSkySpectrum(Spectrum const &) const;
+  Spectrum *makeSkySpectrum(
+    Spectrum const &,
+    double airmass,
+    double moon) const;
 };
 
 #endif // _SKY_MODEL_H
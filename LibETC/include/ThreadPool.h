@@ -0,0 +1,99 @@
+//
+// ThreadPool.h: Pool of worker threads
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#ifndef _ETC_THREAD_POOL_H
+#define _ETC_THREAD_POOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <deque>
+#include <vector>
+#include <memory>
+
+//
+// Fixed-size pool of worker threads. Threads waiting for a task submitted
+// to the pool (wait) run pending tasks themselves while they wait, so
+// tasks can safely submit and wait for other tasks. parallelFor only runs
+// the iterations of its own loop, so it may be called with locks held.
+//
+
+class ThreadPool {
+    static ThreadPool *g_instance;
+
+    std::vector<std::thread>          m_workers;
+    std::deque<std::function<void()>> m_queue;
+    std::mutex                        m_mutex;
+    std::condition_variable           m_cond;
+    bool                              m_stopping = false;
+
+    void work();
+
+  public:
+    ThreadPool(unsigned threads = 0); // 0: one per hardware thread
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool const &) = delete;
+    ThreadPool &operator=(ThreadPool const &) = delete;
+
+    // Library-wide pool. Size can be set with TARSIS_ETC_THREADS.
+    static ThreadPool *instance();
+
+    // To be called in the child after fork(): the workers of the
+    // library-wide pool did not survive it. Replaces the pool by a new one.
+    static void restartAfterFork(unsigned threads = 0);
+
+    unsigned threads() const;
+
+    void push(std::function<void()>);
+    bool runPending();
+
+    template <class F> auto
+    submit(F &&func) -> std::future<decltype(func())>
+    {
+      typedef decltype(func()) R;
+      auto task = std::make_shared<std::packaged_task<R()>>(
+        std::forward<F>(func));
+      auto future = task->get_future();
+
+      push([task] () { (*task)(); });
+
+      return future;
+    }
+
+    // Wait for a future, running pending tasks in the meantime
+    template <class T> T
+    wait(std::future<T> &future)
+    {
+      while (future.wait_for(std::chrono::seconds(0))
+             != std::future_status::ready)
+        if (!runPending())
+          future.wait_for(std::chrono::milliseconds(1));
+
+      return future.get();
+    }
+
+    // Run func(0) ... func(count - 1) in parallel and wait for all of them.
+    // If any of them throws, the first exception is rethrown.
+    void parallelFor(size_t count, std::function<void(size_t)> const &func);
+};
+
+#endif // _ETC_THREAD_POOL_H
@@ -0,0 +1,108 @@
+//
+// Tracer.h: Trace events in the Chrome / Perfetto JSON format
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#ifndef _ETC_TRACER_H
+#define _ETC_TRACER_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+struct TraceEvent {
+  std::string name;
+  const char *category;
+  uint64_t    start;    // us since the tracer was started
+  uint64_t    duration; // us
+  unsigned    tid;
+  std::string args;     // JSON object members, e.g. "\"slice\": 3"
+};
+
+//
+// Library-wide tracer. It is off until started: spans opened while it is
+// off cost a single atomic load. Events are kept in memory and written as
+// complete ("X") events by write(), to be opened in Perfetto or in
+// chrome://tracing.
+//
+
+class Tracer {
+    static Tracer *g_instance;
+
+    std::atomic<bool>       m_enabled;
+    std::mutex              m_mutex;
+    std::vector<TraceEvent> m_events;
+    std::atomic<int64_t>    m_origin; // ns, CLOCK_MONOTONIC
+
+    static int64_t monotonicNs();
+
+    Tracer();
+
+  public:
+    static Tracer *instance();
+
+    // Starts the tracer if TARSIS_ETC_TRACE is set. Returns its value.
+    static std::string startFromEnvironment();
+
+    static inline bool
+    enabled()
+    {
+      return instance()->m_enabled.load(std::memory_order_acquire);
+    }
+
+    static unsigned threadId(); // Small integer, stable per thread
+
+    void start(); // Drops previous events
+    void stop();
+
+    uint64_t now() const; // us
+    void add(TraceEvent &&);
+
+    // Throws if the file cannot be written
+    void write(std::string const &path);
+};
+
+//
+// Traces the time between its construction and its destruction. Arguments
+// are JSON object members. Use the helpers below to build them.
+//
+
+class TraceSpan {
+    bool        m_enabled;
+    const char *m_category;
+    std::string m_name;
+    std::string m_args;
+    uint64_t    m_start = 0;
+
+  public:
+    TraceSpan(const char *category, std::string const &name, std::string const &args = "");
+    ~TraceSpan();
+
+    TraceSpan(TraceSpan const &) = delete;
+    TraceSpan &operator=(TraceSpan const &) = delete;
+
+    bool enabled() const;
+    void addArg(std::string const &name, double value);
+    void addArg(std::string const &name, std::string const &value);
+};
+
+std::string traceArg(std::string const &name, double value);
+std::string traceArg(std::string const &name, std::string const &value);
+
+#endif // _ETC_TRACER_H
@@ -0,0 +1,220 @@
+//
+// AllocationProfile.cpp: Allocation accounting of curve operations
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include <SimulationProfile.h>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <cstddef>
+#include <stdexcept>
+
+static const char *g_siteNames[ALLOCATION_SITE_COUNT] = {
+  "curve load",
+  "curve set",
+  "curve copy",
+  "curve scale",
+  "curve invert",
+  "curve multiply",
+  "curve add",
+  "curve integral",
+  "sky spectrum",
+  "attenuation",
+  "pixel flux",
+  "other"
+};
+
+struct AtomicCounters {
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> bytes;
+};
+
+// Zero-initialized before any allocation can happen
+static AtomicCounters        g_sites[ALLOCATION_SITE_COUNT];
+static std::atomic<uint64_t> g_liveBytes;
+static std::atomic<uint64_t> g_peakLiveBytes;
+static thread_local int      g_currentSite = OtherAllocSite;
+
+const char *
+AllocationProfile::siteName(AllocationSite site)
+{
+  if (site < 0 || site >= ALLOCATION_SITE_COUNT)
+    throw std::runtime_error("Invalid allocation site");
+
+  return g_siteNames[site];
+}
+
+AllocationProfile
+allocationProfile()
+{
+  AllocationProfile profile;
+
+#ifdef ETC_ALLOC_STATS
+  profile.enabled = true;
+#endif // ETC_ALLOC_STATS
+
+  for (auto i = 0; i < ALLOCATION_SITE_COUNT; ++i) {
+    profile.sites[i].count = g_sites[i].count.load(std::memory_order_relaxed);
+    profile.sites[i].bytes = g_sites[i].bytes.load(std::memory_order_relaxed);
+  }
+
+  profile.liveBytes     = g_liveBytes.load(std::memory_order_relaxed);
+  profile.peakLiveBytes = g_peakLiveBytes.load(std::memory_order_relaxed);
+
+  return profile;
+}
+
+void
+resetAllocationProfile()
+{
+  for (auto &site : g_sites) {
+    site.count = 0;
+    site.bytes = 0;
+  }
+
+  g_peakLiveBytes = g_liveBytes.load();
+}
+
+AllocationScope::AllocationScope(AllocationSite site)
+{
+  m_previous    = g_currentSite;
+  g_currentSite = site;
+}
+
+AllocationScope::~AllocationScope()
+{
+  g_currentSite = m_previous;
+}
+
+#ifdef ETC_ALLOC_STATS
+//
+// Replacements of the global allocation functions. Blocks are prefixed by
+// their size, so that deallocations can be subtracted from the live bytes.
+// Aligned allocations are left to the default implementation.
+//
+
+static const size_t g_header = alignof(std::max_align_t);
+
+static void *
+countedAlloc(size_t size)
+{
+  auto block = static_cast<char *>(malloc(size + g_header));
+  uint64_t live, peak;
+
+  if (block == nullptr)
+    return nullptr;
+
+  *reinterpret_cast<size_t *>(block) = size;
+
+  g_sites[g_currentSite].count.fetch_add(1, std::memory_order_relaxed);
+  g_sites[g_currentSite].bytes.fetch_add(size, std::memory_order_relaxed);
+
+  live = g_liveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+  peak = g_peakLiveBytes.load(std::memory_order_relaxed);
+
+  while (live > peak
+         && !g_peakLiveBytes.compare_exchange_weak(
+           peak,
+           live,
+           std::memory_order_relaxed));
+
+  return block + g_header;
+}
+
+static void
+countedFree(void *ptr)
+{
+  char *block;
+
+  if (ptr == nullptr)
+    return;
+
+  block = static_cast<char *>(ptr) - g_header;
+
+  g_liveBytes.fetch_sub(
+    *reinterpret_cast<size_t *>(block),
+    std::memory_order_relaxed);
+
+  free(block);
+}
+
+void *
+operator new(size_t size)
+{
+  void *ptr = countedAlloc(size);
+
+  if (ptr == nullptr)
+    throw std::bad_alloc();
+
+  return ptr;
+}
+
+void *
+operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void *
+operator new(size_t size, std::nothrow_t const &) noexcept
+{
+  return countedAlloc(size);
+}
+
+void *
+operator new[](size_t size, std::nothrow_t const &) noexcept
+{
+  return countedAlloc(size);
+}
+
+void
+operator delete(void *ptr) noexcept
+{
+  countedFree(ptr);
+}
+
+void
+operator delete[](void *ptr) noexcept
+{
+  countedFree(ptr);
+}
+
+void
+operator delete(void *ptr, size_t) noexcept
+{
+  countedFree(ptr);
+}
+
+void
+operator delete[](void *ptr, size_t) noexcept
+{
+  countedFree(ptr);
+}
+
+void
+operator delete(void *ptr, std::nothrow_t const &) noexcept
+{
+  countedFree(ptr);
+}
+
+void
+operator delete[](void *ptr, std::nothrow_t const &) noexcept
+{
+  countedFree(ptr);
+}
+#endif // ETC_ALLOC_STATS
@@ -19,6 +19,7 @@
 
 #include <DataFileManager.h>
 #include <ConfigManager.h>
+#include <EmbeddedData.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <cerrno>
@@ -70,10 +71,18 @@ Config::load()
     m_objectName,
     false);
 
-  // File exists!
-  if (access(path.c_str(), R_OK) != -1) {
+  // File exists! (resolved paths are always readable)
+  if (!path.empty()) {
     try {
-      m_yamlConfig = YAML::LoadFile(path);
+      auto embedded = EmbeddedData::fromPath(path);
+
+      if (embedded != nullptr)
+        m_yamlConfig = YAML::Load(
+          std::string(
+            reinterpret_cast<const char *>(embedded->data),
+            embedded->size));
+      else
+        m_yamlConfig = YAML::LoadFile(path);
     } catch (std::runtime_error const &e) {
       fprintf(
         stderr,
@@ -100,7 +109,7 @@ Config::save()
     m_objectName,
     true);
 
-  if (!serialize())
+  if (path.empty() || !serialize())
     return false;
 
   YAML::Emitter out;
@@ -121,42 +130,61 @@ Config::save()
   fwrite(out.c_str(), out.size(), 1, fp);
   fclose(fp);
 
+  // We may have created a new file
+  DataFileManager::instance()->invalidateCache(
+    CONFIG_MANAGER_DIRECTORY "/" + m_objectName + ".yaml");
+
   return true;
 }
 
-ConfigManager::ConfigManager()
+ConfigManager::ConfigManager() : m_snapshot(new ConfigSnapshot())
 {
-  struct stat sbuf;
+}
 
-  m_configDir = DataFileManager::instance()->suggest(CONFIG_MANAGER_DIRECTORY);
-  if (!m_configDir.empty()) {
-    try {
-      if (stat(m_configDir.c_str(), &sbuf) == -1) {
-        if (errno == ENOENT) {
-          if (mkdir(m_configDir.c_str(), 0700) == -1)
-            throw std::runtime_error("Failed to create config directory");
-        } else {
+//
+// The config directory is only looked up (and created, if necessary) when
+// something is about to be saved. Programs that only read configs, e.g.
+// from the embedded data, never touch the filesystem for it.
+//
+bool
+ConfigManager::prepareConfigDir()
+{
+  std::call_once(m_configDirFlag, [this] () {
+    struct stat sbuf;
+
+    m_configDir = DataFileManager::instance()->suggest(CONFIG_MANAGER_DIRECTORY);
+    if (!m_configDir.empty()) {
+      try {
+        if (stat(m_configDir.c_str(), &sbuf) == -1) {
+          if (errno == ENOENT) {
+            if (mkdir(m_configDir.c_str(), 0700) == -1)
+              throw std::runtime_error("Failed to create config directory");
+            DataFileManager::instance()->invalidateCache(CONFIG_MANAGER_DIRECTORY);
+          } else {
+            throw std::runtime_error(
+              "Config directory `" + m_configDir + "' inaccessible: " + strerror(errno));
+          }
+        } else if (!S_ISDIR(sbuf.st_mode)) {
           throw std::runtime_error(
-            "Config directory `" + m_configDir + "' inaccessible: " + strerror(errno));
+            "Config directory `" + m_configDir + "' is not a directory");
         }
-      } else if (!S_ISDIR(sbuf.st_mode)) {
-        throw std::runtime_error(
-          "Config directory `" + m_configDir + "' is not a directory");
+
+        m_canSaveConfig = true;
+      } catch (std::runtime_error const &e) {
+        fprintf(
+          stderr,
+          "warning: cannot create config directory: %s\n", e.what());
       }
+    }
 
-      m_canSaveConfig = true;
-    } catch (std::runtime_error const &e) {
+    if (!m_canSaveConfig) {
       fprintf(
         stderr,
-        "warning: cannot create config directory: %s\n", e.what());
+        "warning: no writable config directory available, configurations cannot be saved!\n");
     }
-  }
+  });
 
-  if (!m_canSaveConfig) {
-    fprintf(
-      stderr,
-      "warning: no writable config directory available, configurations cannot be saved!\n");
-  }
+  return m_canSaveConfig;
 }
 
 bool
@@ -164,20 +192,80 @@ ConfigManager::saveAll()
 {
   bool ok = true;
 
-  if (!m_canSaveConfig)
+  if (!prepareConfigDir())
     return false;
-    
+
+  std::lock_guard<std::mutex> guard(m_mutex);
+
   for (auto p : m_configList)
     ok = p->save() && ok;
 
   return ok;
 }
 
+Config const *
+ConfigSnapshot::find(std::string const &name) const
+{
+  auto it = configs.find(name);
+
+  return it == configs.end() ? nullptr : it->second;
+}
+
+// Called with m_mutex held
+void
+ConfigManager::publish(std::string const &name, Config *config)
+{
+  const ConfigSnapshot *current = m_snapshot.load(std::memory_order_relaxed);
+  ConfigSnapshot *next = new ConfigSnapshot(*current);
+
+  ++next->version;
+  next->configs[name] = config;
+
+  m_snapshot.store(next, std::memory_order_release);
+  m_retiredSnapshots.push_back(current);
+}
+
+ConfigSnapshot const *
+ConfigManager::snapshot() const
+{
+  return m_snapshot.load(std::memory_order_acquire);
+}
+
+unsigned
+ConfigManager::version() const
+{
+  return snapshot()->version;
+}
+
+bool
+ConfigManager::reload(std::string const &name)
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  Config const *oldConfig = snapshot()->find(name);
+
+  // Never loaded: it will be loaded from the new file anyway
+  if (oldConfig == nullptr)
+    return false;
+
+  Config *newConfig = m_factories[name](name);
+
+  newConfig->load();
+
+  for (auto &p : m_configList)
+    if (p == oldConfig)
+      p = newConfig;
+
+  m_retiredList.push_back(oldConfig);
+  publish(name, newConfig);
+
+  return true;
+}
+
 std::string
-ConfigManager::getConfigFilePath(std::string const &name, bool write) const
+ConfigManager::getConfigFilePath(std::string const &name, bool write)
 {
   if (write)
-    return m_configDir + "/" + name + ".yaml";
+    return prepareConfigDir() ? m_configDir + "/" + name + ".yaml" : "";
   else
     return DataFileManager::instance()->resolve(
       CONFIG_MANAGER_DIRECTORY "/" + name + ".yaml");
@@ -186,8 +274,10 @@ ConfigManager::getConfigFilePath(std::string const &name, bool write) const
 ConfigManager *
 ConfigManager::instance()
 {
-  if (g_instance == nullptr)
-    g_instance = new ConfigManager();
-  
+  static std::once_flag flag;
+
+  // Models may be loaded from several threads at once
+  std::call_once(flag, [] () { g_instance = new ConfigManager(); });
+
   return g_instance;
 }
\ No newline at end of file
@@ -0,0 +1,316 @@
+//
+// CsvReader.cpp: Fast reader of numeric CSV files
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include <CsvReader.h>
+#include <EmbeddedData.h>
+#include <stdexcept>
+#include <algorithm>
+#include <charconv>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+CsvReader::CsvReader(std::string const &path, char separator)
+{
+  struct stat sbuf;
+  int fd;
+  auto embedded = EmbeddedData::fromPath(path);
+
+  m_path      = path;
+  m_separator = separator;
+
+  // Compiled-in data files are read in place
+  if (embedded != nullptr) {
+    m_data = reinterpret_cast<const char *>(embedded->data);
+    m_size = embedded->size;
+    indexRows();
+    return;
+  }
+
+  if ((fd = open(path.c_str(), O_RDONLY)) == -1)
+    throw std::runtime_error(
+      "Cannot open `" + path + "' for reading: " + strerror(errno));
+
+  if (fstat(fd, &sbuf) == -1) {
+    int err = errno;
+    close(fd);
+    throw std::runtime_error(
+      "Cannot stat `" + path + "': " + strerror(err));
+  }
+
+  m_size = static_cast<size_t>(sbuf.st_size);
+
+  if (m_size > 0) {
+    m_mapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m_mapping == MAP_FAILED) {
+      int err = errno;
+      m_mapping = nullptr;
+      close(fd);
+      throw std::runtime_error(
+        "Cannot map `" + path + "' to memory: " + strerror(err));
+    }
+
+    madvise(m_mapping, m_size, MADV_SEQUENTIAL);
+    m_data = static_cast<const char *>(m_mapping);
+  }
+
+  close(fd);
+
+  indexRows();
+}
+
+CsvReader::CsvReader(
+  const char *data,
+  size_t size,
+  std::string const &name,
+  char separator)
+{
+  m_path      = name;
+  m_separator = separator;
+  m_data      = data;
+  m_size      = size;
+
+  indexRows();
+}
+
+CsvReader::~CsvReader()
+{
+  if (m_mapping != nullptr)
+    munmap(m_mapping, m_size);
+}
+
+void
+CsvReader::detach()
+{
+  if (m_mapping == nullptr)
+    return;
+
+  // Row offsets stay valid, only the base pointer moves
+  m_owned.assign(m_data, m_size);
+  munmap(m_mapping, m_size);
+  m_mapping = nullptr;
+  m_data    = m_owned.data();
+}
+
+void
+CsvReader::indexRows()
+{
+  size_t p = 0;
+
+  // Skip UTF-8 BOM
+  if (m_size >= 3 && memcmp(m_data, "\xef\xbb\xbf", 3) == 0)
+    p = 3;
+
+  while (p < m_size) {
+    const char *nl = static_cast<const char *>(
+      memchr(m_data + p, '\n', m_size - p));
+    size_t next = nl == nullptr ? m_size : static_cast<size_t>(nl - m_data);
+    size_t end  = next;
+
+    if (end > p && m_data[end - 1] == '\r')
+      --end;
+
+    // Last line without newline is only a row if it has something
+    if (nl != nullptr || end > p)
+      m_rows.push_back(std::make_pair(p, end));
+
+    p = next + 1;
+  }
+}
+
+void
+CsvReader::splitRow(
+  unsigned row,
+  std::vector<std::string_view> &cells,
+  unsigned maxCells) const
+{
+  size_t p   = m_rows[row].first;
+  size_t end = m_rows[row].second;
+
+  cells.clear();
+
+  while (cells.size() < maxCells) {
+    const char *sep = static_cast<const char *>(
+      memchr(m_data + p, m_separator, end - p));
+    size_t cellEnd = sep == nullptr ? end : static_cast<size_t>(sep - m_data);
+
+    cells.push_back(std::string_view(m_data + p, cellEnd - p));
+
+    if (sep == nullptr)
+      break;
+
+    p = cellEnd + 1;
+  }
+}
+
+std::string const &
+CsvReader::path() const
+{
+  return m_path;
+}
+
+unsigned
+CsvReader::rows() const
+{
+  return static_cast<unsigned>(m_rows.size());
+}
+
+unsigned
+CsvReader::cols() const
+{
+  std::vector<std::string_view> cells;
+
+  if (m_rows.empty())
+    return 0;
+
+  splitRow(0, cells);
+
+  return static_cast<unsigned>(cells.size());
+}
+
+bool
+CsvReader::parse(std::string_view cell, double &value)
+{
+  const char *p   = cell.data();
+  const char *end = p + cell.size();
+
+  // Trim blanks and quotes
+  while (p < end && (*p == ' ' || *p == '\t'))
+    ++p;
+  while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+    --end;
+  if (end - p >= 2 && *p == '"' && end[-1] == '"') {
+    ++p;
+    --end;
+  }
+
+  if (p < end && *p == '+')
+    ++p;
+
+  if (p == end)
+    return false;
+
+#ifdef __cpp_lib_to_chars
+  auto result = std::from_chars(p, end, value);
+
+  return result.ec == std::errc() && result.ptr == end;
+#else
+  // No floating-point from_chars. Fall back to strtod on a copy.
+  char buf[64];
+  std::string longCell;
+  const char *str = buf;
+  char *strEnd;
+  size_t len = static_cast<size_t>(end - p);
+
+  if (len < sizeof(buf)) {
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+  } else {
+    longCell.assign(p, len);
+    str = longCell.c_str();
+  }
+
+  value = strtod(str, &strEnd);
+
+  return strEnd == str + len;
+#endif // __cpp_lib_to_chars
+}
+
+bool
+CsvReader::cellToDouble(
+  std::vector<std::string_view> const &cells,
+  unsigned row,
+  unsigned col,
+  double &value,
+  std::vector<CsvCellIssue> &issues) const
+{
+  if (col >= cells.size()) {
+    issues.push_back(CsvCellIssue {CsvMissingCell, row, col, ""});
+    return false;
+  }
+
+  if (!parse(cells[col], value)) {
+    issues.push_back(
+      CsvCellIssue {CsvInvalidValue, row, col, std::string(cells[col])});
+    return false;
+  }
+
+  return true;
+}
+
+void
+CsvReader::readPairs(
+  bool transpose,
+  unsigned xIndex,
+  unsigned yIndex,
+  std::vector<double> &x,
+  std::vector<double> &y,
+  std::vector<CsvCellIssue> &issues) const
+{
+  std::vector<std::string_view> xCells, yCells;
+  double xVal, yVal;
+
+  x.clear();
+  y.clear();
+
+  if (transpose) {
+    unsigned count = cols();
+
+    if (xIndex >= rows() || yIndex >= rows())
+      return;
+
+    splitRow(xIndex, xCells);
+    splitRow(yIndex, yCells);
+
+    x.reserve(count);
+    y.reserve(count);
+
+    for (auto i = 0u; i < count; ++i) {
+      if (!cellToDouble(xCells, xIndex, i, xVal, issues))
+        continue;
+      if (!cellToDouble(yCells, yIndex, i, yVal, issues))
+        continue;
+
+      x.push_back(xVal);
+      y.push_back(yVal);
+    }
+  } else {
+    unsigned count    = rows();
+    unsigned maxCells = std::max(xIndex, yIndex) + 1;
+
+    x.reserve(count);
+    y.reserve(count);
+
+    for (auto i = 0u; i < count; ++i) {
+      splitRow(i, xCells, maxCells);
+
+      if (!cellToDouble(xCells, i, xIndex, xVal, issues))
+        continue;
+      if (!cellToDouble(xCells, i, yIndex, yVal, issues))
+        continue;
+
+      x.push_back(xVal);
+      y.push_back(yVal);
+    }
+  }
+}
@@ -18,14 +18,17 @@
 //
 
 #include <Curve.h>
+#include <SimulationProfile.h>
 #include <cstdio>
 #include <cerrno>
 #include <stdexcept>
 #include <cstring>
-#include <fstream>
-#include <set>
+#include <iterator>
+#include <vector>
+#include <algorithm>
 
-#include <rapidcsv.h>
+#include <CsvReader.h>
+#include <DataWriter.h>
 
 void
 CurveAssignProxy::operator=(double val)
@@ -38,6 +41,15 @@ CurveAssignProxy::operator double() const
   return parent->get(xPoint);
 }
 
+Curve::Curve()
+{
+}
+
+Curve::Curve(std::vector<double> &&x, std::vector<double> &&y)
+{
+  adopt(std::move(x), std::move(y));
+}
+
 double
 Curve::operator[](double x) const
 {
@@ -75,23 +87,103 @@ Curve::setUnits(CurveAxis axis, std::string const &units)
   }
 }
 
+//
+// Sort points by X and remove repeated X values. If keepLast is set,
+// repeated points behave as if they were set() one after another. 
+// Otherwise, the first one is kept. Arrays that are already sorted (in
+// either direction) are not sorted again.
+//
+void
+Curve::sortPoints(
+  std::vector<double> &x,
+  std::vector<double> &y,
+  bool keepLast)
+{
+  size_t n = x.size();
+  bool ascending  = true;
+  bool descending = true;
+
+  for (size_t i = 1; i < n && (ascending || descending); ++i) {
+    ascending  = ascending  && x[i - 1] < x[i];
+    descending = descending && x[i - 1] > x[i];
+  }
+
+  if (ascending)
+    return;
+
+  if (descending) {
+    std::reverse(x.begin(), x.end());
+    std::reverse(y.begin(), y.end());
+    return;
+  }
+
+  std::vector<size_t> order(n);
+  std::vector<double> newX, newY;
+
+  for (size_t i = 0; i < n; ++i)
+    order[i] = i;
+
+  std::stable_sort(
+    order.begin(),
+    order.end(),
+    [&x] (size_t a, size_t b) { return x[a] < x[b]; });
+
+  newX.reserve(n);
+  newY.reserve(n);
+
+  for (auto i : order) {
+    if (!newX.empty() && !(newX.back() < x[i])) {
+      if (keepLast)
+        newY.back() = y[i];
+      continue;
+    }
+
+    newX.push_back(x[i]);
+    newY.push_back(y[i]);
+  }
+
+  x = std::move(newX);
+  y = std::move(newY);
+}
+
+void
+Curve::adopt(std::vector<double> &&x, std::vector<double> &&y)
+{
+  if (x.size() != y.size())
+    throw std::runtime_error("Curve arrays have different sizes");
+
+  sortPoints(x, y, true);
+
+  m_x = std::move(x);
+  m_y = std::move(y);
+}
+
+void
+Curve::reserve(size_t size)
+{
+  m_x.reserve(size);
+  m_y.reserve(size);
+}
+
+void
+Curve::shrinkToFit()
+{
+  m_x.shrink_to_fit();
+  m_y.shrink_to_fit();
+}
+
 double
 Curve::integral() const
 {
-  std::map<double, double>::const_iterator it, next;
   double accum = 0;
   double err   = 0;
 
   if (m_oobRight + m_oobLeft != 0)
     return std::numeric_limits<double>::infinity() * (m_oobLeft + m_oobRight);
   
-  it = m_curve.begin();
-  if (it == m_curve.end())
-    return 0;
-
-  while ((next = std::next(it)) != m_curve.end()) {
-    double dx = next->first - it->first;
-    double my = .5 * (next->second + it->second);
+  for (size_t i = 1; i < m_x.size(); ++i) {
+    double dx = m_x[i] - m_x[i - 1];
+    double my = .5 * (m_y[i] + m_y[i - 1]);
 
     // More Kahan
     double term_real         = my * dx - err;
@@ -99,8 +191,6 @@ Curve::integral() const
     volatile double term_err = tmp - accum;
     err                      = term_err - term_real;
     accum                    = tmp;
-
-    it = next;
   }
 
   return accum;
@@ -109,21 +199,19 @@ Curve::integral() const
 double
 Curve::distMean() const
 {
-  std::map<double, double>::const_iterator it, next;
   double accum = 0;
   double err   = 0;
 
   if (m_oobRight + m_oobLeft != 0)
     return .5 * (m_oobLeft + m_oobRight);
   
-  it = m_curve.begin();
-  if (it == m_curve.end())
-    return it->first;
+  if (m_x.empty())
+    return std::numeric_limits<double>::quiet_NaN();
 
-  while ((next = std::next(it)) != m_curve.end()) {
-    double dx = next->first - it->first;
-    double x0 = .5 * (next->first + it->first);
-    double my = .5 * (next->second + it->second);
+  for (size_t i = 1; i < m_x.size(); ++i) {
+    double dx = m_x[i] - m_x[i - 1];
+    double x0 = .5 * (m_x[i] + m_x[i - 1]);
+    double my = .5 * (m_y[i] + m_y[i - 1]);
 
     // More Kahan
     double term_real         = x0 * my * dx - err;
@@ -131,8 +219,6 @@ Curve::distMean() const
     volatile double term_err = tmp - accum;
     err                      = term_err - term_real;
     accum                    = tmp;
-
-    it = next;
   }
 
   return accum / integral();
@@ -141,47 +227,43 @@ Curve::distMean() const
 void
 Curve::integrate(double K)
 {
+  ETC_ALLOC_SCOPE(CurveIntegrateAllocSite);
+
   double accum = K;
   double err   = 0;
-  double x0, x_prev, y_prev, x, y;
-  
+  double x_prev, y_prev, x, y, dx;
+  size_t n = m_x.size();
+
   m_oobLeft = K;
 
-  if (m_curve.empty()) {
+  if (n == 0) {
     m_oobRight = K;
     return;
   }
   
-  if (m_curve.size() == 1) {
-    auto it    = m_curve.begin();
-    it->second = K;
+  if (n == 1) {
+    m_y[0]     = K;
     m_oobRight = K;
     return;
   }
 
-  // Get point at x0
-  auto it       = m_curve.begin();
-  auto next     = std::next(it);
-  double dx     = next->first - it->first;
-  x0            = it->first;
-
   //
   // At x_1 there must be the accumulated area from x_0 to x_1
   // At x_2 there must be the accumulared area from x_0 to x_2
   // And so on and so forth
   //
 
-  x = it->first;
-  y = it->second;
-
-  it = next;
+  x      = m_x[0];
+  y      = m_y[0];
+  x_prev = x;
+  dx     = m_x[1] - m_x[0];
 
-  while (it != m_curve.end()) {
+  for (size_t i = 1; i < n; ++i) {
     x_prev = x;
     y_prev = y;
 
-    x  = it->first;
-    y  = it->second;
+    x  = m_x[i];
+    y  = m_y[i];
     dx = x - x_prev;
 
     // Kahan summation to calculate Y
@@ -190,14 +272,11 @@ Curve::integrate(double K)
     volatile double term_err = tmp - accum;
     err                      = term_err - term_real;
     accum                    = tmp;
-    it->second               = accum;
-
-    // Advance
-    ++it;
+    m_y[i]                   = accum;
   }
 
-  m_curve[x0] = K;
-  m_curve[x + dx] = y * (x - x_prev + dx) + m_curve[x_prev];
+  m_y[0] = K;
+  set(x + dx, y * (x - x_prev + dx) + m_y[n - 2]);
 
   m_oobRight = accum;
 }
@@ -209,66 +288,41 @@ Curve::flip()
   m_unitsX = m_unitsY;
   m_unitsY = tmp;
 
-  std::list<std::map<double, double>::node_type> xp;
-
-  auto it = m_curve.cbegin();
-  auto next = std::next(it);
-
-  while (it != m_curve.end()) {
-    next = std::next(it);
-    xp.push_back(std::move(m_curve.extract(it)));
-    it = next;
-  }
-  
-  for (auto &p : xp) {
-    double tmp = p.key();
-    p.key() = p.mapped();
-    p.mapped() = tmp;
-    m_curve.insert(std::move(p));
-  }
+  m_x.swap(m_y);
+  sortPoints(m_x, m_y, false);
 }
 
 void
 Curve::extendLeft()
 {
-  if (m_curve.empty())
+  if (m_x.empty())
     return;
   
-  m_oobLeft = m_curve.cbegin()->second;
+  m_oobLeft = m_y.front();
 }
 
 void
 Curve::extendRight()
 {
-  if (m_curve.empty())
+  if (m_x.empty())
     return;
   
-  m_oobRight = std::prev(m_curve.end())->second;
+  m_oobRight = m_y.back();
 }
 
 void
 Curve::scaleAxis(CurveAxis axis, double factor)
 {
-  if (axis == XAxis) {
-    std::list<std::map<double, double>::node_type> xp;
-
-    auto it = m_curve.cbegin();
-    auto next = std::next(it);
+  ETC_ALLOC_SCOPE(CurveScaleAllocSite);
 
-    while (it != m_curve.end()) {
-      next = std::next(it);
-      xp.push_back(std::move(m_curve.extract(it)));
-      it = next;
-    }
-
-    for (auto &p : xp) {
-      p.key() *= factor;
-      m_curve.insert(std::move(p));
-    }
+  if (axis == XAxis) {
+    for (auto &x : m_x)
+      x *= factor;
 
+    sortPoints(m_x, m_y, false);
   } else {
-    for (auto &p : m_curve)
-      p.second *= factor;
+    for (auto &y : m_y)
+      y *= factor;
 
     m_oobLeft  *= factor;
     m_oobRight *= factor;
@@ -278,25 +332,16 @@ Curve::scaleAxis(CurveAxis axis, double factor)
 void
 Curve::scaleAxis(CurveAxis axis, Curve const &curve)
 {
-  if (axis == XAxis) {
-    std::list<std::map<double, double>::node_type> xp;
+  ETC_ALLOC_SCOPE(CurveScaleAllocSite);
 
-    auto it = m_curve.cbegin();
-    auto next = std::next(it);
+  if (axis == XAxis) {
+    for (auto &x : m_x)
+      x = curve(x);
 
-    while (it != m_curve.end()) {
-      next = std::next(it);
-      xp.push_back(std::move(m_curve.extract(it)));
-      it = next;
-    }
-    
-    for (auto &p : xp) {
-      p.key() = curve(p.key());
-      m_curve.insert(std::move(p));
-    }
+    sortPoints(m_x, m_y, false);
   } else {
-    for (auto &p : m_curve)
-      p.second = curve(p.second);
+    for (auto &y : m_y)
+      y = curve(y);
     
     m_oobLeft  = curve(m_oobLeft);
     m_oobRight = curve(m_oobRight);
@@ -306,25 +351,16 @@ Curve::scaleAxis(CurveAxis axis, Curve const &curve)
 void
 Curve::invertAxis(CurveAxis axis, double factor)
 {
-  if (axis == XAxis) {
-    std::list<std::map<double, double>::node_type> xp;
+  ETC_ALLOC_SCOPE(CurveInvertAllocSite);
 
-    auto it = m_curve.cbegin();
-    auto next = std::next(it);
+  if (axis == XAxis) {
+    for (auto &x : m_x)
+      x = factor / x;
 
-    while (it != m_curve.end()) {
-      next = std::next(it);
-      xp.push_back(std::move(m_curve.extract(it)));
-      it = next;
-    }
-    
-    for (auto &p : xp) {
-      p.key() = factor / p.key();
-      m_curve.insert(std::move(p));
-    }
+    sortPoints(m_x, m_y, false);
   } else {
-    for (auto &p : m_curve)
-      p.second = factor / p.second;
+    for (auto &y : m_y)
+      y = factor / y;
     
     m_oobLeft  = 1 / m_oobLeft;
     m_oobRight = 1 / m_oobRight;
@@ -334,39 +370,51 @@ Curve::invertAxis(CurveAxis axis, double factor)
 void
 Curve::set(double x, double y)
 {
-  m_curve[x] = y;
+  ETC_ALLOC_SCOPE(CurveSetAllocSite);
+
+  // Appending is the most common case
+  if (m_x.empty() || m_x.back() < x) {
+    m_x.push_back(x);
+    m_y.push_back(y);
+    return;
+  }
+
+  auto it  = std::lower_bound(m_x.begin(), m_x.end(), x);
+  auto pos = it - m_x.begin();
+
+  if (*it == x) {
+    m_y[pos] = y;
+  } else {
+    m_x.insert(it, x);
+    m_y.insert(m_y.begin() + pos, y);
+  }
 }
 
 std::list<double>
 Curve::xPoints() const
 {
-  std::list<double> xP;
-
-  for (auto &p : m_curve)
-    xP.push_back(p.first);
-
-  return xP;
+  return std::list<double>(m_x.begin(), m_x.end());
 }
 
 double
 Curve::get(double x) const
 {
-  auto next = m_curve.lower_bound(x);
-  if (next == m_curve.end())
+  size_t next = std::lower_bound(m_x.begin(), m_x.end(), x) - m_x.begin();
+  if (next == m_x.size())
     return m_oobRight;
 
-  if (next == m_curve.begin()) {
-    if (x < next->first)
+  if (next == 0) {
+    if (x < m_x[0])
       return m_oobLeft;
-    return next->second;
+    return m_y[0];
   }
   
-  auto prev = std::prev(next);
+  size_t prev = next - 1;
   
-  double x0 = prev->first;
-  double y0 = prev->second;
-  double x1 = next->first;
-  double y1 = next->second;
+  double x0 = m_x[prev];
+  double y0 = m_y[prev];
+  double x1 = m_x[next];
+  double y1 = m_y[next];
 
   return y0 + (x - x0) * (y1 - y0) / (x1 - x0);
 }
@@ -374,33 +422,33 @@ Curve::get(double x) const
 double
 Curve::getdiff(double x) const
 {
-  auto next = m_curve.lower_bound(x);
-  if (next == m_curve.end())
+  size_t next = std::lower_bound(m_x.begin(), m_x.end(), x) - m_x.begin();
+  if (next == m_x.size())
     return 0;
 
-  if (next == m_curve.begin())
+  if (next == 0)
     return 0;
   
-  auto prev = std::prev(next);
+  size_t prev = next - 1;
   
-  double x0 = prev->first;
-  double y0 = prev->second;
-  double x1 = next->first;
-  double y1 = next->second;
+  double x0 = m_x[prev];
+  double y0 = m_y[prev];
+  double x1 = m_x[next];
+  double y1 = m_y[next];
   
   // Two cases:
-  if (next->first != x) {
+  if (x1 != x) {
     // Middle of a segment. Easy
     return (y1 - y0) / (x1 - x0);
   } else {
     // Edge of a segment. We need to take the next one into account
-    auto after = std::next(next);
+    size_t after = next + 1;
 
-    if (after == m_curve.end())
+    if (after == m_x.size())
       return 0;
 
-    double x2 = after->first;
-    double y2 = after->second;
+    double x2 = m_x[after];
+    double y2 = m_y[after];
 
     return (y2 - y0) / (x2 - x0);
   }
@@ -409,116 +457,130 @@ Curve::getdiff(double x) const
 void
 Curve::multiplyBy(Curve const &curve)
 {
+  ETC_ALLOC_SCOPE(CurveMultiplyAllocSite);
+
   // Construct the union of both curves
-  std::set<double> xp;
-  std::list<std::pair<double, double>> newPairs;
+  std::vector<double> xp, yp;
   Curve &self = *this;
 
-  for (auto &p : m_curve)
-    xp.emplace(p.first);
-
-  for (auto &p : curve.m_curve)
-    xp.emplace(p.first);
-
-  for (auto &x : xp) {
-    std::pair<double, double> pair;
-    pair.first  = x;
-    pair.second = self(x) * curve(x);
-    newPairs.push_back(pair);
-  }
+  xp.reserve(m_x.size() + curve.m_x.size());
+  std::set_union(
+    m_x.begin(),
+    m_x.end(),
+    curve.m_x.begin(),
+    curve.m_x.end(),
+    std::back_inserter(xp));
+
+  yp.resize(xp.size());
+  for (size_t i = 0; i < xp.size(); ++i)
+    yp[i] = self(xp[i]) * curve(xp[i]);
   
   // Recreate curve
-  m_curve.clear();
-
   m_oobLeft  *= curve.m_oobLeft;
   m_oobRight *= curve.m_oobRight;
-  for (auto &p : newPairs)
-    m_curve.insert(std::move(p));
+
+  m_x = std::move(xp);
+  m_y = std::move(yp);
 }
 
 void
 Curve::add(Curve const &curve)
 {
+  ETC_ALLOC_SCOPE(CurveAddAllocSite);
+
   // Construct the union of both curves
-  std::set<double> xp;
-  std::list<std::pair<double, double>> newPairs;
+  std::vector<double> xp, yp;
   Curve &self = *this;
 
-  for (auto &p : m_curve)
-    xp.emplace(p.first);
-
-  for (auto &p : curve.m_curve)
-    xp.emplace(p.first);
-
-  for (auto &x : xp) {
-    std::pair<double, double> pair;
-    pair.first  = x;
-    pair.second = self(x) + curve(x);
-    newPairs.push_back(pair);
-  }
+  xp.reserve(m_x.size() + curve.m_x.size());
+  std::set_union(
+    m_x.begin(),
+    m_x.end(),
+    curve.m_x.begin(),
+    curve.m_x.end(),
+    std::back_inserter(xp));
+
+  yp.resize(xp.size());
+  for (size_t i = 0; i < xp.size(); ++i)
+    yp[i] = self(xp[i]) + curve(xp[i]);
   
   // Recreate curve
-  m_curve.clear();
-
   m_oobLeft  += curve.m_oobLeft;
   m_oobRight += curve.m_oobRight;
-  for (auto &p : newPairs)
-    m_curve.insert(std::move(p));
+
+  m_x = std::move(xp);
+  m_y = std::move(yp);
 } 
 
 void
 Curve::assign(Curve const &curve)
 {
-  // Determine overlapping segments:
-  auto ownFirst = m_curve.cbegin();
-  auto crvFirst = curve.m_curve.cbegin();
+  ETC_ALLOC_SCOPE(CurveCopyAllocSite);
 
   // Nothing to add
-  if (crvFirst == curve.m_curve.end())
+  if (curve.m_x.empty())
     return;
 
   // No curve
-  if (ownFirst == m_curve.end()) {
+  if (m_x.empty()) {
     *this = curve;
     return;
   }
 
   // Assign middle part (this must go first!)
-  for (auto &p : m_curve)
-    if (!curve.isOob(p.first))
-      p.second = curve(p.first);
+  for (size_t i = 0; i < m_x.size(); ++i)
+    if (!curve.isOob(m_x[i]))
+      m_y[i] = curve(m_x[i]);
 
   // Curve is longer to the left
-  if (crvFirst->first < ownFirst->first)
+  if (curve.m_x.front() < m_x.front())
     m_oobLeft = curve.m_oobLeft;
 
-  auto ownLast = std::prev(m_curve.cend());
-  auto crvLast = std::prev(curve.m_curve.cend());
-
   // Curve is longer to the right
-  if (ownLast->first < crvLast->first)
+  if (m_x.back() < curve.m_x.back())
     m_oobRight = curve.m_oobRight;
 
-  // Assign the whole curve
-  for (auto &p : curve.m_curve)
-    set(p.first, p.second);
+  // Assign the whole curve. This is a merge in which its points prevail.
+  std::vector<double> xp, yp;
+  size_t i = 0, j = 0;
+
+  xp.reserve(m_x.size() + curve.m_x.size());
+  yp.reserve(m_x.size() + curve.m_x.size());
+
+  while (i < m_x.size() || j < curve.m_x.size()) {
+    if (j == curve.m_x.size() 
+        || (i < m_x.size() && m_x[i] < curve.m_x[j])) {
+      xp.push_back(m_x[i]);
+      yp.push_back(m_y[i++]);
+    } else {
+      if (i < m_x.size() && m_x[i] == curve.m_x[j])
+        ++i;
+      xp.push_back(curve.m_x[j]);
+      yp.push_back(curve.m_y[j++]);
+    }
+  }
+
+  m_x = std::move(xp);
+  m_y = std::move(yp);
 }
 
 void
 Curve::fromExisting(Curve const &curve, double yUnits)
 {
+  ETC_ALLOC_SCOPE(CurveCopyAllocSite);
+
   *this = curve;
 
   if (yUnits != 1.)
-    for (auto &p : m_curve)
-      p.second *= yUnits;
+    for (auto &y : m_y)
+      y *= yUnits;
 }
 
 void
 Curve::add(double val)
 {
-  for (auto &p : m_curve)
-    p.second += val;
+  for (auto &y : m_y)
+    y += val;
 
   m_oobLeft  += val;
   m_oobRight += val;
@@ -527,101 +589,90 @@ Curve::add(double val)
 void
 Curve::clear()
 {
-  m_curve.clear();
+  m_x.clear();
+  m_y.clear();
   m_oobLeft = m_oobRight = 0;
 }
 
 void
 Curve::load(std::string const &path, bool transpose, unsigned xCol, unsigned yCol)
 {
-  rapidcsv::Document doc(
-    path,
-    rapidcsv::LabelParams(-1, -1),
-    rapidcsv::SeparatorParams(','));
+  ETC_ALLOC_SCOPE(CurveLoadAllocSite);
 
-  auto rows = doc.GetRowCount();
-  auto cols = doc.GetColumnCount();
+  CsvReader csv(path);
+
+  load(csv, transpose, xCol, yCol);
+}
+
+void
+Curve::load(CsvReader const &csv, bool transpose, unsigned xCol, unsigned yCol)
+{
+  ETC_ALLOC_SCOPE(CurveLoadAllocSite);
+
+  std::vector<double> x, y;
+  std::vector<CsvCellIssue> issues;
+
+  auto rows = csv.rows();
+  auto cols = csv.cols();
 
   clear();
 
-  if (transpose) {
-    // Columns are CSV rows, rows are CSV cols
-    if (xCol >= rows)
-      throw std::runtime_error("Column for X is out of range (file has " + std::to_string(rows) + " data columns)");
-    if (yCol >= rows)
-      throw std::runtime_error("Column for Y is out of range (file has " + std::to_string(rows) + " data columns)");
-    
-    for (auto i = 0u; i < cols; ++i) {
-      try {
-        m_curve[doc.GetCell<double>(i, xCol)] = doc.GetCell<double>(i, yCol);
-      } catch (std::invalid_argument const &e) {
-        std::string asString = doc.GetCell<std::string>(i, yCol);
-        fprintf(
-          stderr,
-          "warning: %s:row %d: col %d: invalid argument (\"%s\")\n",
-          path.c_str(),
-          yCol + 1,
-          i + 1,
-          asString.c_str());
-      } catch (std::exception const &e) {
-        fprintf(
-          stderr,
-          "warning: %s:row %d: col %d: out of bounds! (blank line?)\n",
-          path.c_str(),
-          yCol + 1,
-          i + 1);
-      }
-    }
-  } else {
-    if (xCol >= cols)
-      throw std::runtime_error("Column for X is out of range (file has " + std::to_string(rows) + " data columns)");
-    if (yCol >= cols)
-      throw std::runtime_error("Column for Y is out of range (file has " + std::to_string(rows) + " data columns)");
-    
-    for (auto i = 0u; i < rows; ++i) {
-      try {
-        m_curve[doc.GetCell<double>(xCol, i)] = doc.GetCell<double>(yCol, i);
-      } catch (std::invalid_argument const &e) {
-        std::string asString = doc.GetCell<std::string>(yCol, i);
+  // In transposed files, columns are CSV rows and rows are CSV cols
+  auto dataCols = transpose ? rows : cols;
+
+  if (xCol >= dataCols)
+    throw std::runtime_error("Column for X is out of range (file has " + std::to_string(dataCols) + " data columns)");
+  if (yCol >= dataCols)
+    throw std::runtime_error("Column for Y is out of range (file has " + std::to_string(dataCols) + " data columns)");
+
+  csv.readPairs(transpose, xCol, yCol, x, y, issues);
+
+  for (auto const &issue : issues) {
+    switch (issue.kind) {
+      case CsvInvalidValue:
         fprintf(
           stderr,
           "warning: %s:row %d: col %d: invalid argument (\"%s\")\n",
-          path.c_str(),
-          i + 1,
-          yCol + 1,
-          asString.c_str());
-      } catch (std::exception const &e) {
+          csv.path().c_str(),
+          issue.row + 1,
+          issue.col + 1,
+          issue.text.c_str());
+        break;
+
+      case CsvMissingCell:
         fprintf(
           stderr,
           "warning: %s:row %d: col %d: out of bounds! (blank line?)\n",
-          path.c_str(),
-          i + 1,
-          yCol + 1);
-      }
+          csv.path().c_str(),
+          issue.row + 1,
+          issue.col + 1);
+        break;
     }
   }
+
+  // Sorted only if necessary. For repeated X values, the last one wins.
+  adopt(std::move(x), std::move(y));
 }
 
 void
 Curve::save(std::string const &path) const
 {
-  FILE *fp;
-
-  fp = fopen(path.c_str(), "wb");
-  if (fp == nullptr)
-    throw std::runtime_error(
-      "Cannot open `" + path + "' for writing: " + strerror(errno));
+  DataWriter out(path);
 
-  for (auto &p : m_curve)
-    fprintf(fp, "%.15e, %.15e\n", p.first, p.second);
+  for (size_t i = 0; i < m_x.size(); ++i) {
+    out.writeScientific(m_x[i], 15);
+    out.write(", ");
+    out.writeScientific(m_y[i], 15);
+    out.writeChar('\n');
+  }
 
-  fclose(fp);
+  out.close();
 }
 
 void
 Curve::debug()
 {
-  for (auto p : m_curve)
-    printf("%g=%g, ", p.first, p.second);
+  for (size_t i = 0; i < m_x.size(); ++i)
+    printf("%g=%g, ", m_x[i], m_y[i]);
   putchar(10);
 }
\ No newline at end of file
@@ -18,6 +18,7 @@
 //
 
 #include <DataFileManager.h>
+#include <EmbeddedData.h>
 #include <sys/stat.h>
 #include <cerrno>
 #include <cstring>
@@ -26,6 +27,12 @@
 #include <libgen.h>
 #include <stdexcept>
 #include <filesystem>
+#include <system_error>
+#include <poll.h>
+
+#ifdef __linux__
+#  include <sys/inotify.h>
+#endif // __linux__
 
 DataFileManager *DataFileManager::g_instance = nullptr;
 
@@ -85,12 +92,121 @@ DataFileManager::DataFileManager()
 DataFileManager *
 DataFileManager::instance()
 {
-  if (g_instance == nullptr)
-    g_instance = new DataFileManager();
-  
+  static std::once_flag flag;
+
+  // Models may be loaded from several threads at once
+  std::call_once(flag, [] () { g_instance = new DataFileManager(); });
+
   return g_instance;
 }
 
+static void
+scanDirectory(std::string const &dir, DataFileDirListing &listing)
+{
+  std::error_code ec;
+
+  listing.exists = false;
+  listing.entries.clear();
+
+  listing.mtime = std::filesystem::last_write_time(dir, ec);
+  if (ec)
+    return;
+
+  std::filesystem::directory_iterator it(dir, ec), end;
+  if (ec)
+    return;
+
+  while (it != end) {
+    listing.entries.insert(it->path().filename().string());
+    it.increment(ec);
+    if (ec)
+      break;
+  }
+
+  listing.exists = true;
+}
+
+static std::string
+parentDirectory(std::string const &path)
+{
+  auto pos = path.rfind('/');
+
+  if (pos == std::string::npos)
+    return ".";
+
+  if (pos == 0)
+    return "/";
+
+  return path.substr(0, pos);
+}
+
+DataFileDirListing &
+DataFileManager::listing(std::string const &dir)
+{
+  auto it = m_listings.find(dir);
+
+  if (it == m_listings.end()) {
+    auto &newListing = m_listings[dir];
+    scanDirectory(dir, newListing);
+    return newListing;
+  }
+
+  return it->second;
+}
+
+//
+// Tells whether a file is present in its directory, according to the
+// directory listing. This saves one access() per search path for files
+// that are not there.
+//
+bool
+DataFileManager::listed(std::string const &fullPath)
+{
+  auto pos = fullPath.rfind('/');
+
+  if (pos == std::string::npos || pos + 1 == fullPath.size())
+    return true;
+
+  auto &dirListing = listing(parentDirectory(fullPath));
+
+  return dirListing.entries.find(fullPath.substr(pos + 1))
+    != dirListing.entries.end();
+}
+
+// Rescan changed directories. Returns true if any of them changed.
+bool
+DataFileManager::validateListings()
+{
+  bool changed = false;
+
+  for (auto &p : m_listings) {
+    std::error_code ec;
+    auto mtime  = std::filesystem::last_write_time(p.first, ec);
+    bool exists = !ec;
+
+    if (exists != p.second.exists || (exists && mtime != p.second.mtime)) {
+      scanDirectory(p.first, p.second);
+      changed = true;
+    }
+  }
+
+  return changed;
+}
+
+bool
+DataFileManager::validateEntry(DataFileCacheEntry const &entry)
+{
+  std::error_code ec;
+
+  // Negative entries are validated by means of the directory listings
+  if (entry.path.empty() || EmbeddedData::isEmbedded(entry.path))
+    return true;
+
+  auto mtime = std::filesystem::last_write_time(entry.path, ec);
+
+  return !ec && mtime == entry.mtime;
+}
+
 bool
 DataFileManager::addSearchPath(std::string const &path)
 {
@@ -113,7 +229,17 @@ DataFileManager::addSearchPath(std::string const &path)
     return false;
   }
 
+  std::lock_guard<std::mutex> guard(m_mutex);
+
   m_paths.push_front(path);
+
+  // Search order changed. Scan the new directory upfront.
+  m_cache.clear();
+  listing(path);
+
+  for (auto const &subdir : m_watchedSubdirs)
+    addWatches(path, subdir);
+
   return true;
 }
 
@@ -142,6 +268,11 @@ DataFileManager::find(std::string const &path, int flags)
   } else {
     for (auto const &p : m_paths) {
       std::string fullPath = p + "/" + path;
+
+      // Files to read must be in the directory listing
+      if (!(flags & W_OK) && !listed(fullPath))
+        continue;
+
       if (access(fullPath.c_str(), flags) != -1)
         return fullPath;
 
@@ -155,21 +286,270 @@ DataFileManager::find(std::string const &path, int flags)
   return std::string();
 }
 
+std::string
+DataFileManager::lookup(std::string const &path, int flags)
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  auto key = std::make_pair(path, flags);
+
+  // Something changed in the directories, cached entries may be stale
+  if (m_validateCache && validateListings())
+    m_cache.clear();
+
+  auto it = m_cache.find(key);
+  if (it != m_cache.end()) {
+    if (!m_validateCache || validateEntry(it->second))
+      return it->second.path;
+
+    m_cache.erase(it);
+  }
+
+  DataFileCacheEntry entry;
+  entry.path = find(path, flags);
+
+  // Not in the search paths. Fall back to the embedded copy, if any.
+  if (entry.path.empty() && !(flags & W_OK) && EmbeddedData::find(path))
+    entry.path = EmbeddedData::path(path);
+
+  if (!entry.path.empty() && !EmbeddedData::isEmbedded(entry.path)) {
+    std::error_code ec;
+    entry.mtime = std::filesystem::last_write_time(entry.path, ec);
+  }
+
+  m_cache[key] = entry;
+
+  return entry.path;
+}
+
 std::string
 DataFileManager::resolve(std::string const &path)
 {
-  return find(path, R_OK);
+  return lookup(path, R_OK);
 }
 
 std::string
 DataFileManager::suggest(std::string const &path)
 {
-  return find(path, W_OK);
+  return lookup(path, W_OK);
 }
 
-std::list<std::string> const &
+std::list<std::string>
 DataFileManager::searchPaths() const
 {
+  std::lock_guard<std::mutex> guard(m_mutex);
+
   return m_paths;
 }
 
+void
+DataFileManager::invalidateCache()
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  m_cache.clear();
+  m_listings.clear();
+}
+
+void
+DataFileManager::invalidateCache(std::string const &path)
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  for (auto flags : {R_OK, W_OK})
+    m_cache.erase(std::make_pair(path, flags));
+
+  // Force a rescan of every directory the file may be in
+  if (!path.empty() && path[0] == '/') {
+    m_listings.erase(parentDirectory(path));
+  } else {
+    for (auto const &p : m_paths)
+      m_listings.erase(parentDirectory(p + "/" + path));
+  }
+}
+
+void
+DataFileManager::setCacheValidation(bool validate)
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  m_validateCache = validate;
+}
+
+bool
+DataFileManager::cacheValidation() const
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  return m_validateCache;
+}
+
+
+////////////////////////////// File watching ///////////////////////////////////
+#ifdef __linux__
+#  define WATCH_EVENTS \
+  (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE)
+#endif // __linux__
+
+// Called with m_mutex held
+void
+DataFileManager::addWatches(std::string const &path, std::string const &subdir)
+{
+#ifdef __linux__
+  std::string dir = subdir.empty() ? path : path + "/" + subdir;
+  int wd = inotify_add_watch(m_watchFd, dir.c_str(), WATCH_EVENTS);
+
+  // Directories that do not exist are not an error
+  if (wd != -1)
+    m_watches[wd] = DataFileChange(path, subdir);
+#endif // __linux__
+}
+
+void
+DataFileManager::dispatchChanges(std::set<DataFileChange> const &changed)
+{
+  std::list<DataFileWatchListener> listeners;
+
+  for (auto const &change : changed)
+    invalidateCache(change.second);
+
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    listeners = m_watchListeners;
+  }
+
+  for (auto const &change : changed)
+    for (auto const &listener : listeners)
+      listener(change.second, change.first);
+}
+
+void
+DataFileManager::watchLoop()
+{
+#ifdef __linux__
+  alignas(struct inotify_event) char buf[4096];
+  struct pollfd fds[2];
+
+  fds[0].fd     = m_watchFd;
+  fds[0].events = POLLIN;
+  fds[1].fd     = m_watchPipe[0];
+  fds[1].events = POLLIN;
+
+  for (;;) {
+    std::set<DataFileChange> changed;
+
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    if (fds[1].revents != 0)
+      break;
+
+    // Events of one read are coalesced: editors tend to touch files
+    // several times when saving them
+    ssize_t len = read(m_watchFd, buf, sizeof(buf));
+    if (len <= 0)
+      continue;
+
+    {
+      std::lock_guard<std::mutex> guard(m_mutex);
+
+      for (char *p = buf; p < buf + len; ) {
+        auto event = reinterpret_cast<struct inotify_event *>(p);
+        auto it    = m_watches.find(event->wd);
+
+        if (it != m_watches.end() && event->len > 0) {
+          auto const &subdir = it->second.second;
+
+          if (subdir.empty())
+            changed.insert(DataFileChange(it->second.first, event->name));
+          else
+            changed.insert(
+              DataFileChange(it->second.first, subdir + "/" + event->name));
+        }
+
+        p += sizeof(struct inotify_event) + event->len;
+      }
+    }
+
+    if (!changed.empty())
+      dispatchChanges(changed);
+  }
+#endif // __linux__
+}
+
+bool
+DataFileManager::watch(std::string const &subdir)
+{
+#ifdef __linux__
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  if (m_watchFd == -1) {
+    if ((m_watchFd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK)) == -1) {
+      fprintf(
+        stderr,
+        "warning: cannot watch data files: %s\n",
+        strerror(errno));
+      return false;
+    }
+
+    if (pipe(m_watchPipe) == -1) {
+      fprintf(
+        stderr,
+        "warning: cannot watch data files: %s\n",
+        strerror(errno));
+      close(m_watchFd);
+      m_watchFd = -1;
+      return false;
+    }
+
+    m_watchThread = std::thread(&DataFileManager::watchLoop, this);
+  }
+
+  if (m_watchedSubdirs.insert(subdir).second)
+    for (auto const &p : m_paths)
+      addWatches(p, subdir);
+
+  return true;
+#else
+  (void) subdir;
+  return false;
+#endif // __linux__
+}
+
+void
+DataFileManager::stopWatching()
+{
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    if (m_watchFd == -1)
+      return;
+
+    // Wake up the watch thread
+    if (write(m_watchPipe[1], "", 1) == -1)
+      fprintf(stderr, "warning: cannot stop watch thread\n");
+  }
+
+  m_watchThread.join();
+
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  close(m_watchFd);
+  close(m_watchPipe[0]);
+  close(m_watchPipe[1]);
+
+  m_watchFd      = -1;
+  m_watchPipe[0] = m_watchPipe[1] = -1;
+  m_watches.clear();
+  m_watchedSubdirs.clear();
+}
+
+void
+DataFileManager::addWatchListener(DataFileWatchListener listener)
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  m_watchListeners.push_back(listener);
+}
@@ -0,0 +1,326 @@
+//
+// DataWriter.cpp: Fast writers of numeric data
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include <DataWriter.h>
+#include <stdexcept>
+#include <charconv>
+#include <cstring>
+#include <cerrno>
+
+static inline bool
+isLittleEndian()
+{
+  uint16_t word = 1;
+
+  return *reinterpret_cast<uint8_t *>(&word) == 1;
+}
+
+///////////////////////////////// DataWriter ///////////////////////////////////
+DataWriter::DataWriter(FILE *fp)
+{
+  m_fp = fp;
+  m_buffer.resize(DATA_WRITER_BUFFER_SIZE);
+}
+
+DataWriter::DataWriter(std::string const &path)
+{
+  m_fp = fopen(path.c_str(), "wb");
+  if (m_fp == nullptr)
+    throw std::runtime_error(
+      "Cannot open `" + path + "' for writing: " + strerror(errno));
+
+  m_owned = true;
+  m_path  = path;
+  m_buffer.resize(DATA_WRITER_BUFFER_SIZE);
+}
+
+DataWriter::DataWriter(std::string *sink)
+{
+  m_sink = sink;
+  m_buffer.resize(DATA_WRITER_BUFFER_SIZE);
+}
+
+DataWriter::~DataWriter()
+{
+  if (m_sink != nullptr)
+    m_sink->append(m_buffer.data(), m_used);
+
+  if (m_fp != nullptr) {
+    if (m_used > 0)
+      fwrite(m_buffer.data(), m_used, 1, m_fp);
+
+    if (m_owned)
+      fclose(m_fp);
+    else
+      fflush(m_fp);
+  }
+}
+
+void
+DataWriter::flush()
+{
+  if (m_sink != nullptr) {
+    m_sink->append(m_buffer.data(), m_used);
+    m_used = 0;
+  } else if (m_used > 0) {
+    if (fwrite(m_buffer.data(), m_used, 1, m_fp) < 1)
+      throw std::runtime_error(
+        "Write error"
+        + (m_path.empty() ? std::string() : " in `" + m_path + "'")
+        + ": " + strerror(errno));
+    m_used = 0;
+  }
+}
+
+void
+DataWriter::close()
+{
+  flush();
+
+  if (m_sink != nullptr || m_fp == nullptr)
+    return;
+
+  if (m_owned) {
+    FILE *fp = m_fp;
+
+    m_fp = nullptr;
+    if (fclose(fp) == EOF)
+      throw std::runtime_error(
+        "Cannot close `" + m_path + "': " + strerror(errno));
+  } else if (fflush(m_fp) == EOF) {
+    throw std::runtime_error(std::string("Write error: ") + strerror(errno));
+  }
+}
+
+void
+DataWriter::write(const void *data, size_t size)
+{
+  if (size > m_buffer.size()) {
+    flush();
+    if (m_sink != nullptr) {
+      m_sink->append(static_cast<const char *>(data), size);
+      return;
+    }
+
+    if (fwrite(data, size, 1, m_fp) < 1)
+      throw std::runtime_error(
+        std::string("Write error: ") + strerror(errno));
+    return;
+  }
+
+  memcpy(reserve(size), data, size);
+  m_used += size;
+}
+
+void
+DataWriter::write(std::string_view str)
+{
+  write(str.data(), str.size());
+}
+
+void
+DataWriter::writeChar(char c)
+{
+  *reserve(1) = c;
+  ++m_used;
+}
+
+// Large enough for any %.*e or %.*g of up to 17 significant digits
+#define DATA_WRITER_MAX_NUMBER 32
+
+void
+DataWriter::writeGeneral(double value, int precision)
+{
+  char *p = reserve(DATA_WRITER_MAX_NUMBER);
+
+#ifdef __cpp_lib_to_chars
+  auto result = std::to_chars(
+    p,
+    p + DATA_WRITER_MAX_NUMBER,
+    value,
+    std::chars_format::general,
+    precision);
+
+  m_used += result.ptr - p;
+#else
+  m_used += snprintf(p, DATA_WRITER_MAX_NUMBER, "%.*g", precision, value);
+#endif // __cpp_lib_to_chars
+}
+
+void
+DataWriter::writeScientific(double value, int precision)
+{
+  char *p = reserve(DATA_WRITER_MAX_NUMBER);
+
+#ifdef __cpp_lib_to_chars
+  auto result = std::to_chars(
+    p,
+    p + DATA_WRITER_MAX_NUMBER,
+    value,
+    std::chars_format::scientific,
+    precision);
+
+  m_used += result.ptr - p;
+#else
+  m_used += snprintf(p, DATA_WRITER_MAX_NUMBER, "%.*e", precision, value);
+#endif // __cpp_lib_to_chars
+}
+
+void
+DataWriter::writeLittleEndian(double const *data, size_t count)
+{
+  if (isLittleEndian()) {
+    write(data, count * sizeof(double));
+    return;
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    char bytes[sizeof(double)];
+    memcpy(bytes, data + i, sizeof(double));
+    for (size_t j = 0; j < sizeof(double); ++j)
+      writeChar(bytes[sizeof(double) - 1 - j]);
+  }
+}
+
+void
+DataWriter::writeLittleEndian(uint32_t value)
+{
+  for (auto i = 0; i < 4; ++i)
+    writeChar(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+///////////////////////////////// TableWriter //////////////////////////////////
+TableWriter::TableWriter(
+  DataWriter &out,
+  DataFormat format,
+  size_t rows,
+  size_t cols) : m_out(out)
+{
+  m_format = format;
+  m_rows   = rows;
+  m_cols   = cols;
+
+  writeHeader();
+}
+
+void
+TableWriter::writeHeader()
+{
+  switch (m_format) {
+    case TextFormat:
+      break;
+
+    case BinaryFormat:
+      m_out.write("TETCTAB", 8); // Includes the NUL
+      m_out.writeLittleEndian(static_cast<uint32_t>(TABLE_WRITER_BINARY_VERSION));
+      m_out.writeLittleEndian(static_cast<uint32_t>(m_rows));
+      m_out.writeLittleEndian(static_cast<uint32_t>(m_cols));
+      break;
+
+    case NpyFormat: {
+      // Version 1.0 header, padded so that data starts at a multiple of 64
+      std::string dict =
+          "{'descr': '<f8', 'fortran_order': False, 'shape': ("
+        + std::to_string(m_rows) + ", " + std::to_string(m_cols) + "), }";
+      size_t total = 10 + dict.size() + 1;
+      size_t pad   = (64 - total % 64) % 64;
+      uint16_t headerLen = static_cast<uint16_t>(dict.size() + pad + 1);
+
+      dict.append(pad, ' ');
+      dict.push_back('\n');
+
+      m_out.write("\x93NUMPY\x01\x00", 8);
+      m_out.writeChar(static_cast<char>(headerLen & 0xff));
+      m_out.writeChar(static_cast<char>(headerLen >> 8));
+      m_out.write(dict);
+      break;
+    }
+  }
+}
+
+void
+TableWriter::writeRow(std::vector<double> const &row, std::string const &label)
+{
+  if (m_format != TextFormat) {
+    if (row.size() != m_cols)
+      throw std::runtime_error(
+        "Row has " + std::to_string(row.size()) + " values, expected "
+        + std::to_string(m_cols));
+
+    if (m_written == m_rows)
+      throw std::runtime_error("Too many rows for table");
+  }
+
+  switch (m_format) {
+    case TextFormat:
+      if (!label.empty()) {
+        m_out.write(label);
+        m_out.writeChar(',');
+      }
+
+      for (size_t i = 0; i < row.size(); ++i) {
+        if (i > 0)
+          m_out.writeChar(',');
+        m_out.writeGeneral(row[i]);
+      }
+
+      m_out.writeChar('\n');
+      break;
+
+    case BinaryFormat:
+      m_out.writeLittleEndian(static_cast<uint32_t>(label.size()));
+      m_out.write(label);
+      m_out.writeLittleEndian(row.data(), row.size());
+      break;
+
+    case NpyFormat:
+      m_out.writeLittleEndian(row.data(), row.size());
+      break;
+  }
+
+  ++m_written;
+}
+
+bool
+TableWriter::parseFormat(std::string const &name, DataFormat &format)
+{
+  if (name == "text" || name == "csv")
+    format = TextFormat;
+  else if (name == "bin" || name == "binary")
+    format = BinaryFormat;
+  else if (name == "npy")
+    format = NpyFormat;
+  else
+    return false;
+
+  return true;
+}
+
+DataFormat
+TableWriter::formatFromPath(std::string const &path)
+{
+  DataFormat format = TextFormat;
+  auto dot = path.rfind('.');
+
+  if (dot != std::string::npos && path.find('/', dot) == std::string::npos)
+    if (!parseFormat(path.substr(dot + 1), format))
+      format = TextFormat;
+
+  return format;
+}
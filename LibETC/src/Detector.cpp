@@ -111,28 +111,19 @@ Detector::Detector()
 {
   m_properties         = &ConfigManager::get<DetectorProperties>("detectors");
 
-  m_photonFluxPerPixel = new Spectrum();
-  m_photonsPerPixel    = new Spectrum();
-  m_electronsPerPixel  = new Spectrum();
-  m_signal             = new Spectrum();
+  m_photonFluxPerPixel.resize(DETECTOR_PIXELS);
+  m_photonsPerPixel.resize(DETECTOR_PIXELS);
+  m_electronsPerPixel.resize(DETECTOR_PIXELS);
+  m_signal.resize(DETECTOR_PIXELS);
+  m_noise.resize(DETECTOR_PIXELS);
+  m_snr.resize(DETECTOR_PIXELS);
 }
 
 Detector::~Detector()
 {
-  if (m_photonFluxPerPixel != nullptr)
-    delete m_photonFluxPerPixel;
-
-  if (m_photonsPerPixel != nullptr)
-    delete m_photonsPerPixel;
-
-  if (m_electronsPerPixel != nullptr)
-    delete m_electronsPerPixel;
-
-  if (m_signal != nullptr)
-    delete m_signal;
 }
 
-DetectorProperties *
+DetectorProperties const *
 Detector::properties() const
 {
   return m_properties;
@@ -141,7 +132,9 @@ Detector::properties() const
 void
 Detector::setPixelPhotonFlux(Spectrum const &flux)
 {
-  m_photonFluxPerPixel->assign(flux);
+  for (auto i = 0u; i < DETECTOR_PIXELS; ++i)
+    m_photonFluxPerPixel[i] = flux(i);
+
   recalculate();
 }
 
@@ -149,6 +142,7 @@ void
 Detector::setExposureTime(double t)
 {
   m_expostureTime = t;
+  updateDarkElectrons();
 }
 
 bool
@@ -157,19 +151,29 @@ Detector::setDetector(std::string const &det)
   auto it = m_properties->detectors.find(det);
   if (it == m_properties->detectors.end()) {
     m_detector = nullptr;
+    m_detectorName.clear();
     return false;
   }
 
-  m_detector = it->second;
+  m_detector     = it->second;
+  m_detectorName = it->first;
+  updateDarkElectrons();
+
   return true;
 }
 
-DetectorSpec *
+DetectorSpec const *
 Detector::getSpec() const
 {
   return m_detector;
 }
 
+std::string const &
+Detector::detectorName() const
+{
+  return m_detectorName;
+}
+
 double
 Detector::darkElectrons(double T) const
 {
@@ -183,36 +187,71 @@ Detector::darkElectrons(double T) const
   return Qd;
 }
 
+//
+// Dark current only depends on the exposure time and the detector, so we
+// compute it once every time any of these changes.
+//
+void
+Detector::updateDarkElectrons()
+{
+  if (m_detector != nullptr)
+    m_darkElectrons = darkElectrons(DETECTOR_TEMPERATURE);
+}
+
 void
 Detector::recalculate()
 {
   if (m_detector == nullptr)
     throw std::runtime_error("No detector selected");
 
-  double invGain = 1. / m_detector->gain;
-
-  // Compute electrons in each pixel by means of the exposure time
-  m_photonsPerPixel->fromExisting(
-    *m_photonFluxPerPixel,
-    m_expostureTime * m_detector->pixelSide * m_detector->pixelSide);
-  
-  // Compute number of electrons by means of the quantum efficiency
-  m_electronsPerPixel->fromExisting(*m_photonsPerPixel, m_detector->qE);
-  
-  // Turn this into counts
-  m_signal->fromExisting(*m_electronsPerPixel, invGain);
-
-  // Add dark electrons to the electron-per-pixel curve
-  m_electronsPerPixel->add(darkElectrons(DETECTOR_TEMPERATURE));
+  const double toPhotons = m_expostureTime * m_detector->pixelSide * m_detector->pixelSide;
+  const double qE        = m_detector->qE;
+  const double gain      = m_detector->gain;
+  const double invGain   = 1. / gain;
+  const double ron       = readOutNoise();
+  const double dark      = m_darkElectrons;
+
+  const double *flux = m_photonFluxPerPixel.data();
+  double *photons    = m_photonsPerPixel.data();
+  double *electrons  = m_electronsPerPixel.data();
+  double *signal     = m_signal.data();
+  double *noise      = m_noise.data();
+  double *snr        = m_snr.data();
+
+  //
+  // For every pixel:
+  //
+  // 1. Compute photons in each pixel by means of the exposure time
+  // 2. Compute number of electrons by means of the quantum efficiency
+  // 3. Turn this into counts. Dark electrons do not contribute to the
+  //    signal, only to the noise.
+  // 4. Compute noise (shot noise + read-out noise) and SNR
+  //
+
+  for (auto i = 0u; i < DETECTOR_PIXELS; ++i) {
+    double ph = flux[i] * toPhotons;
+    double el = ph * qE;
+    double sg = el * invGain;
+    double nz = Detector::noise(el + dark, gain, ron);
+
+    photons[i]   = ph;
+    electrons[i] = el + dark;
+    signal[i]    = sg;
+    noise[i]     = nz;
+    snr[i]       = sg / nz;
+  }
 }
 
 double
 Detector::signal(unsigned px) const
 {
-  return (*m_signal)(px);
+  if (px >= DETECTOR_PIXELS)
+    throw std::runtime_error("Pixel " + std::to_string(px) + " out of bounds");
+
+  return m_signal[px];
 }
 
-const Spectrum *
+std::vector<double> const &
 Detector::signal() const
 {
   return m_signal;
@@ -221,15 +260,24 @@ Detector::signal() const
 double
 Detector::electrons(unsigned px) const
 {
-  return (*m_electronsPerPixel)(px);
+  if (px >= DETECTOR_PIXELS)
+    throw std::runtime_error("Pixel " + std::to_string(px) + " out of bounds");
+
+  return m_electronsPerPixel[px];
 }
 
-const Spectrum *
+std::vector<double> const &
 Detector::electrons() const
 {
   return m_electronsPerPixel;
 }
 
+std::vector<double> const &
+Detector::photons() const
+{
+  return m_photonsPerPixel;
+}
+
 //
 // Noise readout counts. This is the standard deviation of a Gaussian,
 // describing the voltage fluctuations in the output amplifier as seen
@@ -251,12 +299,16 @@ Detector::readOutNoise() const
 double
 Detector::noise(unsigned px) const
 {
-  double ron2     = readOutNoise();
-  double invGain2 = 1. / (m_detector->gain * m_detector->gain);
-  
-  ron2 *= ron2;
+  if (px >= DETECTOR_PIXELS)
+    throw std::runtime_error("Pixel " + std::to_string(px) + " out of bounds");
 
-  return sqrt(invGain2 * electrons(px) + ron2);
+  return m_noise[px];
+}
+
+std::vector<double> const &
+Detector::noise() const
+{
+  return m_noise;
 }
 
 //
@@ -265,5 +317,14 @@ Detector::noise(unsigned px) const
 double
 Detector::snr(unsigned px) const
 {
-  return signal(px) / noise(px);
+  if (px >= DETECTOR_PIXELS)
+    throw std::runtime_error("Pixel " + std::to_string(px) + " out of bounds");
+
+  return m_snr[px];
+}
+
+std::vector<double> const &
+Detector::snr() const
+{
+  return m_snr;
 }
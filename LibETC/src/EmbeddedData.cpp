@@ -0,0 +1,79 @@
+//
+// EmbeddedData.cpp: Data files compiled into the library
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include <EmbeddedData.h>
+#include <cstring>
+
+#ifdef ETC_EMBED_DATA
+// Generated at build time by cmake/EmbedData.cmake
+extern EmbeddedDataFile const g_embeddedDataFiles[];
+extern size_t const g_embeddedDataFileCount;
+#else
+static EmbeddedDataFile const *const g_embeddedDataFiles = nullptr;
+static size_t const g_embeddedDataFileCount = 0;
+#endif // ETC_EMBED_DATA
+
+size_t
+EmbeddedData::count()
+{
+  return g_embeddedDataFileCount;
+}
+
+EmbeddedDataFile const *
+EmbeddedData::file(size_t index)
+{
+  if (index >= g_embeddedDataFileCount)
+    return nullptr;
+
+  return &g_embeddedDataFiles[index];
+}
+
+EmbeddedDataFile const *
+EmbeddedData::find(std::string const &name)
+{
+  for (size_t i = 0; i < g_embeddedDataFileCount; ++i)
+    if (name == g_embeddedDataFiles[i].name)
+      return &g_embeddedDataFiles[i];
+
+  return nullptr;
+}
+
+bool
+EmbeddedData::isEmbedded(std::string const &path)
+{
+  return path.compare(
+    0,
+    sizeof(ETC_EMBEDDED_PREFIX) - 1,
+    ETC_EMBEDDED_PREFIX) == 0;
+}
+
+EmbeddedDataFile const *
+EmbeddedData::fromPath(std::string const &path)
+{
+  if (!isEmbedded(path))
+    return nullptr;
+
+  return find(path.substr(sizeof(ETC_EMBEDDED_PREFIX) - 1));
+}
+
+std::string
+EmbeddedData::path(std::string const &name)
+{
+  return ETC_EMBEDDED_PREFIX + name;
+}
@@ -23,6 +23,10 @@
 #include <Spectrum.h>
 #include <cmath>
 #include <Helpers.h>
+#include <CsvReader.h>
+#include <ThreadPool.h>
+#include <SimulationProfile.h>
+#include <mutex>
 
 //
 // Turn FWHM to the inverse of sigma. This speeds up the calculation of
@@ -61,142 +65,249 @@ InstrumentProperties::deserialize()
   return true;
 }
 
-///////////////////////////// InstrumentModel //////////////////////////////////
-InstrumentModel::InstrumentModel()
+//
+// Build the curves of one slice of one arm, from the dispersion and
+// resolution tables of that arm.
+//
+
+static void
+buildSlice(
+  CsvReader const &dispTable,
+  CsvReader const &resTable,
+  unsigned i,
+  Curve *disp,
+  Curve *rePx,
+  Curve *w2Px,
+  Curve *px2W)
 {
-  for (auto i = 0; i < TARSIS_SLICES; ++i) {
-    m_blueDisp[i] = m_blueW2Px[i] = m_bluePx2W[i] = m_blueREPx[i] = nullptr;
-    m_redDisp[i]  = m_redW2Px[i]  = m_redPx2W[i]  = m_redREPx[i]  = nullptr;
-  }
+  // Units of this datafile are nm -> nm/px
+  // We invert the Y axis of the curve to have (m -> px / m)
+  disp->load(dispTable, true, 0, i + 1);
+  disp->extendRight();
+  disp->extendLeft();
+  disp->scaleAxis(XAxis, 1e-9);
+  disp->scaleAxis(YAxis, 1e-9);
+  disp->invertAxis(YAxis);
+
+  // Units of this datafile are nm -> px
+  rePx->load(resTable, true, 0, i + 1);
+  rePx->extendRight();
+  rePx->extendLeft();
+  rePx->scaleAxis(XAxis, 1e-9);
+
+  fwhm2invStd(rePx);
+
+  // We want to have a curve that connects wavelengths to pixels, therefore:
+  // 1. We assign the disp curve to it (m -> px/m)
+  // 2. We integrate the curve. Now we have (m -> px)
+  w2Px->assign(*disp);
+  w2Px->integrate();
+
+  // We now want the pixel-to-wavelength relationship. Easy. Just flip X and Y
+  px2W->assign(*w2Px);
+  px2W->flip();
+}
 
-  m_properties    = &ConfigManager::get<InstrumentProperties>("tarsis");
+//////////////////////////// InstrumentArmSlices ///////////////////////////////
+//
+// Slices of one arm, built on first use from the dispersion and resolution
+// tables of the arm. Models that do not reload these tables share them.
+//
 
-  m_attenSpectrum = new Spectrum();
+struct InstrumentArmSlices {
+  CsvReader *dispTable = nullptr;      // Owned
+  CsvReader *resTable  = nullptr;      // Owned
+  Curve     *disp[TARSIS_SLICES];      // Owned, spectral dispersion
+  Curve     *rePx[TARSIS_SLICES];      // Owned, resolution element (in pixels)
+  Curve     *w2Px[TARSIS_SLICES];      // Owned, int of inv of sd
+  Curve     *px2W[TARSIS_SLICES];      // Owned, inverse of above
+  std::once_flag loaded[TARSIS_SLICES];
 
-  m_blueML15      = new Curve();
-  m_blueNBB       = new Curve();
-  m_redML15       = new Curve();
+  InstrumentArmSlices(std::string const &dispFile, std::string const &resFile);
+  ~InstrumentArmSlices();
 
-  m_blueML15->load(dataFile("blueTransmission.csv"), true, 0, 1);
-  m_blueML15->scaleAxis(XAxis, 1e-9);
+  InstrumentArmSlices(InstrumentArmSlices const &) = delete;
+  InstrumentArmSlices &operator=(InstrumentArmSlices const &) = delete;
 
-  m_blueNBB->load(dataFile("blueTransmission.csv"), true, 0, 2);
-  m_blueNBB->scaleAxis(XAxis, 1e-9);
+  void require(unsigned slice);
+};
+
+InstrumentArmSlices::InstrumentArmSlices(
+  std::string const &dispFile,
+  std::string const &resFile)
+{
+  // These tables outlive the constructor of the model, so they must not
+  // keep the files mapped.
+  dispTable = new CsvReader(dispFile);
+
+  try {
+    resTable = new CsvReader(resFile);
+  } catch (...) {
+    delete dispTable;
+    throw;
+  }
 
-  m_redML15->load(dataFile("redTransmission.csv"), true);
-  m_redML15->scaleAxis(XAxis, 1e-9);
+  dispTable->detach();
+  resTable->detach();
 
   for (auto i = 0; i < TARSIS_SLICES; ++i) {
-    // Units of this datafile are nm -> nm/px
-    // We invert the Y axis of the curve to have (m -> px / m)
-    m_blueDisp[i] = new Curve();
-    m_blueDisp[i]->load(dataFile("dispersionBlue.csv"), true, 0, i + 1);
-    m_blueDisp[i]->extendRight();
-    m_blueDisp[i]->extendLeft();
-    m_blueDisp[i]->scaleAxis(XAxis, 1e-9);
-    m_blueDisp[i]->scaleAxis(YAxis, 1e-9);
-    m_blueDisp[i]->invertAxis(YAxis);
-
-    // Units of this datafile are nm -> px
-    m_blueREPx[i] = new Curve();
-    m_blueREPx[i]->load(dataFile("pxResolutionBlue.csv"), true, 0, i + 1);
-    m_blueREPx[i]->extendRight();
-    m_blueREPx[i]->extendLeft();
-    m_blueREPx[i]->scaleAxis(XAxis, 1e-9);
-    
-    fwhm2invStd(m_blueREPx[i]);
-
-    // We want to have a curve that connects wavelengths to pixels, therefore:
-    // 1. We assign the m_blueDisp[i] to it (m -> px/m)
-    // 2. We integrate the curve. Now we have (m -> px)
-    m_blueW2Px[i] = new Curve();
-    m_blueW2Px[i]->assign(*m_blueDisp[i]);
-    m_blueW2Px[i]->integrate();
-
-    // We now want the pixel-to-wavelength relationship. Easy. Just flip X and Y
-    m_bluePx2W[i] = new Curve();
-    m_bluePx2W[i]->assign(*m_blueW2Px[i]);
-    m_bluePx2W[i]->flip();
-
-    ///////////////////////////// Repeat for red ///////////////////////////////
-    // Units of this datafile are nm -> nm/px
-    // We invert the Y axis of the curve to have (m -> px / m)
-    m_redDisp[i] = new Curve();
-    m_redDisp[i]->load(dataFile("dispersionRed.csv"), true, 0, i + 1);
-    m_redDisp[i]->extendRight();
-    m_redDisp[i]->extendLeft();
-    m_redDisp[i]->scaleAxis(XAxis, 1e-9);
-    m_redDisp[i]->scaleAxis(YAxis, 1e-9);
-    m_redDisp[i]->invertAxis(YAxis);
-
-    // Units of this datafile are nm -> px
-    m_redREPx[i] = new Curve();
-    m_redREPx[i]->load(dataFile("pxResolutionRed.csv"), true, 0, i + 1);
-    m_redREPx[i]->extendRight();
-    m_redREPx[i]->extendLeft();
-    m_redREPx[i]->scaleAxis(XAxis, 1e-9);
-
-    fwhm2invStd(m_redREPx[i]);
-
-    // We want to have a curve that connects wavelengths to pixels, therefore:
-    // 1. We assign the m_redDisp[i] to it (m -> px/m)
-    // 3. We integrate the curve. Now we have (m -> px)
-    m_redW2Px[i] = new Curve();
-    m_redW2Px[i]->assign(*m_redDisp[i]);
-    m_redW2Px[i]->integrate();
-
-    // We now want the pixel-to-wavelength relationship. Easy. Just flip X and Y
-    m_redPx2W[i] = new Curve();
-    m_redPx2W[i]->assign(*m_redW2Px[i]);
-    m_redPx2W[i]->flip();
+    disp[i] = new Curve();
+    rePx[i] = new Curve();
+    w2Px[i] = new Curve();
+    px2W[i] = new Curve();
   }
 }
 
-InstrumentModel::~InstrumentModel()
+InstrumentArmSlices::~InstrumentArmSlices()
 {
-  if (m_blueML15 != nullptr)
-    delete m_blueML15;
+  for (auto i = 0; i < TARSIS_SLICES; ++i) {
+    delete disp[i];
+    delete rePx[i];
+    delete w2Px[i];
+    delete px2W[i];
+  }
 
-  if (m_blueNBB != nullptr)
-    delete m_blueNBB;
+  delete dispTable;
+  delete resTable;
+}
 
-  if (m_redML15 != nullptr)
-    delete m_redML15;
+//
+// Builds the curves of a slice the first time they are needed. Several
+// simulations may request the same slice at once: only one of them builds
+// it, and the rest wait for it.
+//
+void
+InstrumentArmSlices::require(unsigned slice)
+{
+  if (slice >= TARSIS_SLICES)
+    throw std::runtime_error("Slice " + std::to_string(slice + 1) + " out of bounds");
 
-  if (m_attenSpectrum != nullptr)
-    delete m_attenSpectrum;
+  std::call_once(loaded[slice], [this, slice] () {
+    buildSlice(
+      *dispTable, *resTable, slice,
+      disp[slice], rePx[slice], w2Px[slice], px2W[slice]);
+  });
+}
 
-  for (auto i = 0; i < TARSIS_SLICES; ++i) {
-    // Delete blue curves
-    if (m_blueDisp[i] != nullptr)
-      delete m_blueDisp[i];
+static std::shared_ptr<const Curve>
+loadTransmission(CsvReader const &table, unsigned yCol)
+{
+  auto curve = std::make_shared<Curve>();
 
-    if (m_blueREPx[i] != nullptr)
-      delete m_blueREPx[i];
+  curve->load(table, true, 0, yCol);
+  curve->scaleAxis(XAxis, 1e-9);
 
-    if (m_blueW2Px[i] != nullptr)
-      delete m_blueW2Px[i];
+  return curve;
+}
 
-    if (m_bluePx2W[i] != nullptr)
-      delete m_bluePx2W[i];
+///////////////////////////// InstrumentModel //////////////////////////////////
+InstrumentModel::InstrumentModel()
+{
+  load(nullptr, AllInstrumentModelParts);
+}
 
-    // Delete red curves
-    if (m_redDisp[i] != nullptr)
-      delete m_redDisp[i];
+InstrumentModel::InstrumentModel(
+  InstrumentModel const &previous,
+  unsigned reload)
+{
+  load(&previous, reload);
+}
+
+void
+InstrumentModel::load(InstrumentModel const *previous, unsigned reload)
+{
+  m_properties = &ConfigManager::get<InstrumentProperties>("tarsis");
 
-    if (m_redREPx[i] != nullptr)
-      delete m_redREPx[i];
+  // Parts that are not reloaded are shared with the previous model
+  if (previous != nullptr) {
+    if (!(reload & BlueTransmissionPart)) {
+      m_blueML15 = previous->m_blueML15;
+      m_blueNBB  = previous->m_blueNBB;
+    }
+
+    if (!(reload & RedTransmissionPart))
+      m_redML15 = previous->m_redML15;
+
+    if (!(reload & BlueSlicesPart))
+      m_blueSlices = previous->m_blueSlices;
+
+    if (!(reload & RedSlicesPart))
+      m_redSlices = previous->m_redSlices;
+  }
 
-    if (m_redW2Px[i] != nullptr)
-      delete m_redW2Px[i];
+  // Every table is read once and shared by all the curves built from it.
+  // Slices are built on first use, from the tables kept in m_*Slices.
+  ThreadPool::instance()->parallelFor(4, [&] (size_t task) {
+    switch (task) {
+      case 0:
+        if (!m_blueML15) {
+          CsvReader blueTrans(dataFile("blueTransmission.csv"));
+          m_blueML15 = loadTransmission(blueTrans, 1);
+          m_blueNBB  = loadTransmission(blueTrans, 2);
+        }
+        break;
+
+      case 1:
+        if (!m_redML15) {
+          CsvReader redTrans(dataFile("redTransmission.csv"));
+          m_redML15 = loadTransmission(redTrans, 1);
+        }
+        break;
+
+      case 2:
+        if (!m_blueSlices)
+          m_blueSlices = std::make_shared<InstrumentArmSlices>(
+            dataFile("dispersionBlue.csv"),
+            dataFile("pxResolutionBlue.csv"));
+        break;
+
+      case 3:
+        if (!m_redSlices)
+          m_redSlices = std::make_shared<InstrumentArmSlices>(
+            dataFile("dispersionRed.csv"),
+            dataFile("pxResolutionRed.csv"));
+        break;
+    }
+  });
+}
+
+InstrumentArmSlices &
+InstrumentModel::requireSlice(InstrumentArm arm, unsigned slice) const
+{
+  InstrumentArmSlices *slices = nullptr;
+
+  switch (arm) {
+    case BlueArm:
+      slices = m_blueSlices.get();
+      break;
 
-    if (m_redPx2W[i] != nullptr)
-      delete m_redPx2W[i];
+    case RedArm:
+      slices = m_redSlices.get();
+      break;
   }
+
+  if (slices == nullptr)
+    throw std::runtime_error("Invalid arm configuration");
+
+  slices->require(slice);
+
+  return *slices;
+}
+
+void
+InstrumentModel::loadAllSlices() const
+{
+  ThreadPool::instance()->parallelFor(
+    2 * TARSIS_SLICES,
+    [this] (size_t i) {
+      requireSlice(
+        i < TARSIS_SLICES ? BlueArm : RedArm,
+        static_cast<unsigned>(i % TARSIS_SLICES));
+    });
 }
 
 // Returns instrument properties (required for simulation)
-InstrumentProperties *
+InstrumentProperties const *
 InstrumentModel::properties() const
 {
   return m_properties;
@@ -209,35 +320,13 @@ InstrumentModel::pxToWavelength(
   unsigned slice,
   unsigned pixel) const
 {
-  if (slice >= TARSIS_SLICES)
-    throw std::runtime_error("Slice " + std::to_string(slice + 1) + " out of bounds");
-
-  switch (arm) {
-    case BlueArm:
-      return (*m_bluePx2W[slice])(pixel);
-
-    case RedArm:
-      return (*m_redPx2W[slice])(pixel);
-  }
-
-  return std::numeric_limits<double>::quiet_NaN();
+  return (*requireSlice(arm, slice).px2W[slice])(pixel);
 }
 
-Curve *
-InstrumentModel::pxToWavelength(unsigned slice) const
+Curve const *
+InstrumentModel::pxToWavelength(InstrumentArm arm, unsigned slice) const
 {
-  if (slice >= TARSIS_SLICES)
-    throw std::runtime_error("Slice " + std::to_string(slice + 1) + " out of bounds");
-
-  switch (m_currentPath) {
-    case BlueArm:
-      return m_bluePx2W[slice];
-
-    case RedArm:
-      return m_redPx2W[slice];
-  }
-
-  return nullptr;
+  return requireSlice(arm, slice).px2W[slice];
 }
 
 int
@@ -246,68 +335,71 @@ InstrumentModel::wavelengthToPx(
   unsigned slice,
   double lambda) const
 {
-  if (slice >= TARSIS_SLICES)
-    throw std::runtime_error("Slice " + std::to_string(slice + 1) + " out of bounds");
-
-  switch (arm) {
-    case BlueArm:
-      return (*m_blueW2Px[slice])(lambda);
-
-    case RedArm:
-      return (*m_redW2Px[slice])(lambda);
-  }
-
-  return -1;
+  return (*requireSlice(arm, slice).w2Px[slice])(lambda);
 }
 
-Curve *
-InstrumentModel::wavelengthToPx(unsigned slice) const
+Curve const *
+InstrumentModel::wavelengthToPx(InstrumentArm arm, unsigned slice) const
 {
-  if (slice >= TARSIS_SLICES)
-    throw std::runtime_error("Slice " + std::to_string(slice + 1) + " out of bounds");
+  return requireSlice(arm, slice).w2Px[slice];
+}
 
-  switch (m_currentPath) {
+Curve const *
+InstrumentModel::transmission(
+  InstrumentArm arm,
+  std::string const &coating) const
+{
+  switch (arm) {
     case BlueArm:
-      return m_blueW2Px[slice];
+      if (coating == "ML15")
+        return m_blueML15.get();
+      else if (coating == "NBB")
+        return m_blueNBB.get();
+      break;
 
     case RedArm:
-      return m_redW2Px[slice];
+      if (coating == "ML15")
+        return m_redML15.get();
+      break;
   }
 
   return nullptr;
 }
 
+bool
+InstrumentModel::supportsCoating(
+  InstrumentArm arm,
+  std::string const &coating) const
+{
+  return transmission(arm, coating) != nullptr;
+}
+
 // Applies the spectrum. The input spectrum must be in radiance units,
 // with a *frequency* spectral axis* i.e. J / (s * m^2 * sr * Hz)
-void
-InstrumentModel::setInput(InstrumentArm arm, Spectrum const &input)
+Spectrum *
+InstrumentModel::makeAttenuatedSpectrum(
+  InstrumentArm arm,
+  std::string const &coating,
+  Spectrum const &input) const
 {
+  ETC_ALLOC_SCOPE(AttenuationAllocSite);
+
   double lightConeSr;
   double apertureAngRadius;
   double totalScale;
-  const Curve *transmission = nullptr;
-  
-  std::string const &coating = m_properties->coating;
+  const Curve *transmission = this->transmission(arm, coating);
 
-  switch (arm) {
-    case BlueArm:
-      if (coating == "ML15")
-        transmission = m_blueML15;
-      else if (coating == "NBB")
-        transmission = m_blueNBB;
-      else
+  if (transmission == nullptr) {
+    switch (arm) {
+      case BlueArm:
         throw std::runtime_error(coating + " is not a supported AR coating for the blue arm");
-      break;
 
-    case RedArm:
-      if (coating == "ML15")
-        transmission = m_redML15;
-      else
+      case RedArm:
         throw std::runtime_error(coating + " is not a supported AR coating for the red arm");
-      break;
 
-    default:
-      throw std::runtime_error("Invalid arm configuration");
+      default:
+        throw std::runtime_error("Invalid arm configuration");
+    }
   }
 
   // 
@@ -317,18 +409,19 @@ InstrumentModel::setInput(InstrumentArm arm, Spectrum const &input)
   //    multiplying the radiance by a light cone of f/#.
   // 2. Attenuate spectrum by the aperture efficiency
   // 3. Attenuate by the instrument curve
-  // 4. Save to m_attenSpectrum
   //
 
   apertureAngRadius = atan(.5 / m_properties->fNum);
   lightConeSr       = M_PI * apertureAngRadius * apertureAngRadius;
   totalScale        = lightConeSr * m_properties->apEfficiency;
 
-  m_currentPath     = arm;
+  Spectrum *attenSpectrum = new Spectrum();
+
+  attenSpectrum->fromExisting(input);          // Set input radiance
+  attenSpectrum->scaleAxis(YAxis, totalScale); // To irradiance
+  attenSpectrum->multiplyBy(*transmission);    // Attenuate by transmission
 
-  m_attenSpectrum->fromExisting(input);          // Set input radiance
-  m_attenSpectrum->scaleAxis(YAxis, totalScale); // To irradiance
-  m_attenSpectrum->multiplyBy(*transmission);    // Attenuate by transmission
+  return attenSpectrum;
 }
 
 static inline double
@@ -360,35 +453,22 @@ convolveAround(
 
 // Returns the per-pixel photon flux,in units of in ph / (s m^2)
 Spectrum *
-InstrumentModel::makePixelPhotonFlux(unsigned int slice) const
+InstrumentModel::makePixelPhotonFlux(
+  InstrumentArm arm,
+  unsigned int slice,
+  Spectrum const &attenuated,
+  SimulationProfile *profile) const
 {
-  Spectrum dispSpectrum;
+  ETC_ALLOC_SCOPE(PixelFluxAllocSite);
 
-  Curve const *w2pxPtr  = nullptr;
-  Curve const *px2wPtr  = nullptr;
-  Curve const *resElPtr = nullptr;
-  Curve const *dispPtr  = nullptr;
-
-  switch (m_currentPath) {
-    case BlueArm:
-      dispPtr  = m_blueDisp[slice];
-      w2pxPtr  = m_blueW2Px[slice];
-      px2wPtr  = m_bluePx2W[slice];
-      resElPtr = m_blueREPx[slice];
-      break;
+  Spectrum dispSpectrum;
 
-    case RedArm:
-      dispPtr  = m_redDisp[slice];
-      w2pxPtr  = m_redW2Px[slice];
-      px2wPtr  = m_redPx2W[slice];
-      resElPtr = m_redREPx[slice];
-      break;
-  }
+  InstrumentArmSlices const &slices = requireSlice(arm, slice);
 
-  Curve const &w2px  = *w2pxPtr;
-  Curve const &px2w  = *px2wPtr;
-  Curve const &resEl = *resElPtr;
-  Curve const &disp  = *dispPtr;
+  Curve const &w2px  = *slices.w2Px[slice];
+  Curve const &px2w  = *slices.px2W[slice];
+  Curve const &resEl = *slices.rePx[slice];
+  Curve const &disp  = *slices.disp[slice];
 
   //
   // This operates on the attenuated spectrum and involves:
@@ -400,11 +480,16 @@ InstrumentModel::makePixelPhotonFlux(unsigned int slice) const
   // 4. Convert power to photons by means of the planck constant. Note that
   //    ph = E / (hf) = E lambda / hc
 
-  dispSpectrum.fromExisting(*m_attenSpectrum);
-  dispSpectrum.scaleAxis(XAxis, w2px, disp);
+  {
+    StageTimer timer(profile, DispersionStage, attenuated.size());
+
+    dispSpectrum.fromExisting(attenuated);
+    dispSpectrum.scaleAxis(XAxis, w2px, disp);
+  }
 
   Spectrum *pixelFlux = new Spectrum();
   auto &pxFRef = *pixelFlux;
+  StageTimer timer(profile, ConvolutionStage, dispSpectrum.size());
 
   for (auto i = 0; i < SPECTRAL_PIXEL_LENGTH; ++i) {
     double wl = px2w(i);
@@ -0,0 +1,177 @@
+//
+// JobScheduler.cpp: Priority-aware scheduling of simulation jobs
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include <JobScheduler.h>
+#include <stdexcept>
+
+JobScheduler *JobScheduler::g_instance = nullptr;
+
+JobScheduler::JobScheduler(
+  ThreadPool *pool,
+  size_t interactiveCapacity,
+  size_t bulkCapacity)
+{
+  if (interactiveCapacity == 0 || bulkCapacity == 0)
+    throw std::runtime_error("Job queues cannot be empty");
+
+  m_pool = pool;
+
+  m_capacity[InteractiveJob] = interactiveCapacity;
+  m_capacity[BulkJob]        = bulkCapacity;
+}
+
+JobScheduler::~JobScheduler()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  // Tokens in the pool refer to us. Wait for them.
+  for (;;) {
+    bool idle = m_running == 0;
+
+    for (auto const &q : m_queues)
+      idle = idle && q.empty();
+
+    if (idle)
+      break;
+
+    help(lock);
+  }
+}
+
+JobScheduler *
+JobScheduler::instance()
+{
+  static std::once_flag flag;
+
+  std::call_once(flag, [] () {
+    g_instance = new JobScheduler();
+  });
+
+  return g_instance;
+}
+
+ThreadPool *
+JobScheduler::pool() const
+{
+  // Looked up every time, as it may be restarted after fork()
+  return m_pool != nullptr ? m_pool : ThreadPool::instance();
+}
+
+size_t
+JobScheduler::capacity(JobPriority priority) const
+{
+  return m_capacity[priority];
+}
+
+size_t
+JobScheduler::queued(JobPriority priority)
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  return m_queues[priority].size();
+}
+
+// Run a pending pool task, or wait a bit for changes if there is none
+void
+JobScheduler::help(std::unique_lock<std::mutex> &lock)
+{
+  lock.unlock();
+
+  if (pool()->runPending()) {
+    lock.lock();
+  } else {
+    lock.lock();
+    m_cond.wait_for(lock, std::chrono::milliseconds(1));
+  }
+}
+
+void
+JobScheduler::runNext()
+{
+  std::function<void()> job;
+
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    for (auto &q : m_queues) {
+      if (!q.empty()) {
+        job = std::move(q.front());
+        q.pop_front();
+        break;
+      }
+    }
+
+    if (!job)
+      return;
+
+    ++m_running;
+  }
+
+  m_cond.notify_all();
+
+  // Jobs are packaged tasks and keep their exceptions, but the destructor
+  // waits on m_running: never leave it counted, whatever happens.
+  struct Done {
+    JobScheduler *self;
+
+    ~Done()
+    {
+      {
+        std::lock_guard<std::mutex> guard(self->m_mutex);
+        --self->m_running;
+      }
+
+      self->m_cond.notify_all();
+    }
+  } done = {this};
+
+  job();
+}
+
+void
+JobScheduler::push(JobPriority priority, std::function<void()> job)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  // Blocked pool workers cannot drain the queue: help while we wait
+  while (m_queues[priority].size() >= m_capacity[priority])
+    help(lock);
+
+  m_queues[priority].push_back(std::move(job));
+  lock.unlock();
+
+  pool()->push([this] () { runNext(); });
+}
+
+bool
+JobScheduler::tryPush(JobPriority priority, std::function<void()> job)
+{
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    if (m_queues[priority].size() >= m_capacity[priority])
+      return false;
+
+    m_queues[priority].push_back(std::move(job));
+  }
+
+  pool()->push([this] () { runNext(); });
+
+  return true;
+}
@@ -0,0 +1,228 @@
+//
+// ModelRegistry.cpp: Process-wide registry of shared instrument models
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include <ModelRegistry.h>
+#include <DataFileManager.h>
+#include <SkyModel.h>
+#include <InstrumentModel.h>
+#include <Curve.h>
+#include <Helpers.h>
+#include <ConfigManager.h>
+#include <map>
+#include <filesystem>
+
+ModelRegistry *ModelRegistry::g_instance = nullptr;
+
+// Data files each model is built from, and the parts of the model read
+// from them. Sky models and filters are read again as a whole.
+static const std::map<std::string, unsigned> g_skyModelFiles = {
+  {"CAHASky.csv",                       ~0u},
+  {"CAHASkyExt.csv",                    ~0u},
+  {"moonBrightness.csv",                ~0u},
+  {CONFIG_MANAGER_DIRECTORY "/sky.yaml", ~0u}
+};
+
+static const std::map<std::string, unsigned> g_tarsisModelFiles = {
+  {"blueTransmission.csv",                 BlueTransmissionPart},
+  {"redTransmission.csv",                  RedTransmissionPart},
+  {"dispersionBlue.csv",                   BlueSlicesPart},
+  {"pxResolutionBlue.csv",                 BlueSlicesPart},
+  {"dispersionRed.csv",                    RedSlicesPart},
+  {"pxResolutionRed.csv",                  RedSlicesPart},
+  {CONFIG_MANAGER_DIRECTORY "/tarsis.yaml", InstrumentPropertiesPart}
+};
+
+static const std::map<std::string, unsigned> g_cousinsRFiles = {
+  {"Generic_Cousins.R.dat", ~0u}
+};
+
+ModelRegistry::ModelRegistry() : m_generation(0), m_builds(0)
+{
+}
+
+ModelRegistry *
+ModelRegistry::instance()
+{
+  static std::once_flag flag;
+
+  // Simulations may be created from several threads at once
+  std::call_once(flag, [] () { g_instance = new ModelRegistry(); });
+
+  return g_instance;
+}
+
+std::string
+ModelRegistry::currentKey()
+{
+  std::string key;
+
+  for (auto const &p : DataFileManager::instance()->searchPaths())
+    key += p + "\n";
+
+  return key;
+}
+
+std::shared_ptr<const SkyModel>
+ModelRegistry::skyModel()
+{
+  return lookup(m_skyMutex, m_skyModels, [] (auto const &, unsigned) {
+    return new SkyModel();
+  });
+}
+
+std::shared_ptr<const InstrumentModel>
+ModelRegistry::instrumentModel()
+{
+  return lookup(
+    m_tarsisMutex,
+    m_tarsisModels,
+    [] (std::shared_ptr<const InstrumentModel> const &previous, unsigned stale) {
+      if (previous)
+        return new InstrumentModel(*previous, stale);
+
+      return new InstrumentModel();
+    });
+}
+
+std::shared_ptr<const Curve>
+ModelRegistry::cousinsRFilter()
+{
+  return lookup(m_cousinsMutex, m_cousinsR, [] (auto const &, unsigned) {
+    Curve *cousinsR = new Curve();
+
+    // 
+    // http://svo2.cab.inta-csic.es/theory/fps/index.php?id=Generic/Cousins.R&&mode=browse&gname=Generic&gname2=Cousins
+    //
+
+    try {
+      cousinsR->load(dataFile("Generic_Cousins.R.dat"));
+    } catch (...) {
+      delete cousinsR;
+      throw;
+    }
+
+    cousinsR->scaleAxis(XAxis, 1e-10); // X axis was in angstrom
+    cousinsR->invertAxis(XAxis, SPEED_OF_LIGHT); // To frequency
+
+    return cousinsR;
+  });
+}
+
+//
+// Whether the models of a key read a file from the given search path. This
+// is the case if the path is one of the key, and no path before it has its
+// own copy of the file. Added and removed files count as well, as they
+// change the file the key resolves to.
+//
+bool
+ModelRegistry::readsFrom(
+  std::string const &key,
+  std::string const &name,
+  std::string const &searchPath)
+{
+  size_t p = 0, nl;
+
+  while ((nl = key.find('\n', p)) != std::string::npos) {
+    std::string path = key.substr(p, nl - p);
+    std::error_code ec;
+
+    if (path == searchPath)
+      return true;
+
+    if (std::filesystem::exists(path + "/" + name, ec))
+      return false;
+
+    p = nl + 1;
+  }
+
+  return false;
+}
+
+void
+ModelRegistry::dataFileChanged(
+  std::string const &name,
+  std::string const &searchPath)
+{
+  std::string configPrefix = CONFIG_MANAGER_DIRECTORY "/";
+  std::string configSuffix = ".yaml";
+  std::string path = searchPath;
+  bool changed = false;
+
+  // Config files are reloaded before dropping the models that use them.
+  // There is one config for all the keys, so all of them are affected.
+  if (name.size() > configPrefix.size() + configSuffix.size()
+      && name.compare(0, configPrefix.size(), configPrefix) == 0
+      && name.compare(
+        name.size() - configSuffix.size(),
+        configSuffix.size(),
+        configSuffix) == 0) {
+    changed = ConfigManager::instance()->reload(
+      name.substr(
+        configPrefix.size(),
+        name.size() - configPrefix.size() - configSuffix.size()));
+    path.clear();
+  }
+
+  auto sky = g_skyModelFiles.find(name);
+  if (sky != g_skyModelFiles.end()
+      && invalidate(m_skyMutex, m_skyModels, name, path, sky->second))
+    changed = true;
+
+  auto tarsis = g_tarsisModelFiles.find(name);
+  if (tarsis != g_tarsisModelFiles.end()
+      && invalidate(m_tarsisMutex, m_tarsisModels, name, path, tarsis->second))
+    changed = true;
+
+  auto cousins = g_cousinsRFiles.find(name);
+  if (cousins != g_cousinsRFiles.end()
+      && invalidate(m_cousinsMutex, m_cousinsR, name, path, cousins->second))
+    changed = true;
+
+  // Temporary files of editors and the like are of no interest
+  if (changed)
+    ++m_generation;
+}
+
+bool
+ModelRegistry::watchDataFiles()
+{
+  auto dfm = DataFileManager::instance();
+
+  {
+    std::lock_guard<std::mutex> guard(m_skyMutex);
+
+    if (m_watching)
+      return true;
+
+    m_watching = true;
+  }
+
+  dfm->addWatchListener(
+    [this] (std::string const &name, std::string const &searchPath) {
+      dataFileChanged(name, searchPath);
+    });
+
+  return dfm->watch() && dfm->watch(CONFIG_MANAGER_DIRECTORY);
+}
+
+unsigned
+ModelRegistry::generation() const
+{
+  return m_generation;
+}
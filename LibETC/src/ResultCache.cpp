@@ -0,0 +1,99 @@
+//
+// ResultCache.cpp: Memoization of simulation results
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include <ResultCache.h>
+#include <ModelRegistry.h>
+#include <stdexcept>
+#include <functional>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+
+static uint64_t
+fnv1a64(std::string_view data)
+{
+  uint64_t hash = 0xcbf29ce484222325ull;
+
+  for (auto c : data) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 0x100000001b3ull;
+  }
+
+  return hash;
+}
+
+std::string
+simulationKey(
+  SimulationParams const &params,
+  std::string const &extra,
+  std::string_view spectrum)
+{
+  char buf[256];
+
+  // Results computed after reloading data files or configs are different
+  // results. Parameters are written exactly (hexadecimal floats).
+  snprintf(
+    buf,
+    sizeof(buf),
+    "%u,%a,%a,%a,%a,%d,%ux%u,%zu:%016llx%016llx",
+    ModelRegistry::instance()->generation(),
+    params.airmass,
+    params.moon,
+    params.exposure,
+    params.rABmag,
+    params.slice,
+    params.binning.spectral,
+    params.binning.spatial,
+    spectrum.size(),
+    static_cast<unsigned long long>(fnv1a64(spectrum)),
+    static_cast<unsigned long long>(std::hash<std::string_view>()(spectrum)));
+
+  // Detector names are free text: store their length too
+  return std::string(buf)
+    + "," + std::to_string(params.blueDetector.size()) + ":" + params.blueDetector
+    + "," + std::to_string(params.redDetector.size()) + ":" + params.redDetector
+    + "," + extra;
+}
+
+std::string
+fileContents(std::string const &path)
+{
+  std::string contents;
+  char buf[65536];
+  size_t got;
+  FILE *fp = fopen(path.c_str(), "rb");
+
+  if (fp == nullptr)
+    throw std::runtime_error(
+      "Cannot open `" + path + "' for reading: " + strerror(errno));
+
+  while ((got = fread(buf, 1, sizeof(buf), fp)) > 0)
+    contents.append(buf, got);
+
+  if (ferror(fp)) {
+    int err = errno;
+    fclose(fp);
+    throw std::runtime_error(
+      "Cannot read `" + path + "': " + strerror(err));
+  }
+
+  fclose(fp);
+
+  return contents;
+}
@@ -20,34 +20,54 @@
 #include <Simulation.h>
 #include <ConfigManager.h>
 #include <DataFileManager.h>
+#include <ModelRegistry.h>
+#include <ThreadPool.h>
 #include <Helpers.h>
+#include <Tracer.h>
+
+void
+ArmResult::resize(unsigned pixels)
+{
+  wavelength.resize(pixels);
+  signal.resize(pixels);
+  noise.resize(pixels);
+  electrons.resize(pixels);
+  snr.resize(pixels);
+}
 
 Simulation::Simulation()
 {
-  // Init model
-  m_skyModel    = new SkyModel();
-  m_det         = new Detector();
-  m_tarsisModel = new InstrumentModel();
+  acquireModels();
+}
 
-  // 
-  // http://svo2.cab.inta-csic.es/theory/fps/index.php?id=Generic/Cousins.R&&mode=browse&gname=Generic&gname2=Cousins
-  //
+void
+Simulation::acquireModels()
+{
+  auto registry = ModelRegistry::instance();
+  auto pool     = ThreadPool::instance();
+
+  m_modelGeneration = registry->generation();
 
-  m_cousinsR.load(dataFile("Generic_Cousins.R.dat"));
-  m_cousinsR.scaleAxis(XAxis, 1e-10); // X axis was in angstrom
-  m_cousinsR.invertAxis(XAxis, SPEED_OF_LIGHT); // To frequency
+  // Init model. Loaded models are shared with other simulations. Models
+  // that are not loaded yet are loaded in parallel.
+  auto sky      = pool->submit([registry] () { return registry->skyModel(); });
+  auto tarsis   = pool->submit(
+    [registry] () { return registry->instrumentModel(); });
 
-  m_cousinsREquivBw = m_cousinsR.integral();
+  m_cousinsR    = registry->cousinsRFilter();
+  m_skyModel    = pool->wait(sky);
+  m_tarsisModel = pool->wait(tarsis);
+
+  // The detector holds the detector config, which may have been reloaded
+  if (m_det != nullptr)
+    delete m_det;
+  m_det         = new Detector();
+
+  m_cousinsREquivBw = m_cousinsR->integral();
 }
 
 Simulation::~Simulation()
 {
-  if (m_skyModel != nullptr)
-    delete m_skyModel;
-
-  if (m_tarsisModel != nullptr)
-    delete m_tarsisModel;
-
   if (m_det != nullptr)
     delete m_det;
 
@@ -67,6 +87,7 @@ Simulation::normalizeToRMag(double R)
 {
   Spectrum filtered;
   double meanSB, desiredSB;
+  StageTimer timer(profiler(), NormalizationStage, m_input.size());
 
   //
   // The following calculation departs from the following assumption. If we
@@ -84,7 +105,7 @@ Simulation::normalizeToRMag(double R)
   filtered.invertAxis(XAxis, SPEED_OF_LIGHT);
 
   // Filter (still in W / (m^2 sr Hz))
-  filtered.multiplyBy(m_cousinsR);
+  filtered.multiplyBy(*m_cousinsR);
 
   // Integrate the spectrum axis. Units are W / (m^2 sr). Dividing by 
   // the equivalent bandwidth gives a mean spectral surface brightness
@@ -99,16 +120,21 @@ Simulation::setParams(SimulationParams const &params)
 {
   m_params = params;
 
-  m_skyModel->setAirmass(params.airmass);
-  m_skyModel->setMoon(params.moon);
-  
+  // Data files changed since we got our models. Subsequent simulations
+  // use the new ones.
+  if (m_modelGeneration != ModelRegistry::instance()->generation())
+    acquireModels();
+
   if (m_sky != nullptr) {
     delete m_sky;
     m_sky = nullptr;
   }
 
   // Update sky spectrum
-  m_sky = m_skyModel->makeSkySpectrum(m_input);
+  {
+    StageTimer timer(profiler(), SkyStage, m_input.size());
+    m_sky = m_skyModel->makeSkySpectrum(m_input, params.airmass, params.moon);
+  }
 
   // Update detector config
   m_det->setExposureTime(params.exposure);
@@ -117,10 +143,16 @@ Simulation::setParams(SimulationParams const &params)
 void
 Simulation::simulateArm(InstrumentArm arm)
 {
-  Spectrum *flux = nullptr;
+  Spectrum *atten = nullptr;
+  Spectrum *flux  = nullptr;
+  TraceSpan span("slice", "simulateArm");
+
+  if (span.enabled()) {
+    span.addArg("arm", arm == BlueArm ? "blue" : "red");
+    span.addArg("slice", m_params.slice);
+  }
 
   try {
-    auto tarsisProp = m_tarsisModel->properties();
     std::string detName;
 
     switch (arm) {
@@ -139,23 +171,218 @@ Simulation::simulateArm(InstrumentArm arm)
     if (!m_det->setDetector(detName))
       throw std::runtime_error("Unknown detector `" + detName + "'");
 
-    // Set coating
-    tarsisProp->coating = m_det->getSpec()->coating;
-    m_tarsisModel->setInput(arm, *m_sky);
-    flux = m_tarsisModel->makePixelPhotonFlux(m_params.slice);
-    m_det->setPixelPhotonFlux(*flux);
-    delete flux;
-    flux = nullptr;
+    // The coating is given by the detector
+    {
+      StageTimer timer(profiler(), AttenuationStage, m_sky->size());
+      atten = m_tarsisModel->makeAttenuatedSpectrum(
+        arm,
+        m_det->getSpec()->coating,
+        *m_sky);
+    }
+
+    flux = m_tarsisModel->makePixelPhotonFlux(
+      arm,
+      m_params.slice,
+      *atten,
+      profiler());
+
+    {
+      StageTimer timer(profiler(), DetectorStage, flux->size());
+      m_det->setPixelPhotonFlux(*flux);
+    }
+
+    m_currentArm = arm;
+
+    fillResult(arm, m_result.arm(arm));
   } catch (std::runtime_error const &e) {
+    if (atten != nullptr)
+      delete atten;
     if (flux != nullptr)
       delete flux;
     throw;
   } 
 
+  if (atten != nullptr)
+    delete atten;
+
   if (flux != nullptr)
     delete flux;
 }
 
+void
+Simulation::fillResult(InstrumentArm arm, ArmResult &result)
+{
+  Curve const &px2w  = *m_tarsisModel->pxToWavelength(arm, m_params.slice);
+
+  result.resize(DETECTOR_PIXELS);
+  result.slice        = m_params.slice;
+  result.detector     = m_det->detectorName();
+  result.readOutNoise = m_det->readOutNoise();
+  result.gain         = m_det->getSpec()->gain;
+
+  for (auto i = 0u; i < DETECTOR_PIXELS; ++i)
+    result.wavelength[i] = px2w(i);
+
+  result.signal    = m_det->signal();
+  result.noise     = m_det->noise();
+  result.electrons = m_det->electrons();
+  result.snr       = m_det->snr();
+
+  result.valid = true;
+}
+
+DetectorResultTable
+Simulation::simulateAllDetectors(InstrumentArm arm)
+{
+  DetectorResultTable table;
+  std::map<std::string, std::list<std::string>> byCoating;
+  auto properties = m_det->properties();
+  TraceSpan span("slice", "simulateAllDetectors");
+
+  if (span.enabled()) {
+    span.addArg("arm", arm == BlueArm ? "blue" : "red");
+    span.addArg("slice", m_params.slice);
+  }
+
+  if (arm != BlueArm && arm != RedArm)
+    throw std::runtime_error("Unknown arm");
+
+  // Only the detector stage depends on the detector, save for the coating
+  for (auto const &p : properties->detectors)
+    if (m_tarsisModel->supportsCoating(arm, p.second->coating))
+      byCoating[p.second->coating].push_back(p.first);
+
+  for (auto const &group : byCoating) {
+    Spectrum *atten = nullptr;
+    Spectrum *flux  = nullptr;
+
+    try {
+      {
+        StageTimer timer(profiler(), AttenuationStage, m_sky->size());
+        atten = m_tarsisModel->makeAttenuatedSpectrum(arm, group.first, *m_sky);
+      }
+
+      flux = m_tarsisModel->makePixelPhotonFlux(
+        arm,
+        m_params.slice,
+        *atten,
+        profiler());
+
+      bool first = true;
+      for (auto const &name : group.second) {
+        m_det->setDetector(name);
+
+        // The pixel flux is sampled once, subsequent detectors reuse it
+        {
+          StageTimer timer(profiler(), DetectorStage, flux->size());
+
+          if (first)
+            m_det->setPixelPhotonFlux(*flux);
+          else
+            m_det->recalculate();
+        }
+
+        first = false;
+        fillResult(arm, table[name]);
+      }
+    } catch (std::runtime_error const &e) {
+      if (atten != nullptr)
+        delete atten;
+      if (flux != nullptr)
+        delete flux;
+      throw;
+    }
+
+    delete atten;
+    delete flux;
+  }
+
+  return table;
+}
+
+SimulationResult const &
+Simulation::result() const
+{
+  return m_result;
+}
+
+ArmResult const &
+Simulation::result(InstrumentArm arm) const
+{
+  return m_result.arm(arm);
+}
+
+SimulationResult
+Simulation::takeResult()
+{
+  SimulationResult result = std::move(m_result);
+
+  m_result = SimulationResult();
+
+  return result;
+}
+
+//
+// Binning adds up the charge of the binned pixels before read-out. Since
+// the simulated spectrum is the same along the spatial direction of the
+// slice, spatially binned pixels hold the same charge. Trailing pixels
+// that do not fill a whole spectral bin are discarded.
+//
+ArmResult
+ArmResult::binned(DetectorBinning const &binning) const
+{
+  ArmResult const &result = *this;
+  ArmResult binned;
+
+  if (!result.valid)
+    throw std::runtime_error("Arm has not been simulated yet");
+
+  if (!binning.isValid())
+    throw std::runtime_error("Invalid binning mode");
+
+  unsigned pixels = binning.pixels();
+  double invSpectral = 1. / binning.spectral;
+
+  binned.resize(pixels);
+  binned.slice        = result.slice;
+  binned.detector     = result.detector;
+  binned.readOutNoise = result.readOutNoise;
+  binned.gain         = result.gain;
+
+  for (auto i = 0u; i < pixels; ++i) {
+    double wl = 0, el = 0, sg = 0;
+
+    for (auto j = i * binning.spectral; j < (i + 1) * binning.spectral; ++j) {
+      wl += result.wavelength[j];
+      el += result.electrons[j];
+      sg += result.signal[j];
+    }
+
+    el *= binning.spatial;
+    sg *= binning.spatial;
+
+    double nz = Detector::noise(el, result.gain, result.readOutNoise);
+
+    binned.wavelength[i] = wl * invSpectral;
+    binned.electrons[i]  = el;
+    binned.signal[i]     = sg;
+    binned.noise[i]      = nz;
+    binned.snr[i]        = sg / nz;
+  }
+
+  binned.valid = true;
+
+  return binned;
+}
+
+ArmResult
+Simulation::binnedResult(
+  InstrumentArm arm,
+  DetectorBinning const &binning) const
+{
+  return m_result.arm(arm).binned(binning);
+}
+
 double
 Simulation::signal(unsigned px) const
 {
@@ -194,11 +421,41 @@ Simulation::gain() const
 double
 Simulation::pxToWavelength(unsigned px) const
 {
-  return (*m_tarsisModel->pxToWavelength(m_params.slice))(px);
+  return (*m_tarsisModel->pxToWavelength(m_currentArm, m_params.slice))(px);
 }
 
 Curve const &
 Simulation::wlToPixelCurve() const
 {
-  return (*m_tarsisModel->wavelengthToPx(m_params.slice));
+  return (*m_tarsisModel->wavelengthToPx(m_currentArm, m_params.slice));
+}
+
+SimulationProfile *
+Simulation::profiler()
+{
+  return m_profiling ? &m_profile : nullptr;
+}
+
+void
+Simulation::setProfiling(bool profiling)
+{
+  m_profiling = profiling;
+}
+
+bool
+Simulation::profiling() const
+{
+  return m_profiling;
+}
+
+SimulationProfile const &
+Simulation::profile() const
+{
+  return m_profile;
+}
+
+void
+Simulation::resetProfile()
+{
+  m_profile.clear();
 }
@@ -0,0 +1,160 @@
+//
+// SimulationProfile.cpp: Per-stage timing of simulations
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include <SimulationProfile.h>
+#include <Tracer.h>
+#include <stdexcept>
+
+static const char *g_stageNames[SIMULATION_STAGE_COUNT] = {
+  "normalization",
+  "sky",
+  "attenuation",
+  "dispersion",
+  "convolution",
+  "detector"
+};
+
+static inline double
+elapsed(struct timespec const &start, struct timespec const &end)
+{
+  return static_cast<double>(end.tv_sec - start.tv_sec)
+    + 1e-9 * static_cast<double>(end.tv_nsec - start.tv_nsec);
+}
+
+const char *
+SimulationProfile::stageName(SimulationStage stage)
+{
+  if (stage < 0 || stage >= SIMULATION_STAGE_COUNT)
+    throw std::runtime_error("Invalid simulation stage");
+
+  return g_stageNames[stage];
+}
+
+StageProfile const &
+SimulationProfile::stage(SimulationStage stage) const
+{
+  if (stage < 0 || stage >= SIMULATION_STAGE_COUNT)
+    throw std::runtime_error("Invalid simulation stage");
+
+  return m_stages[stage];
+}
+
+StageProfile
+SimulationProfile::total() const
+{
+  StageProfile total;
+
+  for (auto const &s : m_stages) {
+    total.calls    += s.calls;
+    total.wallTime += s.wallTime;
+    total.cpuTime  += s.cpuTime;
+    total.points   += s.points;
+  }
+
+  return total;
+}
+
+void
+SimulationProfile::add(
+  SimulationStage stage,
+  double wallTime,
+  double cpuTime,
+  uint64_t points)
+{
+  auto &s = m_stages[stage];
+
+  ++s.calls;
+  s.wallTime += wallTime;
+  s.cpuTime  += cpuTime;
+  s.points   += points;
+}
+
+void
+SimulationProfile::merge(SimulationProfile const &other)
+{
+  for (auto i = 0; i < SIMULATION_STAGE_COUNT; ++i) {
+    m_stages[i].calls    += other.m_stages[i].calls;
+    m_stages[i].wallTime += other.m_stages[i].wallTime;
+    m_stages[i].cpuTime  += other.m_stages[i].cpuTime;
+    m_stages[i].points   += other.m_stages[i].points;
+  }
+}
+
+void
+SimulationProfile::clear()
+{
+  for (auto &s : m_stages)
+    s = StageProfile();
+}
+
+StageTimer::StageTimer(
+  SimulationProfile *profile,
+  SimulationStage stage,
+  uint64_t points)
+{
+  m_profile = profile;
+  m_stage   = stage;
+  m_points  = points;
+  m_tracing = Tracer::enabled();
+
+  if (m_tracing)
+    m_traceStart = Tracer::instance()->now();
+
+  if (m_profile != nullptr) {
+    clock_gettime(CLOCK_MONOTONIC, &m_wallStart);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &m_cpuStart);
+  }
+}
+
+StageTimer::~StageTimer()
+{
+  struct timespec wallEnd, cpuEnd;
+
+  if (m_tracing) {
+    auto tracer = Tracer::instance();
+    uint64_t end = tracer->now();
+
+    tracer->add(
+      TraceEvent {
+        g_stageNames[m_stage],
+        "stage",
+        m_traceStart,
+        end > m_traceStart ? end - m_traceStart : 0,
+        Tracer::threadId(),
+        traceArg("points", static_cast<double>(m_points))});
+  }
+
+  if (m_profile == nullptr)
+    return;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuEnd);
+  clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+
+  m_profile->add(
+    m_stage,
+    elapsed(m_wallStart, wallEnd),
+    elapsed(m_cpuStart, cpuEnd),
+    m_points);
+}
+
+void
+StageTimer::setPoints(uint64_t points)
+{
+  m_points = points;
+}
@@ -18,10 +18,12 @@
 //
 
 #include <SkyModel.h>
+#include <SimulationProfile.h>
 #include <DataFileManager.h>
 #include <Curve.h>
 #include <Spectrum.h>
 #include <Helpers.h>
+#include <ThreadPool.h>
 #include <cmath>
 
 //////////////////////////////// SkyProperties /////////////////////////////////
@@ -65,12 +67,23 @@ SkyModel::SkyModel()
   //            1.7466e-17 erg / (s cm^2 A arcsec^2), i.e.
   //             7.4309394e-10 W / (m^2 A sr)
 
-  m_skySpectrum->load(dataFile("CAHASky.csv"), false, 1, 2);
-  m_skySpectrum->scaleAxis(YAxis, 7.4309394e-10); // To SI units
-  m_skySpectrum->scaleAxis(XAxis, 1e-10);         // Convert angstrom to meters
-
-  m_skyExt->load(dataFile("CAHASkyExt.csv"));
-  m_moonToMag->load(dataFile("moonBrightness.csv"));
+  ThreadPool::instance()->parallelFor(3, [this] (size_t i) {
+    switch (i) {
+      case 0:
+        m_skySpectrum->load(dataFile("CAHASky.csv"), false, 1, 2);
+        m_skySpectrum->scaleAxis(YAxis, 7.4309394e-10); // To SI units
+        m_skySpectrum->scaleAxis(XAxis, 1e-10);         // Angstrom to meters
+        break;
+
+      case 1:
+        m_skyExt->load(dataFile("CAHASkyExt.csv"));
+        break;
+
+      case 2:
+        m_moonToMag->load(dataFile("moonBrightness.csv"));
+        break;
+    }
+  });
 }
 
 SkyModel::~SkyModel()
@@ -85,36 +98,29 @@ SkyModel::~SkyModel()
     delete m_moonToMag;
 }
 
-void
-SkyModel::setMoon(double moon)
-{
-  if (moon < 0 || moon > 100)
-    throw std::runtime_error("Moon percent out of bounds");
-  
-  m_moonFraction = moon;
-}
-
-void
-SkyModel::setAirmass(double airmass)
-{
-  if (airmass < 1)
-    throw std::runtime_error("Airmass out of bounds");
-
-  m_airmass = airmass;
-}
-
-void
-SkyModel::setZenithDistance(double z)
+double
+SkyModel::zenithDistanceToAirmass(double z)
 {
   if (z < 0 || z >= 90)
     throw std::runtime_error("Zenith distance out of bounds");
 
-  setAirmass(1. / cos(z / 180. * M_PI));
+  return 1. / cos(z / 180. * M_PI);
 }
 
 Spectrum *
-SkyModel::makeSkySpectrum(Spectrum const &object) const
+SkyModel::makeSkySpectrum(
+  Spectrum const &object,
+  double airmass,
+  double moonFraction) const
 {
+  ETC_ALLOC_SCOPE(SkySpectrumAllocSite);
+
+  if (moonFraction < 0 || moonFraction > 100)
+    throw std::runtime_error("Moon percent out of bounds");
+
+  if (airmass < 1)
+    throw std::runtime_error("Airmass out of bounds");
+
   Spectrum *spectPtr     = new Spectrum();
   Spectrum &spectrum     = *spectPtr;
   Curve const &skyExt    = *m_skyExt;
@@ -123,17 +129,17 @@ SkyModel::makeSkySpectrum(Spectrum const &object) const
 
 
   spectrum.fromExisting(skyBg);
-  spectrum.scaleAxis(YAxis, m_airmass);
+  spectrum.scaleAxis(YAxis, airmass);
   spectrum.add(object);
   auto xp = spectrum.xPoints();
 
   for (auto p : xp) {
-    double extFrac = mag2frac(skyExt(p) * m_airmass);
+    double extFrac = mag2frac(skyExt(p) * airmass);
     // Model: I_sky = extinction(airmass) * (object + moon + background * airmass)
 
     spectrum[p] = extFrac * (
       spectrum(p) 
-      + surfaceBrightnessAB2radiance(moon(m_moonFraction), p));
+      + surfaceBrightnessAB2radiance(moon(moonFraction), p));
   }
 
   return spectPtr;
@@ -18,30 +18,24 @@
 //
 
 #include <Spectrum.h>
+#include <SimulationProfile.h>
 #include <cmath>
 #include <stdexcept>
+#include <limits>
 
 void
 Spectrum::scaleAxis(CurveAxis axis, double factor)
 {
-  if (axis == XAxis) {
-    std::list<std::map<double, double>::node_type> xp;
-
-    auto it = m_curve.cbegin();
-    auto next = std::next(it);
+  ETC_ALLOC_SCOPE(CurveScaleAllocSite);
 
-    while (it != m_curve.end()) {
-      next = std::next(it);
-      xp.push_back(std::move(m_curve.extract(it)));
-      it = next;
-    }
-    
-    for (auto &p : xp) {
-      p.key()    *= factor;
-      p.mapped() /= factor;
-      m_curve.insert(std::move(p));
+  if (axis == XAxis) {
+    for (size_t i = 0; i < m_x.size(); ++i) {
+      m_x[i] *= factor;
+      m_y[i] /= factor;
     }
 
+    sortPoints(m_x, m_y, false);
+
     m_oobLeft  /= factor;
     m_oobRight /= factor;
   } else {
@@ -52,17 +46,10 @@ Spectrum::scaleAxis(CurveAxis axis, double factor)
 void
 Spectrum::scaleAxis(CurveAxis axis, Curve const &curve)
 {
-  if (axis == XAxis) {
-    std::list<std::map<double, double>::node_type> xp;
-    
-    auto it = m_curve.cbegin();
-    auto next = std::next(it);
+  ETC_ALLOC_SCOPE(CurveScaleAllocSite);
 
-    while (it != m_curve.end()) {
-      next = std::next(it);
-      xp.push_back(std::move(m_curve.extract(it)));
-      it = next;
-    }
+  if (axis == XAxis) {
+    size_t p = 0;
 
     //
     // fz(g(x)) = fx(x) / g'(x), this is:
@@ -72,21 +59,26 @@ Spectrum::scaleAxis(CurveAxis axis, Curve const &curve)
     // We would like the differentiation to be (almost) the inverse of
     // integrate()
 
-    for (auto &p : xp) {
-      double x    = p.key();
+    for (size_t i = 0; i < m_x.size(); ++i) {
+      double x    = m_x[i];
       double diff = fabs(curve.getdiff(x));
-      p.key()     = curve(x);
 
       if (diff != 0.0) {
-        p.mapped() /= diff;
-        m_curve.insert(std::move(p));
+        m_x[p]   = curve(x);
+        m_y[p++] = m_y[i] / diff;
       }
     }
+
+    m_x.resize(p);
+    m_y.resize(p);
+    sortPoints(m_x, m_y, false);
     
-    if (m_oobLeft != 0.0)
-      m_oobLeft  /= fabs(curve.getdiff(m_curve.begin()->second));
-    if (m_oobRight != 0.0)
-      m_oobRight /= fabs(curve.getdiff(std::prev(m_curve.end())->second));
+    if (!m_x.empty()) {
+      if (m_oobLeft != 0.0)
+        m_oobLeft  /= fabs(curve.getdiff(m_y.front()));
+      if (m_oobRight != 0.0)
+        m_oobRight /= fabs(curve.getdiff(m_y.back()));
+    }
   } else {
     Curve::scaleAxis(axis, curve);
   }
@@ -95,18 +87,11 @@ Spectrum::scaleAxis(CurveAxis axis, Curve const &curve)
 void
 Spectrum::scaleAxis(CurveAxis axis, Curve const &curve, Curve const &diff)
 {
+  ETC_ALLOC_SCOPE(CurveScaleAllocSite);
+
   if (axis == XAxis) {
-    std::list<std::map<double, double>::node_type> xp;
-    
-    auto it = m_curve.cbegin();
-    auto next = std::next(it);
+    size_t p = 0;
 
-    while (it != m_curve.end()) {
-      next = std::next(it);
-      xp.push_back(std::move(m_curve.extract(it)));
-      it = next;
-    }
-    
     //
     // fz(g(x)) = fx(x) / g'(x), this is:
     // p.key()     = curve(x)
@@ -115,21 +100,26 @@ Spectrum::scaleAxis(CurveAxis axis, Curve const &curve, Curve const &diff)
     // We would like the differentiation to be (almost) the inverse of
     // integrate()
 
-    for (auto &p : xp) {
-      double x    = p.key();
+    for (size_t i = 0; i < m_x.size(); ++i) {
+      double x    = m_x[i];
       double dfdx = fabs(diff(x));
-      p.key()     = curve(x);
 
       if (dfdx != 0.0) {
-        p.mapped() /= dfdx;
-        m_curve.insert(std::move(p));
+        m_x[p]   = curve(x);
+        m_y[p++] = m_y[i] / dfdx;
       }
     }
+
+    m_x.resize(p);
+    m_y.resize(p);
+    sortPoints(m_x, m_y, false);
     
-    if (m_oobLeft != 0.0)
-      m_oobLeft  /= fabs(diff(m_curve.begin()->second));
-    if (m_oobRight != 0.0)
-      m_oobRight /= fabs(diff(std::prev(m_curve.end())->second));
+    if (!m_x.empty()) {
+      if (m_oobLeft != 0.0)
+        m_oobLeft  /= fabs(diff(m_y.front()));
+      if (m_oobRight != 0.0)
+        m_oobRight /= fabs(diff(m_y.back()));
+    }
   } else {
     Curve::scaleAxis(axis, curve);
   }
@@ -138,22 +128,13 @@ Spectrum::scaleAxis(CurveAxis axis, Curve const &curve, Curve const &diff)
 void
 Spectrum::invertAxis(CurveAxis axis, double factor)
 {
-  if (m_curve.empty())
+  ETC_ALLOC_SCOPE(CurveInvertAllocSite);
+
+  if (m_x.empty())
       return;
 
   if (axis == XAxis) {
-    std::list<std::map<double, double>::node_type> xp;
-
-    auto it = m_curve.cbegin();
-    auto next = std::next(it);
-
-    while (it != m_curve.end()) {
-      next = std::next(it);
-      xp.push_back(std::move(m_curve.extract(it)));
-      it = next;
-    }
-
-    if (xp.front().key() < 0)
+    if (m_x.front() < 0)
       throw std::runtime_error("Inverting spectrums with negative values in the X axis not yet supported");
 
     //
@@ -161,24 +142,25 @@ Spectrum::invertAxis(CurveAxis axis, double factor)
     // 1/g'(x) = x*x / factor
     //
 
-    for (auto &p : xp) {
-      double x    = p.key();
-      p.key()     = factor / x;
-      p.mapped() *= (x * x) / factor;
-      m_curve.insert(std::move(p));
+    for (size_t i = 0; i < m_x.size(); ++i) {
+      double x = m_x[i];
+      m_x[i]   = factor / x;
+      m_y[i]  *= (x * x) / factor;
     }
 
+    sortPoints(m_x, m_y, false);
+
     //
     // Everything to the right is going to be squashed in a point of 
     // infinite density towards 0.
     //
 
     if (m_oobRight != 0.)
-      m_curve[0] = std::numeric_limits<double>::infinity();
+      set(0, std::numeric_limits<double>::infinity());
     else
-      m_curve[0] = 0.;
+      set(0, 0.);
     
-    m_oobLeft  = m_curve[0];
+    m_oobLeft  = get(0);
     m_oobRight = 0;
   } else {
     Curve::invertAxis(axis);
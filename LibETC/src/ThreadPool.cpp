@@ -0,0 +1,205 @@
+//
+// ThreadPool.cpp: Pool of worker threads
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include <ThreadPool.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstdio>
+
+ThreadPool *ThreadPool::g_instance = nullptr;
+
+ThreadPool::ThreadPool(unsigned threads)
+{
+  if (threads == 0)
+    threads = std::thread::hardware_concurrency();
+
+  if (threads == 0)
+    threads = 1;
+
+  for (auto i = 0u; i < threads; ++i)
+    m_workers.push_back(std::thread(&ThreadPool::work, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_stopping = true;
+  }
+
+  m_cond.notify_all();
+
+  for (auto &t : m_workers)
+    t.join();
+}
+
+ThreadPool *
+ThreadPool::instance()
+{
+  static std::once_flag flag;
+
+  std::call_once(flag, [] () {
+    const char *env = getenv("TARSIS_ETC_THREADS");
+    unsigned threads = 0;
+
+    if (env != nullptr && sscanf(env, "%u", &threads) < 1) {
+      fprintf(stderr, "warning: invalid TARSIS_ETC_THREADS `%s'\n", env);
+      threads = 0;
+    }
+
+    g_instance = new ThreadPool(threads);
+  });
+
+  return g_instance;
+}
+
+void
+ThreadPool::restartAfterFork(unsigned threads)
+{
+  instance();
+
+  // The old pool is leaked on purpose: its threads cannot be joined
+  g_instance = new ThreadPool(threads);
+}
+
+unsigned
+ThreadPool::threads() const
+{
+  return static_cast<unsigned>(m_workers.size());
+}
+
+void
+ThreadPool::work()
+{
+  for (;;) {
+    std::function<void()> task;
+
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+
+      m_cond.wait(lock, [this] () { return m_stopping || !m_queue.empty(); });
+
+      if (m_queue.empty())
+        return;
+
+      task = std::move(m_queue.front());
+      m_queue.pop_front();
+    }
+
+    task();
+  }
+}
+
+void
+ThreadPool::push(std::function<void()> task)
+{
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_queue.push_back(std::move(task));
+  }
+
+  m_cond.notify_one();
+}
+
+bool
+ThreadPool::runPending()
+{
+  std::function<void()> task;
+
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    if (m_queue.empty())
+      return false;
+
+    task = std::move(m_queue.front());
+    m_queue.pop_front();
+  }
+
+  task();
+
+  return true;
+}
+
+//
+// Indices are claimed from a shared counter, by the workers and by the
+// caller. The caller only runs indices of its own loop: running unrelated
+// tasks here (which may wait for something the caller holds, like a model
+// being built) could deadlock. Tokens left in the queue after the loop is
+// done find no index to claim and return.
+//
+struct ParallelForState {
+  std::atomic<size_t>                next;
+  size_t                             count;
+  size_t                             done = 0;
+  std::function<void(size_t)> const *func;
+  std::exception_ptr                 firstError;
+  std::mutex                         mutex;
+  std::condition_variable            cond;
+
+  bool
+  runNext()
+  {
+    size_t i = next++;
+    std::exception_ptr error;
+
+    if (i >= count)
+      return false;
+
+    try {
+      (*func)(i);
+    } catch (...) {
+      error = std::current_exception();
+    }
+
+    std::lock_guard<std::mutex> guard(mutex);
+
+    if (error && !firstError)
+      firstError = error;
+
+    if (++done == count)
+      cond.notify_all();
+
+    return true;
+  }
+};
+
+void
+ThreadPool::parallelFor(
+  size_t count,
+  std::function<void(size_t)> const &func)
+{
+  auto state = std::make_shared<ParallelForState>();
+
+  state->next  = 0;
+  state->count = count;
+  state->func  = &func;
+
+  // One token per worker is enough, as each of them loops
+  for (size_t i = 1; i < count && i <= threads(); ++i)
+    push([state] () { while (state->runNext()); });
+
+  while (state->runNext());
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->cond.wait(lock, [&state] () { return state->done == state->count; });
+
+  if (state->firstError)
+    std::rethrow_exception(state->firstError);
+}
@@ -0,0 +1,243 @@
+//
+// Tracer.cpp: Trace events in the Chrome / Perfetto JSON format
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include <Tracer.h>
+#include <DataWriter.h>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <ctime>
+#include <unistd.h>
+
+Tracer *Tracer::g_instance = nullptr;
+
+static std::string
+jsonString(std::string const &str)
+{
+  std::string result = "\"";
+
+  for (auto c : str) {
+    switch (c) {
+      case '"':
+        result += "\\\"";
+        break;
+
+      case '\\':
+        result += "\\\\";
+        break;
+
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char buf[8];
+          snprintf(buf, sizeof(buf), "\\u%04x", c);
+          result += buf;
+        } else {
+          result += c;
+        }
+    }
+  }
+
+  return result + "\"";
+}
+
+std::string
+traceArg(std::string const &name, double value)
+{
+  char buf[32];
+
+  // JSON has no NaN or infinity
+  if (!std::isfinite(value))
+    return jsonString(name) + ": null";
+
+  snprintf(buf, sizeof(buf), "%.17g", value);
+
+  return jsonString(name) + ": " + buf;
+}
+
+std::string
+traceArg(std::string const &name, std::string const &value)
+{
+  return jsonString(name) + ": " + jsonString(value);
+}
+
+Tracer::Tracer() : m_enabled(false), m_origin(monotonicNs())
+{
+}
+
+int64_t
+Tracer::monotonicNs()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+Tracer *
+Tracer::instance()
+{
+  static std::once_flag flag;
+
+  std::call_once(flag, [] () {
+    g_instance = new Tracer();
+  });
+
+  return g_instance;
+}
+
+std::string
+Tracer::startFromEnvironment()
+{
+  const char *path = getenv("TARSIS_ETC_TRACE");
+
+  if (path == nullptr || *path == '\0')
+    return "";
+
+  instance()->start();
+
+  return path;
+}
+
+unsigned
+Tracer::threadId()
+{
+  static std::atomic<unsigned> next(1);
+  thread_local unsigned id = next++;
+
+  return id;
+}
+
+void
+Tracer::start()
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  m_events.clear();
+
+  // Read by now() without the lock. Set before enabling, so that spans
+  // seeing the tracer enabled see the new origin as well.
+  m_origin.store(monotonicNs(), std::memory_order_relaxed);
+  m_enabled.store(true, std::memory_order_release);
+}
+
+void
+Tracer::stop()
+{
+  m_enabled = false;
+}
+
+uint64_t
+Tracer::now() const
+{
+  int64_t elapsed = monotonicNs() - m_origin.load(std::memory_order_relaxed);
+
+  // Spans opened before a restart may end before the new origin
+  return elapsed > 0 ? static_cast<uint64_t>(elapsed / 1000) : 0;
+}
+
+void
+Tracer::add(TraceEvent &&event)
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  if (m_enabled)
+    m_events.push_back(std::move(event));
+}
+
+void
+Tracer::write(std::string const &path)
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  DataWriter out(path);
+  std::string pid = std::to_string(getpid());
+  bool first = true;
+
+  out.write("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+  for (auto const &e : m_events) {
+    if (!first)
+      out.write(",\n");
+    first = false;
+
+    out.write(
+      "{\"ph\": \"X\", \"name\": " + jsonString(e.name)
+      + ", \"cat\": " + jsonString(e.category)
+      + ", \"pid\": " + pid
+      + ", \"tid\": " + std::to_string(e.tid)
+      + ", \"ts\": " + std::to_string(e.start)
+      + ", \"dur\": " + std::to_string(e.duration)
+      + ", \"args\": {" + e.args + "}}");
+  }
+
+  out.write("\n]}\n");
+  out.close();
+}
+
+TraceSpan::TraceSpan(
+  const char *category,
+  std::string const &name,
+  std::string const &args)
+{
+  m_enabled = Tracer::enabled();
+
+  if (m_enabled) {
+    m_category = category;
+    m_name     = name;
+    m_args     = args;
+    m_start    = Tracer::instance()->now();
+  }
+}
+
+TraceSpan::~TraceSpan()
+{
+  if (m_enabled) {
+    auto tracer = Tracer::instance();
+    uint64_t end = tracer->now();
+
+    tracer->add(
+      TraceEvent {
+        std::move(m_name),
+        m_category,
+        m_start,
+        end > m_start ? end - m_start : 0,
+        Tracer::threadId(),
+        std::move(m_args)});
+  }
+}
+
+bool
+TraceSpan::enabled() const
+{
+  return m_enabled;
+}
+
+void
+TraceSpan::addArg(std::string const &name, double value)
+{
+  if (m_enabled)
+    m_args += (m_args.empty() ? "" : ", ") + traceArg(name, value);
+}
+
+void
+TraceSpan::addArg(std::string const &name, std::string const &value)
+{
+  if (m_enabled)
+    m_args += (m_args.empty() ? "" : ", ") + traceArg(name, value);
+}
@@ -0,0 +1,120 @@
+//
+// Protocol.h: ETC server protocol
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#ifndef _ETC_SERVER_PROTOCOL_H
+#define _ETC_SERVER_PROTOCOL_H
+
+#include <Simulation.h>
+#include <JobScheduler.h>
+#include <string>
+#include <cstdint>
+
+//
+// Clients talk to the server over a Unix-domain stream socket, by means of
+// frames. A frame is a 16-byte header followed by a payload. Header fields
+// are little endian:
+//
+//   uint32 magic   ETC_PROTOCOL_MAGIC ("TETC")
+//   uint16 version ETC_PROTOCOL_VERSION
+//   uint16 type    One of MessageType
+//   uint32 id      Chosen by the client, copied to the reply
+//   uint32 length  Payload length
+//
+// Requests are processed in order, one reply per request. Results are
+// memoized by the server: repeating a request (same parameters and same
+// spectrum contents) returns the stored reply.
+//
+// MSG_SIMULATE payload: "key=value" lines, an empty line, and then an
+// optional inline spectrum in the same CSV format as spectrum files
+// (wavelength in nm). Keys are:
+//
+//   spectrum      Path to a spectrum file (instead of the inline one)
+//   airmass       Airmass (>= 1, default 1)
+//   moon          Moon illumination, 0 to 100 (default 0)
+//   exposure      Exposure time in seconds (default 3600)
+//   magnitude     R(AB) magnitude of the spectrum (default 18)
+//   slice         Slice, from 1 to 40 (default 21, the library default)
+//   blueDetector  Blue arm detector
+//   redDetector   Red arm detector
+//   binning       On-chip binning, as SPExSPA (default 1x1)
+//   allDetectors  1 to simulate every compatible detector (default 0)
+//   transport     inline (default) or shm. See MSG_RESULT_SHM.
+//   priority      interactive (default) or bulk. Clients sweeping over
+//                 many configurations should send them as bulk requests,
+//                 so that interactive ones are served first.
+//
+// MSG_RESULT payload: binary table (see TableWriter) with three rows per
+// simulated detector: wavelength (m), signal and noise (counts). Rows
+// are labeled "ARM:DETECTOR:QUANTITY", e.g. "blue:CCD231-84-0-S77:signal".
+//
+// MSG_RESULT_SHM: result of requests with transport=shm. The table of
+// MSG_RESULT is not sent in the payload but in a sealed (read-only) memfd,
+// passed along with the frame header as SCM_RIGHTS ancillary data. The
+// payload is the table size as an uint64. Clients map the descriptor and
+// close it when they are done. Identical results share the same memory.
+//
+// MSG_ERROR payload: error message.
+//
+// MSG_STATS request has no payload. The MSG_STATS reply carries "key=value"
+// lines with the result cache counters: hits, misses, coalesced (requests
+// that waited for an identical one in progress), evictions, entries and
+// capacity.
+//
+
+#define ETC_PROTOCOL_MAGIC       0x43544554 // "TETC"
+#define ETC_PROTOCOL_VERSION     1
+#define ETC_PROTOCOL_HEADER_SIZE 16
+#define ETC_PROTOCOL_MAX_PAYLOAD (256u << 20)
+
+enum MessageType {
+  MSG_SIMULATE   = 1,
+  MSG_RESULT     = 2,
+  MSG_ERROR      = 3,
+  MSG_STATS      = 4,
+  MSG_RESULT_SHM = 5
+};
+
+struct Frame {
+  uint16_t    type = 0;
+  uint32_t    id   = 0;
+  std::string payload;
+  int         fd = -1; // Passed along with the frame. Not owned.
+};
+
+struct SimulationRequest {
+  SimulationParams params;
+  bool             allDetectors = false;
+  bool             sharedMemory = false;
+  JobPriority      priority     = InteractiveJob;
+  std::string      spectrumPath;
+  std::string      spectrumData; // Inline spectrum
+};
+
+// Returns false on end of stream. Throws on I/O and protocol errors. If
+// the frame carries a descriptor, the caller must close it.
+bool readFrame(int fd, Frame &frame);
+void writeFrame(int fd, Frame const &frame);
+
+// Returns false and sets error if the request is not valid
+bool parseSimulationRequest(
+  std::string const &payload,
+  SimulationRequest &request,
+  std::string &error);
+
+#endif // _ETC_SERVER_PROTOCOL_H
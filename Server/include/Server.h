@@ -0,0 +1,137 @@
+//
+// Server.h: ETC server
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#ifndef _ETC_SERVER_H
+#define _ETC_SERVER_H
+
+#include <Protocol.h>
+#include <ResultCache.h>
+#include <memory>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <list>
+#include <thread>
+#include <cstdint>
+#include <sys/types.h>
+
+class Curve;
+class SkyModel;
+class InstrumentModel;
+
+//
+// Encoded result, as kept in the result cache. The shared-memory copy is
+// made the first time a client asks for it, and then handed to every
+// client asking for the same result.
+//
+
+class CachedReply {
+    std::string        m_payload;
+    mutable std::mutex m_mutex;
+    mutable int        m_memfd = -1;
+
+  public:
+    CachedReply() = default;
+    ~CachedReply();
+
+    CachedReply(CachedReply const &) = delete;
+    CachedReply &operator=(CachedReply const &) = delete;
+
+    std::string &payload();
+    std::string const &payload() const;
+
+    // Sealed read-only memfd holding the payload. Throws on errors.
+    int memfd() const;
+};
+
+//
+// Simulation server. Listens on a Unix-domain socket and serves each
+// connection in its own thread. When the server stops, open connections
+// are shut down and their threads joined before run() returns. Models are
+// loaded upfront and kept loaded. In this mode data files are watched: when
+// they change, the models are reloaded (see ModelRegistry) and the cached
+// results dropped. Replies are memoized in an LRU cache shared by
+// all connections. Simulations run on the library-wide job scheduler, so
+// at most one per pool thread runs at once, interactive ones first.
+//
+// In prefork mode (runWorkers) connections are served by worker processes
+// instead, one connection at a time each. Workers are forked after every
+// model slice is built, so they share the model pages copy-on-write. Each
+// worker takes its model pointers once, after the fork, and serves all its
+// connections with the same simulation: requests neither look the models
+// up in the registry nor touch their reference counts. The server process
+// supervises the workers and replaces those that die. The result
+// cache is per worker. Data files are not watched in this mode: the models
+// are those loaded at startup, until the server is restarted.
+//
+
+struct ServerConnection {
+  int         fd;     // -1 once closed
+  std::thread thread;
+};
+
+class Server {
+    std::string m_socketPath;
+    int         m_listenFd    = -1;
+    int         m_stopPipe[2] = {-1, -1};
+
+    // Connections served by run(), by connection number
+    std::mutex                              m_connMutex;
+    std::map<uint64_t, ServerConnection>    m_connections;
+    std::list<uint64_t>                     m_finished; // To be joined
+    uint64_t                                m_nextConnection = 0;
+
+    std::shared_ptr<const SkyModel>        m_skyModel;
+    std::shared_ptr<const InstrumentModel> m_tarsisModel;
+    std::shared_ptr<const Curve>           m_cousinsR;
+    std::atomic<unsigned>                  m_modelGeneration;
+    std::mutex                             m_modelMutex;
+
+    ResultCache<CachedReply>               m_cache;
+
+    void refreshModels();
+    void serve(int fd, Simulation &);
+    void serveConnection(uint64_t id, int fd);
+    void reapConnections();
+    void closeConnections();
+    pid_t spawnWorker();
+    void workerMain();
+    void simulate(Simulation &, SimulationRequest const &, std::string &);
+
+  public:
+    Server(std::string const &socketPath, size_t cacheSize = 128);
+    ~Server();
+
+    Server(Server const &) = delete;
+    Server &operator=(Server const &) = delete;
+
+    static std::string defaultSocketPath();
+
+    // Serve one request and fill the reply (result or error)
+    void process(Simulation &, Frame const &request, Frame &reply);
+
+    ResultCacheStats cacheStats();
+
+    void run();
+    void runWorkers(unsigned workers);
+    void stop(); // Async-signal-safe
+};
+
+#endif // _ETC_SERVER_H
@@ -0,0 +1,381 @@
+//
+// Protocol.cpp: ETC server protocol
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include <Protocol.h>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/socket.h>
+
+static inline uint16_t
+getLE16(const uint8_t *p)
+{
+  return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t
+getLE32(const uint8_t *p)
+{
+  return static_cast<uint32_t>(p[0])
+    | (static_cast<uint32_t>(p[1]) << 8)
+    | (static_cast<uint32_t>(p[2]) << 16)
+    | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static inline void
+putLE16(uint8_t *p, uint16_t value)
+{
+  p[0] = value & 0xff;
+  p[1] = value >> 8;
+}
+
+static inline void
+putLE32(uint8_t *p, uint32_t value)
+{
+  for (auto i = 0; i < 4; ++i)
+    p[i] = (value >> (8 * i)) & 0xff;
+}
+
+// Returns false if the stream ended before the first byte
+static bool
+readAll(int fd, void *data, size_t size)
+{
+  auto p = static_cast<uint8_t *>(data);
+  size_t got = 0;
+
+  while (got < size) {
+    ssize_t ret = read(fd, p + got, size - got);
+
+    if (ret == 0) {
+      if (got == 0)
+        return false;
+      throw std::runtime_error("Connection closed in the middle of a frame");
+    }
+
+    if (ret == -1) {
+      if (errno == EINTR)
+        continue;
+      throw std::runtime_error(std::string("Read error: ") + strerror(errno));
+    }
+
+    got += static_cast<size_t>(ret);
+  }
+
+  return true;
+}
+
+static void
+writeAll(int fd, const void *data, size_t size)
+{
+  auto p = static_cast<const uint8_t *>(data);
+  size_t sent = 0;
+
+  while (sent < size) {
+    ssize_t ret = send(fd, p + sent, size - sent, MSG_NOSIGNAL);
+
+    if (ret == -1) {
+      if (errno == EINTR)
+        continue;
+      throw std::runtime_error(std::string("Write error: ") + strerror(errno));
+    }
+
+    sent += static_cast<size_t>(ret);
+  }
+}
+
+// Descriptors travel with the first byte of the frame header
+static bool
+readHeader(int fd, uint8_t *header, int &passedFd)
+{
+  union {
+    struct cmsghdr align;
+    char           buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct iovec iov;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  ssize_t ret;
+
+  passedFd = -1;
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base       = header;
+  iov.iov_len        = ETC_PROTOCOL_HEADER_SIZE;
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  do
+    ret = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+  while (ret == -1 && errno == EINTR);
+
+  if (ret == -1)
+    throw std::runtime_error(std::string("Read error: ") + strerror(errno));
+
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      memcpy(&passedFd, CMSG_DATA(cmsg), sizeof(int));
+
+  if (ret == 0)
+    return false;
+
+  if (static_cast<size_t>(ret) < ETC_PROTOCOL_HEADER_SIZE) {
+    auto got = static_cast<size_t>(ret);
+
+    try {
+      if (!readAll(fd, header + got, ETC_PROTOCOL_HEADER_SIZE - got))
+        throw std::runtime_error("Connection closed in the middle of a frame");
+    } catch (...) {
+      if (passedFd != -1)
+        close(passedFd);
+      throw;
+    }
+  }
+
+  return true;
+}
+
+static void
+readPayload(int fd, const uint8_t *header, Frame &frame)
+{
+  uint32_t length;
+
+  if (getLE32(header) != ETC_PROTOCOL_MAGIC)
+    throw std::runtime_error("Bad frame magic");
+
+  if (getLE16(header + 4) != ETC_PROTOCOL_VERSION)
+    throw std::runtime_error("Unsupported protocol version");
+
+  frame.type = getLE16(header + 6);
+  frame.id   = getLE32(header + 8);
+  length     = getLE32(header + 12);
+
+  if (length > ETC_PROTOCOL_MAX_PAYLOAD)
+    throw std::runtime_error("Frame too big");
+
+  frame.payload.resize(length);
+
+  if (length > 0 && !readAll(fd, &frame.payload[0], length))
+    throw std::runtime_error("Connection closed in the middle of a frame");
+}
+
+bool
+readFrame(int fd, Frame &frame)
+{
+  uint8_t header[ETC_PROTOCOL_HEADER_SIZE];
+
+  if (!readHeader(fd, header, frame.fd))
+    return false;
+
+  try {
+    readPayload(fd, header, frame);
+  } catch (...) {
+    if (frame.fd != -1) {
+      close(frame.fd);
+      frame.fd = -1;
+    }
+    throw;
+  }
+
+  return true;
+}
+
+void
+writeFrame(int fd, Frame const &frame)
+{
+  uint8_t header[ETC_PROTOCOL_HEADER_SIZE];
+
+  putLE32(header,      ETC_PROTOCOL_MAGIC);
+  putLE16(header + 4,  ETC_PROTOCOL_VERSION);
+  putLE16(header + 6,  frame.type);
+  putLE32(header + 8,  frame.id);
+  putLE32(header + 12, static_cast<uint32_t>(frame.payload.size()));
+
+  if (frame.fd != -1) {
+    union {
+      struct cmsghdr align;
+      char           buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    ssize_t ret;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    iov.iov_base       = header;
+    iov.iov_len        = sizeof(header);
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    cmsg             = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &frame.fd, sizeof(int));
+
+    do
+      ret = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    while (ret == -1 && errno == EINTR);
+
+    if (ret == -1)
+      throw std::runtime_error(std::string("Write error: ") + strerror(errno));
+
+    writeAll(fd, header + ret, sizeof(header) - static_cast<size_t>(ret));
+  } else {
+    writeAll(fd, header, sizeof(header));
+  }
+
+  writeAll(fd, frame.payload.data(), frame.payload.size());
+}
+
+static bool
+parseDouble(std::string const &value, double &result)
+{
+  char *end;
+
+  result = strtod(value.c_str(), &end);
+
+  return !value.empty() && *end == '\0';
+}
+
+bool
+parseSimulationRequest(
+  std::string const &payload,
+  SimulationRequest &request,
+  std::string &error)
+{
+  size_t p = 0;
+  auto &params = request.params;
+
+  while (p < payload.size()) {
+    size_t eol = payload.find('\n', p);
+    std::string line, key, value;
+
+    if (eol == std::string::npos)
+      eol = payload.size();
+
+    line = payload.substr(p, eol - p);
+    p    = eol + 1;
+
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+
+    // End of parameters. The rest is the spectrum.
+    if (line.empty()) {
+      if (p < payload.size())
+        request.spectrumData = payload.substr(p);
+      break;
+    }
+
+    auto eq = line.find('=');
+    if (eq == std::string::npos) {
+      error = "Malformed parameter line `" + line + "'";
+      return false;
+    }
+
+    key   = line.substr(0, eq);
+    value = line.substr(eq + 1);
+
+    if (key == "spectrum") {
+      request.spectrumPath = value;
+    } else if (key == "airmass") {
+      if (!parseDouble(value, params.airmass) || params.airmass < 1) {
+        error = "Invalid airmass `" + value + "'";
+        return false;
+      }
+    } else if (key == "moon") {
+      if (!parseDouble(value, params.moon)
+          || params.moon < 0 || params.moon > 100) {
+        error = "Invalid moon illumination `" + value + "'";
+        return false;
+      }
+    } else if (key == "exposure") {
+      if (!parseDouble(value, params.exposure) || params.exposure < 0) {
+        error = "Invalid exposure time `" + value + "'";
+        return false;
+      }
+    } else if (key == "magnitude") {
+      if (!parseDouble(value, params.rABmag)) {
+        error = "Invalid r(AB) magnitude `" + value + "'";
+        return false;
+      }
+    } else if (key == "slice") {
+      int slice;
+
+      // Slices are numbered from 1 on the wire, from 0 in the library
+      if (sscanf(value.c_str(), "%d", &slice) < 1
+          || slice < 1 || slice > TARSIS_SLICES) {
+        error = "Invalid slice `" + value + "'";
+        return false;
+      }
+
+      params.slice = slice - 1;
+    } else if (key == "blueDetector") {
+      params.blueDetector = value;
+    } else if (key == "redDetector") {
+      params.redDetector = value;
+    } else if (key == "binning") {
+      if (sscanf(
+            value.c_str(),
+            "%ux%u",
+            &params.binning.spectral,
+            &params.binning.spatial) < 2
+          || !params.binning.isValid()) {
+        error = "Invalid binning mode `" + value + "'";
+        return false;
+      }
+    } else if (key == "allDetectors") {
+      request.allDetectors = value == "1" || value == "true";
+    } else if (key == "transport") {
+      if (value == "inline") {
+        request.sharedMemory = false;
+      } else if (value == "shm") {
+        request.sharedMemory = true;
+      } else {
+        error = "Invalid transport `" + value + "'";
+        return false;
+      }
+    } else if (key == "priority") {
+      if (value == "interactive") {
+        request.priority = InteractiveJob;
+      } else if (value == "bulk") {
+        request.priority = BulkJob;
+      } else {
+        error = "Invalid priority `" + value + "'";
+        return false;
+      }
+    } else {
+      error = "Unknown parameter `" + key + "'";
+      return false;
+    }
+  }
+
+  if (request.spectrumPath.empty() && request.spectrumData.empty()) {
+    error = "No spectrum given";
+    return false;
+  }
+
+  return true;
+}
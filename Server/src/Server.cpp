@@ -0,0 +1,714 @@
+//
+// Server.cpp: ETC server
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include <Server.h>
+#include <ModelRegistry.h>
+#include <CsvReader.h>
+#include <DataWriter.h>
+#include <InstrumentModel.h>
+#include <ThreadPool.h>
+#include <stdexcept>
+#include <thread>
+#include <chrono>
+#include <map>
+#include <system_error>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+CachedReply::~CachedReply()
+{
+  if (m_memfd != -1)
+    close(m_memfd);
+}
+
+std::string &
+CachedReply::payload()
+{
+  return m_payload;
+}
+
+std::string const &
+CachedReply::payload() const
+{
+  return m_payload;
+}
+
+int
+CachedReply::memfd() const
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  size_t written = 0;
+  int fd;
+
+  if (m_memfd != -1)
+    return m_memfd;
+
+  fd = memfd_create("tarsis-etc-result", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd == -1)
+    throw std::runtime_error(
+      std::string("Cannot create shared memory: ") + strerror(errno));
+
+  while (written < m_payload.size()) {
+    ssize_t ret = write(
+      fd,
+      m_payload.data() + written,
+      m_payload.size() - written);
+
+    if (ret == -1) {
+      int err = errno;
+
+      if (err == EINTR)
+        continue;
+
+      close(fd);
+      throw std::runtime_error(
+        std::string("Cannot write to shared memory: ") + strerror(err));
+    }
+
+    written += static_cast<size_t>(ret);
+  }
+
+  // Clients cannot change what other clients see
+  if (fcntl(
+        fd,
+        F_ADD_SEALS,
+        F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1) {
+    int err = errno;
+    close(fd);
+    throw std::runtime_error(
+      std::string("Cannot seal shared memory: ") + strerror(err));
+  }
+
+  m_memfd = fd;
+
+  return m_memfd;
+}
+
+Server::Server(std::string const &socketPath, size_t cacheSize)
+  : m_modelGeneration(0), m_cache(cacheSize)
+{
+  struct sockaddr_un addr;
+  auto registry = ModelRegistry::instance();
+
+  m_socketPath = socketPath;
+
+  if (socketPath.size() >= sizeof(addr.sun_path))
+    throw std::runtime_error("Socket path `" + socketPath + "' is too long");
+
+  // Warm up. The generation is read first: changes made while loading
+  // are picked up by the first request.
+  m_modelGeneration = registry->generation();
+
+  m_skyModel    = registry->skyModel();
+  m_tarsisModel = registry->instrumentModel();
+  m_cousinsR    = registry->cousinsRFilter();
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+  if ((m_listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+    throw std::runtime_error(
+      std::string("Cannot create socket: ") + strerror(errno));
+
+  // A socket nobody is listening on is a leftover of a previous server
+  if (connect(
+        m_listenFd,
+        reinterpret_cast<struct sockaddr *>(&addr),
+        sizeof(addr)) == 0) {
+    close(m_listenFd);
+    throw std::runtime_error(
+      "Another server is listening on `" + socketPath + "'");
+  } else if (errno == ECONNREFUSED) {
+    unlink(socketPath.c_str());
+  }
+
+  close(m_listenFd);
+
+  if ((m_listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+    throw std::runtime_error(
+      std::string("Cannot create socket: ") + strerror(errno));
+
+  // The socket is created with our permissions only: with the process
+  // umask, other local users could connect before a chmod()
+  mode_t oldMask = umask(0077);
+  int ret = bind(
+    m_listenFd,
+    reinterpret_cast<struct sockaddr *>(&addr),
+    sizeof(addr));
+  int err = errno;
+  umask(oldMask);
+
+  if (ret == -1) {
+    close(m_listenFd);
+    throw std::runtime_error(
+      "Cannot bind to `" + socketPath + "': " + strerror(err));
+  }
+
+  if (chmod(socketPath.c_str(), 0600) == -1) {
+    err = errno;
+    close(m_listenFd);
+    unlink(socketPath.c_str());
+    throw std::runtime_error(
+      "Cannot set the permissions of `" + socketPath + "': " + strerror(err));
+  }
+
+  if (listen(m_listenFd, SOMAXCONN) == -1 || pipe(m_stopPipe) == -1) {
+    err = errno;
+    close(m_listenFd);
+    unlink(socketPath.c_str());
+    throw std::runtime_error(
+      "Cannot listen on `" + socketPath + "': " + strerror(err));
+  }
+}
+
+Server::~Server()
+{
+  closeConnections();
+
+  if (m_listenFd != -1) {
+    close(m_listenFd);
+    unlink(m_socketPath.c_str());
+  }
+
+  for (auto fd : m_stopPipe)
+    if (fd != -1)
+      close(fd);
+}
+
+std::string
+Server::defaultSocketPath()
+{
+  const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+
+  if (runtimeDir != nullptr && *runtimeDir != '\0')
+    return std::string(runtimeDir) + "/tarsis-etc.sock";
+
+  return "/tmp/tarsis-etc-" + std::to_string(getuid()) + ".sock";
+}
+
+static const char *
+armName(InstrumentArm arm)
+{
+  return arm == BlueArm ? "blue" : "red";
+}
+
+static void
+addProduct(
+  SimulationParams const &params,
+  InstrumentArm arm,
+  ArmResult const &result,
+  std::vector<std::pair<std::string, ArmResult>> &products)
+{
+  std::string name = std::string(armName(arm)) + ":" + result.detector;
+
+  if (params.binning.spectral != 1 || params.binning.spatial != 1)
+    products.push_back(std::make_pair(name, result.binned(params.binning)));
+  else
+    products.push_back(std::make_pair(name, result));
+}
+
+void
+Server::simulate(
+  Simulation &sim,
+  SimulationRequest const &req,
+  std::string &payload)
+{
+  std::vector<std::pair<std::string, ArmResult>> products;
+  Spectrum input;
+  CsvReader csv(
+    req.spectrumData.data(),
+    req.spectrumData.size(),
+    req.spectrumPath.empty() ? "<inline spectrum>" : req.spectrumPath);
+
+  input.load(csv);
+
+  input.scaleAxis(XAxis, 1e-9);
+
+  sim.setInput(input);
+  sim.normalizeToRMag(req.params.rABmag);
+  sim.setParams(req.params);
+
+  for (auto arm : {BlueArm, RedArm}) {
+    if (req.allDetectors) {
+      for (auto const &p : sim.simulateAllDetectors(arm))
+        addProduct(req.params, arm, p.second, products);
+    } else {
+      sim.simulateArm(arm);
+      addProduct(req.params, arm, sim.result(arm), products);
+    }
+  }
+
+  // E.g. allDetectors with no detector supporting either arm
+  if (products.empty())
+    throw std::runtime_error("No detector to simulate with these parameters");
+
+  DataWriter out(&payload);
+  TableWriter table(
+    out,
+    BinaryFormat,
+    3 * products.size(),
+    products[0].second.wavelength.size());
+
+  for (auto const &p : products) {
+    table.writeRow(p.second.wavelength, p.first + ":wavelength");
+    table.writeRow(p.second.signal,     p.first + ":signal");
+    table.writeRow(p.second.noise,      p.first + ":noise");
+  }
+
+  out.close();
+}
+
+//
+// The models are kept loaded between requests. After a data file change,
+// the replaced models are released and the current ones loaded instead.
+// Cached results are dropped as well: they would never be hit again, as
+// the registry generation is part of their keys.
+//
+void
+Server::refreshModels()
+{
+  auto registry = ModelRegistry::instance();
+
+  if (registry->generation() == m_modelGeneration)
+    return;
+
+  std::lock_guard<std::mutex> guard(m_modelMutex);
+  unsigned generation = registry->generation();
+
+  if (generation == m_modelGeneration)
+    return;
+
+  m_skyModel    = registry->skyModel();
+  m_tarsisModel = registry->instrumentModel();
+  m_cousinsR    = registry->cousinsRFilter();
+
+  m_cache.clear();
+  m_modelGeneration = generation;
+}
+
+void
+Server::process(Simulation &sim, Frame const &request, Frame &reply)
+{
+  SimulationRequest req;
+  std::string error;
+
+  reply.id   = request.id;
+  reply.type = MSG_ERROR;
+  reply.payload.clear();
+  reply.fd = -1;
+
+  if (request.type == MSG_STATS) {
+    auto stats = cacheStats();
+
+    reply.type    = MSG_STATS;
+    reply.payload =
+        "hits="        + std::to_string(stats.hits)      + "\n"
+      + "misses="      + std::to_string(stats.misses)    + "\n"
+      + "coalesced="   + std::to_string(stats.coalesced) + "\n"
+      + "evictions="   + std::to_string(stats.evictions) + "\n"
+      + "entries="     + std::to_string(stats.entries)   + "\n"
+      + "capacity="    + std::to_string(stats.capacity)  + "\n";
+    return;
+  }
+
+  if (request.type != MSG_SIMULATE) {
+    reply.payload = "Unsupported request type " + std::to_string(request.type);
+    return;
+  }
+
+  if (!parseSimulationRequest(request.payload, req, error)) {
+    reply.payload = error;
+    return;
+  }
+
+  try {
+    refreshModels();
+
+    // The key covers the spectrum contents, not its path
+    if (!req.spectrumPath.empty())
+      req.spectrumData = fileContents(req.spectrumPath);
+
+    auto key    = simulationKey(
+      req.params,
+      req.allDetectors ? "all" : "",
+      req.spectrumData);
+    auto result = m_cache.get(key, [&] () {
+      auto cached = new CachedReply();
+
+      // We are not a pool thread: just wait. A full queue blocks us, and
+      // so the client.
+      try {
+        JobScheduler::instance()->submit(
+          req.priority,
+          [&] () { simulate(sim, req, cached->payload()); }).get();
+      } catch (...) {
+        delete cached;
+        throw;
+      }
+
+      return cached;
+    });
+
+    if (req.sharedMemory) {
+      uint64_t size = result->payload().size();
+
+      // The cache may drop the result before the reply is sent
+      if ((reply.fd = dup(result->memfd())) == -1)
+        throw std::runtime_error(
+          std::string("Cannot duplicate descriptor: ") + strerror(errno));
+
+      reply.payload.resize(sizeof(uint64_t));
+      for (auto i = 0u; i < sizeof(uint64_t); ++i)
+        reply.payload[i] = static_cast<char>((size >> (8 * i)) & 0xff);
+
+      reply.type = MSG_RESULT_SHM;
+    } else {
+      reply.payload = result->payload();
+      reply.type    = MSG_RESULT;
+    }
+  } catch (std::runtime_error const &e) {
+    reply.payload = e.what();
+  }
+}
+
+ResultCacheStats
+Server::cacheStats()
+{
+  return m_cache.stats();
+}
+
+void
+Server::serve(int fd, Simulation &sim)
+{
+  Frame request, reply;
+
+  try {
+    while (readFrame(fd, request)) {
+      // Clients have no business passing us descriptors
+      if (request.fd != -1) {
+        close(request.fd);
+        request.fd = -1;
+      }
+
+      process(sim, request, reply);
+
+      try {
+        writeFrame(fd, reply);
+      } catch (...) {
+        if (reply.fd != -1)
+          close(reply.fd);
+        throw;
+      }
+
+      if (reply.fd != -1) {
+        close(reply.fd);
+        reply.fd = -1;
+      }
+    }
+  } catch (std::runtime_error const &e) {
+    fprintf(stderr, "connection closed: %s\n", e.what());
+  }
+}
+
+// Connection thread of run(). The descriptor is closed under the lock, so
+// that closeConnections() never shuts down a descriptor reused meanwhile.
+void
+Server::serveConnection(uint64_t id, int fd)
+{
+  try {
+    Simulation sim;
+
+    serve(fd, sim);
+  } catch (std::runtime_error const &e) {
+    fprintf(stderr, "connection closed: %s\n", e.what());
+  }
+
+  std::lock_guard<std::mutex> guard(m_connMutex);
+  auto it = m_connections.find(id);
+
+  close(fd);
+
+  if (it != m_connections.end()) {
+    it->second.fd = -1;
+    m_finished.push_back(id);
+  }
+}
+
+// Join the threads of the connections that are over
+void
+Server::reapConnections()
+{
+  std::list<std::thread> threads;
+
+  {
+    std::lock_guard<std::mutex> guard(m_connMutex);
+
+    for (auto id : m_finished) {
+      auto it = m_connections.find(id);
+
+      if (it != m_connections.end()) {
+        threads.push_back(std::move(it->second.thread));
+        m_connections.erase(it);
+      }
+    }
+
+    m_finished.clear();
+  }
+
+  for (auto &t : threads)
+    t.join();
+}
+
+// Wake up every connection thread and wait for all of them
+void
+Server::closeConnections()
+{
+  std::list<std::thread> threads;
+
+  {
+    std::lock_guard<std::mutex> guard(m_connMutex);
+
+    for (auto &c : m_connections) {
+      if (c.second.fd != -1)
+        shutdown(c.second.fd, SHUT_RDWR);
+      threads.push_back(std::move(c.second.thread));
+    }
+
+    m_connections.clear();
+    m_finished.clear();
+  }
+
+  for (auto &t : threads)
+    t.join();
+}
+
+void
+Server::run()
+{
+  struct pollfd fds[2];
+
+  fds[0].fd     = m_listenFd;
+  fds[0].events = POLLIN;
+  fds[1].fd     = m_stopPipe[0];
+  fds[1].events = POLLIN;
+
+  // Calibration updates are picked up without restarting
+  if (!ModelRegistry::instance()->watchDataFiles())
+    fprintf(stderr, "warning: data files cannot be watched for changes\n");
+
+  for (;;) {
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      int err = errno;
+      closeConnections();
+      throw std::runtime_error(std::string("poll failed: ") + strerror(err));
+    }
+
+    if (fds[1].revents != 0)
+      break;
+
+    if (fds[0].revents & POLLIN) {
+      int fd;
+
+      reapConnections();
+
+      if ((fd = accept4(m_listenFd, nullptr, nullptr, SOCK_CLOEXEC)) == -1) {
+        if (errno != EINTR && errno != EAGAIN && errno != ECONNABORTED)
+          fprintf(stderr, "warning: accept failed: %s\n", strerror(errno));
+        continue;
+      }
+
+      std::lock_guard<std::mutex> guard(m_connMutex);
+      auto id = m_nextConnection++;
+      auto &conn = m_connections[id];
+
+      conn.fd = fd;
+
+      try {
+        conn.thread = std::thread(&Server::serveConnection, this, id, fd);
+      } catch (std::system_error const &e) {
+        fprintf(stderr, "warning: cannot serve connection: %s\n", e.what());
+        m_connections.erase(id);
+        close(fd);
+      }
+    }
+  }
+
+  closeConnections();
+}
+
+void
+Server::workerMain()
+{
+  pid_t supervisor = getppid();
+  sigset_t signals;
+
+  // Interrupts are for the supervisor, which terminates us. The supervisor
+  // blocks both signals, so they must be unblocked here.
+  signal(SIGINT,  SIG_IGN);
+  signal(SIGTERM, SIG_DFL);
+
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_UNBLOCK, &signals, nullptr);
+
+  if (prctl(PR_SET_PDEATHSIG, SIGTERM) == -1 || getppid() != supervisor)
+    return;
+
+  // One connection at a time: a single pool thread is enough
+  ThreadPool::restartAfterFork(1);
+
+  // Model pointers are taken once, here, and the simulation reused for
+  // every connection. Per-connection simulations would look the models up
+  // in the registry and copy their shared_ptrs, writing to the registry
+  // and control block pages we share with the other workers.
+  Simulation sim;
+
+  for (;;) {
+    int fd = accept4(m_listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+
+    if (fd == -1) {
+      if (errno == EINTR || errno == EAGAIN || errno == ECONNABORTED)
+        continue;
+      fprintf(stderr, "worker %d: accept failed: %s\n", getpid(), strerror(errno));
+      return;
+    }
+
+    serve(fd, sim);
+    close(fd);
+  }
+}
+
+pid_t
+Server::spawnWorker()
+{
+  pid_t pid;
+
+  fflush(stdout);
+  fflush(stderr);
+
+  if ((pid = fork()) == -1)
+    throw std::runtime_error(
+      std::string("Cannot fork worker: ") + strerror(errno));
+
+  if (pid == 0) {
+    try {
+      workerMain();
+    } catch (std::exception const &e) {
+      fprintf(stderr, "worker %d: %s\n", getpid(), e.what());
+    }
+
+    _exit(EXIT_FAILURE);
+  }
+
+  return pid;
+}
+
+void
+Server::runWorkers(unsigned count)
+{
+  typedef std::chrono::steady_clock Clock;
+  std::map<pid_t, Clock::time_point> workers;
+  struct pollfd fd;
+  unsigned missing = 0;
+  bool backOff = false;
+
+  // Nothing in the model may be written after the fork: build it all now
+  m_tarsisModel->loadAllSlices();
+  {
+    Simulation warmUp;
+  }
+
+  for (auto i = 0u; i < count; ++i)
+    workers[spawnWorker()] = Clock::now();
+
+  fd.fd     = m_stopPipe[0];
+  fd.events = POLLIN;
+
+  for (;;) {
+    pid_t pid;
+    int status;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+      auto it = workers.find(pid);
+
+      if (it == workers.end())
+        continue;
+
+      if (WIFSIGNALED(status))
+        fprintf(
+          stderr,
+          "warning: worker %d killed by signal %d, restarting it\n",
+          pid,
+          WTERMSIG(status));
+      else
+        fprintf(
+          stderr,
+          "warning: worker %d exited with status %d, restarting it\n",
+          pid,
+          WEXITSTATUS(status));
+
+      // Workers dying right away will die again. Do not spin.
+      if (Clock::now() - it->second < std::chrono::seconds(1))
+        backOff = true;
+
+      workers.erase(it);
+      ++missing;
+    }
+
+    if (!backOff) {
+      for (; missing > 0; --missing)
+        workers[spawnWorker()] = Clock::now();
+    }
+
+    if (poll(&fd, 1, backOff ? 1000 : 200) > 0)
+      break;
+
+    backOff = false;
+  }
+
+  for (auto const &w : workers)
+    kill(w.first, SIGTERM);
+
+  for (auto const &w : workers)
+    waitpid(w.first, nullptr, 0);
+}
+
+void
+Server::stop()
+{
+  if (write(m_stopPipe[1], "", 1) == -1) {
+    // Nothing we can do from a signal handler
+  }
+}
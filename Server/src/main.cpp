@@ -0,0 +1,162 @@
+#include <cstdio>
+#include <cstdlib>
+#include <csignal>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <getopt.h>
+#include <pthread.h>
+#include <DataFileManager.h>
+#include <Server.h>
+
+static Server    *g_server = nullptr; // Guarded by g_serverMutex
+static std::mutex g_serverMutex;
+static bool       g_started = false;
+
+void
+help(const char *progName)
+{
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr, "\t%s [OPTIONS]\n\n", progName);
+  fprintf(stderr, "Runs the TARSIS exposure time calculator as a server. Clients\n");
+  fprintf(stderr, "connect to a Unix-domain socket and send simulation requests\n");
+  fprintf(stderr, "(see Protocol.h). Models are loaded at startup, and reloaded when\n");
+  fprintf(stderr, "their data files change (except with -w).\n\n");
+  fprintf(stderr, "OPTIONS can be any of the following:\n");
+  fprintf(stderr, "\t-d, --data-dir [DIR]       Add DIR to the data search paths\n");
+  fprintf(stderr, "\t-s, --socket [PATH]        Listen on PATH (default is\n");
+  fprintf(stderr, "\t                           %s)\n", Server::defaultSocketPath().c_str());
+  fprintf(stderr, "\t-c, --cache [N]            Keep up to N results in memory (default\n");
+  fprintf(stderr, "\t                           128, 0 disables the cache)\n");
+  fprintf(stderr, "\t-w, --workers [N]          Serve connections from N worker processes\n");
+  fprintf(stderr, "\t                           sharing the models, instead of threads\n\n");
+  fprintf(stderr, "\t--help                     This help\n");
+}
+
+//
+// SIGINT and SIGTERM are blocked in every thread and taken by this one, so
+// stopping the server cannot race with its deletion. Before the server is
+// up, they terminate the program as usual.
+//
+static void
+signalThread(sigset_t signals)
+{
+  int sig;
+
+  for (;;) {
+    if (sigwait(&signals, &sig) != 0)
+      continue;
+
+    std::lock_guard<std::mutex> guard(g_serverMutex);
+
+    if (g_server != nullptr)
+      g_server->stop();
+    else if (!g_started)
+      _exit(EXIT_FAILURE);
+  }
+}
+
+int
+main(int argc, char **argv)
+{
+  std::string socketPath = Server::defaultSocketPath();
+  long cacheSize = 128;
+  long workers = 0;
+  char *end;
+  const char* const short_opt = "d:s:c:w:h";
+  int opt;
+  const option long_opt[] = {
+    {"data-dir", required_argument, nullptr, 'd'},
+    {"socket",   required_argument, nullptr, 's'},
+    {"cache",    required_argument, nullptr, 'c'},
+    {"workers",  required_argument, nullptr, 'w'},
+    {"help",     no_argument,       nullptr, 'h'},
+    {nullptr,    no_argument,       nullptr, 0}
+  };
+
+  while ((opt = getopt_long(argc, argv, short_opt, long_opt, nullptr)) != -1) {
+    switch (opt) {
+      case 'd':
+        if (!DataFileManager::instance()->addSearchPath(optarg))
+          goto bad_option;
+        break;
+
+      case 's':
+        socketPath = optarg;
+        break;
+
+      case 'c':
+        cacheSize = strtol(optarg, &end, 10);
+        if (*end != '\0' || cacheSize < 0) {
+          fprintf(stderr, "%s: invalid cache size `%s'\n", argv[0], optarg);
+          goto bad_option;
+        }
+        break;
+
+      case 'w':
+        workers = strtol(optarg, &end, 10);
+        if (*end != '\0' || workers < 0) {
+          fprintf(stderr, "%s: invalid number of workers `%s'\n", argv[0], optarg);
+          goto bad_option;
+        }
+        break;
+
+      case 'h':
+        help(argv[0]);
+        exit(EXIT_SUCCESS);
+
+      case '?':
+        help(argv[0]);
+        goto bad_option;
+    }
+  }
+
+  if (optind < argc) {
+    fprintf(stderr, "%s: unexpected arguments\n", argv[0]);
+    goto bad_option;
+  }
+
+  try {
+    sigset_t signals;
+    Server *server;
+
+    // Before any thread is created, so that all of them inherit the mask
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::thread(signalThread, signals).detach();
+
+    server = new Server(socketPath, static_cast<size_t>(cacheSize));
+
+    {
+      std::lock_guard<std::mutex> guard(g_serverMutex);
+      g_server  = server;
+      g_started = true;
+    }
+
+    fprintf(stderr, "%s: listening on %s\n", argv[0], socketPath.c_str());
+
+    if (workers > 0)
+      g_server->runWorkers(static_cast<unsigned>(workers));
+    else
+      g_server->run();
+  } catch (std::runtime_error const &e) {
+    fprintf(stderr, "%s: %s\n", argv[0], e.what());
+    exit(EXIT_FAILURE);
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(g_serverMutex);
+    delete g_server;
+    g_server = nullptr;
+  }
+
+  exit(EXIT_SUCCESS);
+
+bad_option:
+  fprintf(stderr, "Type `%s --help` for help\n", argv[0]);
+  exit(EXIT_FAILURE);
+}
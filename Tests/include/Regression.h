@@ -0,0 +1,119 @@
+//
+// Regression.h: End-to-end regression scenarios
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#ifndef _TESTS_REGRESSION_H
+#define _TESTS_REGRESSION_H
+
+#include <Simulation.h>
+#include <string>
+#include <vector>
+#include <map>
+
+class Spectrum;
+
+//
+// A scenario simulates one input spectrum in every slice of both arms.
+// Inputs are synthesized, so that the scenarios do not depend on files
+// other than the reference data.
+//
+
+struct Scenario {
+  const char      *name;
+  const char      *description;
+  SimulationParams params;
+
+  Spectrum *(*makeInput)();
+};
+
+struct ScenarioOutput {
+  InstrumentArm       arm;
+  unsigned            slice;
+  std::vector<double> signal; // c
+  std::vector<double> noise;  // c
+};
+
+struct ScenarioRun {
+  std::vector<ScenarioOutput> outputs;
+  size_t                      points   = 0; // Input points
+  double                      wallTime = 0; // s, best simulation pass
+  unsigned                    threads  = 0;
+
+  // Input points simulated per second, over all arms and slices
+  double pointsPerSecond() const;
+};
+
+std::vector<Scenario> const &regressionScenarios();
+ScenarioRun runScenario(Scenario const &, double minTime = 1);
+
+//
+// Golden outputs keep the sum and RMS of the signal and noise arrays of
+// every arm and slice, along with a regular subsample of their pixels.
+// This is enough to catch changes anywhere in the arrays, while keeping
+// the files small.
+//
+
+#define GOLDEN_SAMPLE_STEP 128
+
+struct GoldenArray {
+  double              sum = 0;
+  double              rms = 0;
+  std::vector<double> samples;
+
+  static GoldenArray summarize(std::vector<double> const &);
+};
+
+struct GoldenOutput {
+  InstrumentArm arm;
+  unsigned      slice;
+  GoldenArray   signal;
+  GoldenArray   noise;
+};
+
+typedef std::vector<GoldenOutput> GoldenOutputs;
+
+GoldenOutputs summarize(ScenarioRun const &);
+GoldenOutputs loadGolden(std::string const &path);
+void saveGolden(
+  std::string const &path,
+  Scenario const &,
+  GoldenOutputs const &);
+
+// Returns the mismatches, as human-readable messages
+std::vector<std::string> compareGolden(
+  GoldenOutputs const &expected,
+  GoldenOutputs const &actual,
+  double tolerance);
+
+//
+// Throughput baselines are machine-dependent. They are kept apart from
+// the golden outputs, and record the number of threads they were
+// measured with.
+//
+
+struct ThroughputBaseline {
+  double   pointsPerSecond = 0;
+  unsigned threads         = 0;
+};
+
+typedef std::map<std::string, ThroughputBaseline> ThroughputBaselines;
+
+ThroughputBaselines loadBaselines(std::string const &path);
+void saveBaselines(std::string const &path, ThroughputBaselines const &);
+
+#endif // _TESTS_REGRESSION_H
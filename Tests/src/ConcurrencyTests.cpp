@@ -0,0 +1,101 @@
+//
+// ConcurrencyTests.cpp: Tests of concurrent use of the shared models
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <stdexcept>
+#include <csignal>
+#include <unistd.h>
+#include <DataFileManager.h>
+#include <Simulation.h>
+
+#define CONCURRENCY_THREADS 4
+#define CONCURRENCY_ROUNDS  3
+#define CONCURRENCY_TIMEOUT 120
+
+static void
+onTimeout(int)
+{
+  static const char msg[] = "ConcurrencyTests: timed out (deadlock?)\n";
+
+  if (write(STDERR_FILENO, msg, sizeof(msg) - 1) == -1)
+    _exit(EXIT_FAILURE);
+
+  _exit(EXIT_FAILURE);
+}
+
+//
+// Simulations created from several threads at once, with no models loaded
+// yet. Models are released along with the last simulation using them, so
+// every round starts from a cold registry.
+//
+static bool
+coldConstruction()
+{
+  for (auto round = 0; round < CONCURRENCY_ROUNDS; ++round) {
+    std::vector<std::thread> threads;
+    std::vector<bool> ok(CONCURRENCY_THREADS, false);
+
+    for (auto i = 0; i < CONCURRENCY_THREADS; ++i)
+      threads.push_back(std::thread([&ok, i] () {
+        try {
+          Simulation sim;
+          SimulationParams params;
+
+          params.slice = i;
+          sim.setParams(params);
+          ok[i] = true;
+        } catch (std::runtime_error const &e) {
+          fprintf(stderr, "ConcurrencyTests: thread %d: %s\n", i, e.what());
+        }
+      }));
+
+    for (auto &t : threads)
+      t.join();
+
+    for (auto i = 0; i < CONCURRENCY_THREADS; ++i)
+      if (!ok[i])
+        return false;
+  }
+
+  return true;
+}
+
+int
+main(int argc, char **argv)
+{
+  // Data directories, if any, are passed as arguments
+  for (auto i = 1; i < argc; ++i)
+    if (!DataFileManager::instance()->addSearchPath(argv[i]))
+      exit(EXIT_FAILURE);
+
+  signal(SIGALRM, onTimeout);
+  alarm(CONCURRENCY_TIMEOUT);
+
+  if (!coldConstruction()) {
+    fprintf(stderr, "%s: cold construction: FAILED\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(stderr, "%s: cold construction: OK\n", argv[0]);
+
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,294 @@
+//
+// Regression.cpp: Golden outputs and throughput baselines
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include <Regression.h>
+#include <DataWriter.h>
+#include <yaml-cpp/yaml.h>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+GoldenArray
+GoldenArray::summarize(std::vector<double> const &data)
+{
+  GoldenArray array;
+  double sum2 = 0;
+
+  for (size_t i = 0; i < data.size(); ++i) {
+    array.sum += data[i];
+    sum2      += data[i] * data[i];
+
+    if (i % GOLDEN_SAMPLE_STEP == 0)
+      array.samples.push_back(data[i]);
+  }
+
+  if (!data.empty())
+    array.rms = sqrt(sum2 / data.size());
+
+  return array;
+}
+
+GoldenOutputs
+summarize(ScenarioRun const &run)
+{
+  GoldenOutputs outputs;
+
+  for (auto const &o : run.outputs)
+    outputs.push_back(
+      GoldenOutput {
+        o.arm,
+        o.slice,
+        GoldenArray::summarize(o.signal),
+        GoldenArray::summarize(o.noise)});
+
+  return outputs;
+}
+
+static const char *
+armName(InstrumentArm arm)
+{
+  return arm == BlueArm ? "blue" : "red";
+}
+
+static InstrumentArm
+parseArm(std::string const &name)
+{
+  if (name == "blue")
+    return BlueArm;
+  if (name == "red")
+    return RedArm;
+
+  throw std::runtime_error("Invalid arm `" + name + "'");
+}
+
+static void
+emitArray(YAML::Emitter &out, const char *name, GoldenArray const &array)
+{
+  out << YAML::Key << name << YAML::Value << YAML::BeginMap;
+  out << YAML::Key << "sum" << YAML::Value << array.sum;
+  out << YAML::Key << "rms" << YAML::Value << array.rms;
+  out << YAML::Key << "samples" << YAML::Value << YAML::Flow << array.samples;
+  out << YAML::EndMap;
+}
+
+static GoldenArray
+parseArray(YAML::Node const &node)
+{
+  GoldenArray array;
+
+  array.sum     = node["sum"].as<double>();
+  array.rms     = node["rms"].as<double>();
+  array.samples = node["samples"].as<std::vector<double>>();
+
+  return array;
+}
+
+static void
+writeYaml(std::string const &path, YAML::Emitter const &out)
+{
+  DataWriter writer(path);
+
+  writer.write(out.c_str(), out.size());
+  writer.writeChar('\n');
+  writer.close();
+}
+
+void
+saveGolden(
+  std::string const &path,
+  Scenario const &scenario,
+  GoldenOutputs const &outputs)
+{
+  YAML::Emitter out;
+
+  out.SetDoublePrecision(17);
+
+  out << YAML::BeginMap;
+  out << YAML::Key << "scenario" << YAML::Value << scenario.name;
+  out << YAML::Key << "description" << YAML::Value << scenario.description;
+  out << YAML::Key << "sampleStep" << YAML::Value << GOLDEN_SAMPLE_STEP;
+  out << YAML::Key << "outputs" << YAML::Value << YAML::BeginSeq;
+
+  for (auto const &o : outputs) {
+    out << YAML::BeginMap;
+    out << YAML::Key << "arm" << YAML::Value << armName(o.arm);
+    out << YAML::Key << "slice" << YAML::Value << o.slice;
+    emitArray(out, "signal", o.signal);
+    emitArray(out, "noise", o.noise);
+    out << YAML::EndMap;
+  }
+
+  out << YAML::EndSeq;
+  out << YAML::EndMap;
+
+  writeYaml(path, out);
+}
+
+GoldenOutputs
+loadGolden(std::string const &path)
+{
+  GoldenOutputs outputs;
+
+  try {
+    YAML::Node doc = YAML::LoadFile(path);
+
+    if (doc["sampleStep"].as<unsigned>() != GOLDEN_SAMPLE_STEP)
+      throw std::runtime_error(
+        "Golden outputs in `" + path + "' have a different sample step");
+
+    for (auto const &node : doc["outputs"])
+      outputs.push_back(
+        GoldenOutput {
+          parseArm(node["arm"].as<std::string>()),
+          node["slice"].as<unsigned>(),
+          parseArray(node["signal"]),
+          parseArray(node["noise"])});
+  } catch (YAML::Exception const &e) {
+    throw std::runtime_error(
+      "Cannot read golden outputs from `" + path + "': " + e.what());
+  }
+
+  return outputs;
+}
+
+//
+// Values are compared relative to the expected value, or to the RMS of the
+// array for values close to zero (e.g. pixels outside the spectral range).
+//
+static inline bool
+close(double actual, double expected, double scale, double tolerance)
+{
+  if (std::isnan(actual) || std::isnan(expected))
+    return std::isnan(actual) && std::isnan(expected);
+
+  return fabs(actual - expected)
+    <= tolerance * std::max(fabs(expected), scale);
+}
+
+static void
+compareArray(
+  std::string const &what,
+  GoldenArray const &expected,
+  GoldenArray const &actual,
+  double tolerance,
+  std::vector<std::string> &errors)
+{
+  auto mismatch = [&] (std::string const &value, double a, double e) {
+    char values[64];
+
+    snprintf(values, sizeof(values), "%.17g (expected %.17g)", a, e);
+    errors.push_back(what + " " + value + ": " + values);
+  };
+
+  if (!close(actual.sum, expected.sum, 0, tolerance))
+    mismatch("sum", actual.sum, expected.sum);
+
+  if (!close(actual.rms, expected.rms, 0, tolerance))
+    mismatch("rms", actual.rms, expected.rms);
+
+  if (actual.samples.size() != expected.samples.size()) {
+    errors.push_back(what + ": different number of pixels");
+    return;
+  }
+
+  for (size_t i = 0; i < actual.samples.size(); ++i)
+    if (!close(actual.samples[i], expected.samples[i], expected.rms, tolerance))
+      mismatch(
+        "pixel " + std::to_string(i * GOLDEN_SAMPLE_STEP),
+        actual.samples[i],
+        expected.samples[i]);
+}
+
+std::vector<std::string>
+compareGolden(
+  GoldenOutputs const &expected,
+  GoldenOutputs const &actual,
+  double tolerance)
+{
+  std::vector<std::string> errors;
+
+  if (actual.size() != expected.size()) {
+    errors.push_back(
+      "got " + std::to_string(actual.size()) + " outputs, expected "
+      + std::to_string(expected.size()));
+    return errors;
+  }
+
+  for (size_t i = 0; i < actual.size(); ++i) {
+    auto const &a = actual[i];
+    auto const &e = expected[i];
+    std::string where =
+      std::string(armName(e.arm)) + " arm, slice " + std::to_string(e.slice);
+
+    if (a.arm != e.arm || a.slice != e.slice) {
+      errors.push_back(where + ": outputs are out of order");
+      continue;
+    }
+
+    compareArray(where + ", signal", e.signal, a.signal, tolerance, errors);
+    compareArray(where + ", noise", e.noise, a.noise, tolerance, errors);
+  }
+
+  return errors;
+}
+
+ThroughputBaselines
+loadBaselines(std::string const &path)
+{
+  ThroughputBaselines baselines;
+
+  try {
+    YAML::Node doc = YAML::LoadFile(path);
+
+    for (auto const &p : doc) {
+      ThroughputBaseline baseline;
+
+      baseline.pointsPerSecond = p.second["pointsPerSecond"].as<double>();
+      baseline.threads         = p.second["threads"].as<unsigned>();
+
+      baselines[p.first.as<std::string>()] = baseline;
+    }
+  } catch (YAML::Exception const &e) {
+    throw std::runtime_error(
+      "Cannot read throughput baselines from `" + path + "': " + e.what());
+  }
+
+  return baselines;
+}
+
+void
+saveBaselines(std::string const &path, ThroughputBaselines const &baselines)
+{
+  YAML::Emitter out;
+
+  out.SetDoublePrecision(6);
+
+  out << YAML::BeginMap;
+
+  for (auto const &p : baselines) {
+    out << YAML::Key << p.first << YAML::Value << YAML::BeginMap;
+    out << YAML::Key << "pointsPerSecond" << YAML::Value << p.second.pointsPerSecond;
+    out << YAML::Key << "threads" << YAML::Value << p.second.threads;
+    out << YAML::EndMap;
+  }
+
+  out << YAML::EndMap;
+
+  writeYaml(path, out);
+}
@@ -0,0 +1,196 @@
+//
+// ReloadTests.cpp: Tests of model reloads on data file changes
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+#include <csignal>
+#include <unistd.h>
+#include <DataFileManager.h>
+#include <ModelRegistry.h>
+#include <InstrumentModel.h>
+
+#define RELOAD_SLICE    3
+#define RELOAD_TIMEOUT  120
+#define RELOAD_SETTLE   500 // ms without changes
+
+static void
+onTimeout(int)
+{
+  static const char msg[] = "ReloadTests: timed out\n";
+
+  if (write(STDERR_FILENO, msg, sizeof(msg) - 1) == -1)
+    _exit(EXIT_FAILURE);
+
+  _exit(EXIT_FAILURE);
+}
+
+static std::string
+readFile(std::string const &path)
+{
+  std::ifstream ifs(path, std::ios::binary);
+  std::stringstream ss;
+
+  if (!ifs)
+    throw std::runtime_error("Cannot open `" + path + "'");
+
+  ss << ifs.rdbuf();
+
+  return ss.str();
+}
+
+static void
+writeFile(std::string const &path, std::string const &contents)
+{
+  std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+
+  if (!(ofs << contents))
+    throw std::runtime_error("Cannot write `" + path + "'");
+}
+
+// Waits for the registry to see a change, and for changes to settle
+static void
+waitForReload(unsigned generation)
+{
+  auto registry = ModelRegistry::instance();
+
+  while (registry->generation() == generation)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  do {
+    generation = registry->generation();
+    std::this_thread::sleep_for(std::chrono::milliseconds(RELOAD_SETTLE));
+  } while (registry->generation() != generation);
+}
+
+//
+// The blue tables of the data directory are copied to a temporary
+// directory in front of it. A change to one of them must only reload the
+// blue slices of the instrument model: the red ones are shared with the
+// previous model. The previous model must also survive the truncation of
+// the files it was built from.
+//
+static bool
+reloadBlueSlices(std::string const &tmpDir)
+{
+  auto registry = ModelRegistry::instance();
+  auto dispFile = tmpDir + "/dispersionBlue.csv";
+  auto contents = readFile(dispFile);
+  auto generation = registry->generation();
+
+  auto before   = registry->instrumentModel();
+  auto blue     = before->pxToWavelength(BlueArm, RELOAD_SLICE);
+  auto red      = before->pxToWavelength(RedArm, RELOAD_SLICE);
+
+  // Slices not built yet are read from the tables loaded with the model
+  if (truncate(dispFile.c_str(), 0) == -1) {
+    perror("truncate");
+    return false;
+  }
+
+  if (before->pxToWavelength(BlueArm, RELOAD_SLICE + 1) == nullptr)
+    return false;
+
+  writeFile(dispFile, contents);
+  waitForReload(generation);
+
+  auto after = registry->instrumentModel();
+
+  if (after == before) {
+    fprintf(stderr, "ReloadTests: model not reloaded\n");
+    return false;
+  }
+
+  if (after->pxToWavelength(RedArm, RELOAD_SLICE) != red) {
+    fprintf(stderr, "ReloadTests: red slices reloaded\n");
+    return false;
+  }
+
+  if (after->pxToWavelength(BlueArm, RELOAD_SLICE) == blue) {
+    fprintf(stderr, "ReloadTests: blue slices not reloaded\n");
+    return false;
+  }
+
+  // Same data, same curve
+  if (after->pxToWavelength(BlueArm, RELOAD_SLICE, 1000)
+      != before->pxToWavelength(BlueArm, RELOAD_SLICE, 1000)) {
+    fprintf(stderr, "ReloadTests: blue slices differ\n");
+    return false;
+  }
+
+  return true;
+}
+
+int
+main(int argc, char **argv)
+{
+  char tmpl[] = "/tmp/ReloadTests.XXXXXX";
+  std::string tmpDir;
+  bool ok = false;
+
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s DATADIR\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  signal(SIGALRM, onTimeout);
+  alarm(RELOAD_TIMEOUT);
+
+  if (mkdtemp(tmpl) == nullptr) {
+    perror("mkdtemp");
+    exit(EXIT_FAILURE);
+  }
+
+  tmpDir = tmpl;
+
+  try {
+    for (auto file : {"dispersionBlue.csv", "pxResolutionBlue.csv"})
+      writeFile(
+        tmpDir + "/" + file,
+        readFile(std::string(argv[1]) + "/" + file));
+
+    if (!DataFileManager::instance()->addSearchPath(argv[1])
+        || !DataFileManager::instance()->addSearchPath(tmpDir))
+      throw std::runtime_error("Cannot add search paths");
+
+    if (!ModelRegistry::instance()->watchDataFiles()) {
+      fprintf(stderr, "%s: data files cannot be watched, skipped\n", argv[0]);
+      ok = true;
+    } else {
+      ok = reloadBlueSlices(tmpDir);
+    }
+  } catch (std::runtime_error const &e) {
+    fprintf(stderr, "%s: %s\n", argv[0], e.what());
+  }
+
+  DataFileManager::instance()->stopWatching();
+
+  for (auto file : {"dispersionBlue.csv", "pxResolutionBlue.csv"})
+    unlink((tmpDir + "/" + file).c_str());
+  rmdir(tmpDir.c_str());
+
+  fprintf(stderr, "%s: blue slice reload: %s\n", argv[0], ok ? "OK" : "FAILED");
+
+  exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
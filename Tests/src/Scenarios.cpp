@@ -0,0 +1,258 @@
+//
+// Scenarios.cpp: End-to-end regression scenarios
+// Copyright (c) 2023 Gonzalo J. Carracedo <BatchDrake@gmail.com>
+// 
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#include <Regression.h>
+#include <Spectrum.h>
+#include <ModelRegistry.h>
+#include <InstrumentModel.h>
+#include <ThreadPool.h>
+#include <memory>
+#include <cmath>
+#include <ctime>
+
+#define SCENARIO_WL_MIN 300e-9
+#define SCENARIO_WL_MAX 1100e-9
+
+struct SpectralLine {
+  double wavelength; // nm
+  double amplitude;  // Relative to the continuum
+  double sigma;      // nm
+};
+
+// Continuum sampled in a regular grid, with Gaussian lines on top
+static Spectrum *
+makeSpectrum(
+  size_t points,
+  double (*continuum)(double),
+  std::vector<SpectralLine> const &lines)
+{
+  Spectrum *spectrum = new Spectrum();
+  std::vector<double> x(points), y(points);
+  double step = (SCENARIO_WL_MAX - SCENARIO_WL_MIN) / (points - 1);
+
+  for (size_t i = 0; i < points; ++i) {
+    double wl = SCENARIO_WL_MIN + i * step;
+    double c  = continuum(wl);
+    double v  = c;
+
+    for (auto const &line : lines) {
+      double d = (1e9 * wl - line.wavelength) / line.sigma;
+
+      // Lines are negligible beyond 8 sigma
+      if (fabs(d) < 8)
+        v += c * line.amplitude * exp(-.5 * d * d);
+    }
+
+    x[i] = wl;
+    y[i] = v;
+  }
+
+  spectrum->adopt(std::move(x), std::move(y));
+
+  return spectrum;
+}
+
+static double
+flatContinuum(double)
+{
+  return 1e-10;
+}
+
+// Black body at 5800 K, normalized at 550 nm, plus a small ripple
+static double
+solarContinuum(double wl)
+{
+  const double hc_kT = 6.62607015e-34 * 299792458. / (1.380649e-23 * 5800);
+  const double ref   = 550e-9;
+  double planck      = pow(ref / wl, 5) * expm1(hc_kT / ref) / expm1(hc_kT / wl);
+
+  return 1e-10 * planck * (1 + .02 * sin(wl * 3e8));
+}
+
+static Spectrum *
+flatInput()
+{
+  return makeSpectrum(801, flatContinuum, {});
+}
+
+static Spectrum *
+emissionLineInput()
+{
+  return makeSpectrum(
+    16001,
+    flatContinuum,
+    {
+      {486.13, 20,  .1}, // Hbeta
+      {495.89, 10,  .1}, // [OIII]
+      {500.68, 30,  .1}, // [OIII]
+      {656.28, 50,  .1}, // Halpha
+      {658.35, 15,  .1}, // [NII]
+      {671.64, 8,   .1}, // [SII]
+      {673.08, 6,   .1}, // [SII]
+      {906.86, 5,   .1}, // [SIII]
+      {953.11, 12,  .1}  // [SIII]
+    });
+}
+
+static Spectrum *
+templateInput()
+{
+  return makeSpectrum(
+    1000000,
+    solarContinuum,
+    {
+      {393.37, -.8, .3}, // Ca K
+      {396.85, -.7, .3}, // Ca H
+      {486.13, -.3, .2}, // Hbeta
+      {517.27, -.2, .1}, // Mg b
+      {588.99, -.4, .1}, // Na D2
+      {589.59, -.3, .1}, // Na D1
+      {656.28, -.4, .2}, // Halpha
+      {849.80, -.3, .2}, // Ca triplet
+      {854.21, -.4, .2},
+      {866.21, -.35, .2}
+    });
+}
+
+static SimulationParams
+scenarioParams(double airmass, double moon, double exposure, double rABmag)
+{
+  SimulationParams params;
+
+  params.airmass  = airmass;
+  params.moon     = moon;
+  params.exposure = exposure;
+  params.rABmag   = rABmag;
+
+  return params;
+}
+
+static const std::vector<Scenario> g_scenarios = {
+  {
+    "flat",
+    "Flat spectrum, 801 points",
+    scenarioParams(1, 0, 3600, 18),
+    flatInput
+  },
+  {
+    "line",
+    "Emission-line spectrum, 16001 points, half moon",
+    scenarioParams(1.5, 50, 3600, 20),
+    emissionLineInput
+  },
+  {
+    "template",
+    "Stellar template, 1M points",
+    scenarioParams(1.2, 20, 1800, 16),
+    templateInput
+  }
+};
+
+std::vector<Scenario> const &
+regressionScenarios()
+{
+  return g_scenarios;
+}
+
+static inline double
+monotonicTime()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+double
+ScenarioRun::pointsPerSecond() const
+{
+  return wallTime > 0 ? points * outputs.size() / wallTime : 0;
+}
+
+// Simulates every slice of both arms, keeping the outputs if requested
+static void
+simulatePass(
+  Spectrum const &input,
+  SimulationParams params,
+  std::vector<ScenarioOutput> *outputs)
+{
+  Simulation sim;
+
+  sim.setInput(input);
+  sim.normalizeToRMag(params.rABmag);
+
+  for (auto slice = 0; slice < TARSIS_SLICES; ++slice) {
+    params.slice = slice;
+    sim.setParams(params);
+
+    for (auto arm : {BlueArm, RedArm}) {
+      sim.simulateArm(arm);
+
+      if (outputs != nullptr) {
+        auto const &result = sim.result(arm);
+        outputs->push_back(
+          ScenarioOutput {arm, result.slice, result.signal, result.noise});
+      }
+    }
+  }
+}
+
+//
+// Fast scenarios are repeated until minTime is reached, and the best pass
+// is taken as the throughput. This keeps short runs from being dominated
+// by noise.
+//
+ScenarioRun
+runScenario(Scenario const &scenario, double minTime)
+{
+  ScenarioRun run;
+  std::unique_ptr<Spectrum> input(scenario.makeInput());
+  double total = 0;
+  auto registry = ModelRegistry::instance();
+
+  // Keep the models loaded for the whole scenario: loading them is not
+  // part of the throughput
+  auto skyModel    = registry->skyModel();
+  auto tarsisModel = registry->instrumentModel();
+  auto cousinsR    = registry->cousinsRFilter();
+
+  tarsisModel->loadAllSlices();
+
+  run.points  = input->size();
+  run.threads = ThreadPool::instance()->threads();
+
+  do {
+    double t0 = monotonicTime();
+    double elapsed;
+
+    simulatePass(
+      *input,
+      scenario.params,
+      run.outputs.empty() ? &run.outputs : nullptr);
+
+    elapsed = monotonicTime() - t0;
+    total  += elapsed;
+
+    if (run.wallTime == 0 || elapsed < run.wallTime)
+      run.wallTime = elapsed;
+  } while (total < minTime);
+
+  return run;
+}
@@ -0,0 +1,286 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <stdexcept>
+#include <getopt.h>
+#include <unistd.h>
+#include <DataFileManager.h>
+#include <Regression.h>
+
+#define MAX_REPORTED_MISMATCHES 20
+
+void
+help(const char *progName)
+{
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr, "\t%s [OPTIONS]\n\n", progName);
+  fprintf(stderr, "Simulates the regression scenarios in every slice of both arms,\n");
+  fprintf(stderr, "and checks the signal and noise against the golden outputs and\n");
+  fprintf(stderr, "the throughput against the stored baselines.\n\n");
+  fprintf(stderr, "OPTIONS can be any of the following:\n");
+  fprintf(stderr, "\t-d, --data-dir [DIR]       Add DIR to the data search paths\n");
+  fprintf(stderr, "\t-s, --scenario [NAME]      Run only the scenario NAME. May be\n");
+  fprintf(stderr, "\t                           given more than once\n");
+  fprintf(stderr, "\t-g, --golden-dir [DIR]     Read the golden outputs from DIR\n");
+  fprintf(stderr, "\t-b, --baselines [FILE]     Read the throughput baselines from FILE\n");
+  fprintf(stderr, "\t-e, --tolerance [REL]      Relative tolerance of the outputs\n");
+  fprintf(stderr, "\t                           (default 1e-6)\n");
+  fprintf(stderr, "\t-r, --max-slowdown [PCT]   Fail if the throughput is more than PCT\n");
+  fprintf(stderr, "\t                           percent below the baseline (default 30)\n");
+  fprintf(stderr, "\t-P, --no-perf              Do not check the throughput\n");
+  fprintf(stderr, "\t-u, --update               Write the golden outputs and baselines\n");
+  fprintf(stderr, "\t                           of this build instead of checking them\n");
+  fprintf(stderr, "\t-l, --list                 List the scenarios and exit\n\n");
+  fprintf(stderr, "\t--help                     This help\n");
+}
+
+static bool
+parseNumber(const char *arg, double &value)
+{
+  char *end;
+
+  value = strtod(arg, &end);
+
+  return *end == '\0' && value >= 0 && !std::isnan(value);
+}
+
+static bool
+selected(std::vector<std::string> const &names, const char *name)
+{
+  if (names.empty())
+    return true;
+
+  for (auto const &n : names)
+    if (n == name)
+      return true;
+
+  return false;
+}
+
+static bool
+checkGolden(
+  const char *progName,
+  std::string const &path,
+  ScenarioRun const &run,
+  double tolerance)
+{
+  auto errors = compareGolden(loadGolden(path), summarize(run), tolerance);
+
+  for (size_t i = 0; i < errors.size() && i < MAX_REPORTED_MISMATCHES; ++i)
+    fprintf(stderr, "%s:   %s\n", progName, errors[i].c_str());
+
+  if (errors.size() > MAX_REPORTED_MISMATCHES)
+    fprintf(
+      stderr,
+      "%s:   (%zu more mismatches)\n",
+      progName,
+      errors.size() - MAX_REPORTED_MISMATCHES);
+
+  fprintf(
+    stderr,
+    "%s:   golden outputs: %s\n",
+    progName,
+    errors.empty() ? "OK" : "MISMATCH");
+
+  return errors.empty();
+}
+
+static bool
+checkThroughput(
+  const char *progName,
+  ThroughputBaselines const &baselines,
+  Scenario const &scenario,
+  ScenarioRun const &run,
+  double maxSlowdown)
+{
+  auto it = baselines.find(scenario.name);
+
+  if (it == baselines.end()) {
+    fprintf(stderr, "%s:   throughput: no baseline\n", progName);
+    return false;
+  }
+
+  // Baselines measured with other thread counts are not comparable. Run
+  // with TARSIS_ETC_THREADS set accordingly, or skip the check with -P.
+  if (it->second.threads != run.threads) {
+    fprintf(
+      stderr,
+      "%s:   throughput: baseline is for %u threads, not %u\n",
+      progName,
+      it->second.threads,
+      run.threads);
+    return false;
+  }
+
+  double change = run.pointsPerSecond() / it->second.pointsPerSecond - 1;
+  bool ok = change >= -maxSlowdown;
+
+  fprintf(
+    stderr,
+    "%s:   throughput: %+.1f%% from baseline (%.3e points/s): %s\n",
+    progName,
+    1e2 * change,
+    it->second.pointsPerSecond,
+    ok ? "OK" : "REGRESSION");
+
+  return ok;
+}
+
+int
+main(int argc, char **argv)
+{
+  std::vector<std::string> names;
+  std::string goldenDir = REGRESSION_GOLDEN_DIR;
+  std::string baselinePath = REGRESSION_BASELINES;
+  ThroughputBaselines baselines;
+  double tolerance = 1e-6;
+  double maxSlowdown = 30;
+  bool perf = true;
+  bool update = false;
+  bool ok = true;
+  const char* const short_opt = "d:s:g:b:e:r:Pulh";
+  int opt;
+  const option long_opt[] = {
+    {"data-dir",     required_argument, nullptr, 'd'},
+    {"scenario",     required_argument, nullptr, 's'},
+    {"golden-dir",   required_argument, nullptr, 'g'},
+    {"baselines",    required_argument, nullptr, 'b'},
+    {"tolerance",    required_argument, nullptr, 'e'},
+    {"max-slowdown", required_argument, nullptr, 'r'},
+    {"no-perf",      no_argument,       nullptr, 'P'},
+    {"update",       no_argument,       nullptr, 'u'},
+    {"list",         no_argument,       nullptr, 'l'},
+    {"help",         no_argument,       nullptr, 'h'},
+    {nullptr,        no_argument,       nullptr, 0}
+  };
+
+  while ((opt = getopt_long(argc, argv, short_opt, long_opt, nullptr)) != -1) {
+    switch (opt) {
+      case 'd':
+        if (!DataFileManager::instance()->addSearchPath(optarg))
+          goto bad_option;
+        break;
+
+      case 's':
+        names.push_back(optarg);
+        break;
+
+      case 'g':
+        goldenDir = optarg;
+        break;
+
+      case 'b':
+        baselinePath = optarg;
+        break;
+
+      case 'e':
+        if (!parseNumber(optarg, tolerance)) {
+          fprintf(stderr, "%s: invalid tolerance `%s'\n", argv[0], optarg);
+          goto bad_option;
+        }
+        break;
+
+      case 'r':
+        if (!parseNumber(optarg, maxSlowdown)) {
+          fprintf(stderr, "%s: invalid slowdown `%s'\n", argv[0], optarg);
+          goto bad_option;
+        }
+        break;
+
+      case 'P':
+        perf = false;
+        break;
+
+      case 'u':
+        update = true;
+        break;
+
+      case 'l':
+        for (auto const &s : regressionScenarios())
+          printf("%-10s %s\n", s.name, s.description);
+        exit(EXIT_SUCCESS);
+
+      case 'h':
+        help(argv[0]);
+        exit(EXIT_SUCCESS);
+
+      case '?':
+        help(argv[0]);
+        goto bad_option;
+    }
+  }
+
+  if (optind < argc) {
+    fprintf(stderr, "%s: unexpected arguments\n", argv[0]);
+    goto bad_option;
+  }
+
+  for (auto const &n : names) {
+    bool found = false;
+
+    for (auto const &s : regressionScenarios())
+      if (n == s.name)
+        found = true;
+
+    if (!found) {
+      fprintf(stderr, "%s: unknown scenario `%s'\n", argv[0], n.c_str());
+      goto bad_option;
+    }
+  }
+
+  try {
+    // When updating, baselines of the scenarios not run are kept
+    if ((perf && !update) || access(baselinePath.c_str(), F_OK) == 0)
+      baselines = loadBaselines(baselinePath);
+
+    for (auto const &scenario : regressionScenarios()) {
+      if (!selected(names, scenario.name))
+        continue;
+
+      std::string goldenPath = goldenDir + "/" + scenario.name + ".yaml";
+      ScenarioRun run = runScenario(scenario);
+
+      fprintf(
+        stderr,
+        "%s: %s: %zu outputs in %.3f s, %.3e points/s on %u threads\n",
+        argv[0],
+        scenario.name,
+        run.outputs.size(),
+        run.wallTime,
+        run.pointsPerSecond(),
+        run.threads);
+
+      if (update) {
+        saveGolden(goldenPath, scenario, summarize(run));
+        baselines[scenario.name] =
+          ThroughputBaseline {run.pointsPerSecond(), run.threads};
+        continue;
+      }
+
+      if (!checkGolden(argv[0], goldenPath, run, tolerance))
+        ok = false;
+
+      if (perf
+          && !checkThroughput(
+            argv[0],
+            baselines,
+            scenario,
+            run,
+            1e-2 * maxSlowdown))
+        ok = false;
+    }
+
+    if (update)
+      saveBaselines(baselinePath, baselines);
+  } catch (std::runtime_error const &e) {
+    fprintf(stderr, "%s: %s\n", argv[0], e.what());
+    exit(EXIT_FAILURE);
+  }
+
+  exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+
+bad_option:
+  fprintf(stderr, "Type `%s --help` for help\n", argv[0]);
+  exit(EXIT_FAILURE);
+}